@@ -0,0 +1,407 @@
+// CPU microbenchmarks of the demo's per-frame and startup hot paths. Built and
+// run with `make bench`, which links the src/ units (except main.c) with
+// OpenGL calls stubbed out (gl_stubs.c), so this runs without a GPU or audio.
+//
+// Every benchmark first finds how many iterations take at least
+// BATCH_SECONDS, runs WARMUP batches of them, and then times SAMPLES batches.
+// The results are the median time per iteration and the median absolute
+// deviation (MAD) from it, which unlike the mean and standard deviation
+// don't get thrown off by a few batches which the OS interrupted.
+//
+// Results get written as JSON to the file given as the first argument, or
+// to stdout, and as a table to stderr.
+
+// demo.c gets included to reach its static functions
+#include "../src/demo.c"
+#include "filesystem.h"
+#include "preprocessor.h"
+#include "rand.h"
+#include "sync_tracks.h"
+
+// Only declarations, music_player.c includes the implementation
+#define STB_VORBIS_HEADER_ONLY
+#include "stb_vorbis.c"
+
+#define WARMUP 5
+#define SAMPLES 51
+#define BATCH_SECONDS 0.002
+
+// A benchmark runs `fn` once per iteration. `setup` prepares `state` before
+// the benchmark, and returns 0 when the benchmark can't run (for example
+// when its input file is missing).
+typedef struct {
+    const char *name;
+    int (*setup)(void *state);
+    void (*fn)(void *state);
+    void (*teardown)(void *state);
+} bench_t;
+
+typedef struct {
+    const char *name;
+    int skipped;
+    uint64_t iterations;
+    double median_ns, mad_ns, min_ns;
+} result_t;
+
+// Keeps the compiler from optimizing away results which nothing reads
+static volatile uint64_t sink;
+
+// preprocess_glsl
+// ----------------------------------------------------------------------------
+
+typedef struct {
+    char *src;
+    size_t len;
+} preprocess_state_t;
+
+static int preprocess_setup(void *state) {
+    preprocess_state_t *s = state;
+    s->len = read_file("shaders/shader.frag", &s->src);
+    return s->len > 0;
+}
+
+static void preprocess_run(void *state) {
+    preprocess_state_t *s = state;
+    const shader_define_t define = {.name = "GEOMETRY_PASS", .value = "1"};
+    const char *processed = preprocess_glsl(s->src, s->len, GLSL_VERSION,
+                                            "shaders", &define, 1);
+    sink += processed ? processed[0] : 0;
+    free((void *)processed);
+}
+
+static void preprocess_teardown(void *state) {
+    free(((preprocess_state_t *)state)->src);
+}
+
+// read_file and map_file (filesystem_open in SELF_CONTAINED builds)
+// ----------------------------------------------------------------------------
+
+static void read_file_run(void *state) {
+    char *data = NULL;
+    sink += read_file("shaders/shader.frag", &data);
+    free(data);
+}
+
+static void map_file_run(void *state) {
+    size_t len = 0;
+    const void *data = map_file("shaders/shader.frag", &len);
+    sink += len;
+    unmap_file(data);
+}
+
+// Noise texture fill, like begin_frame
+// ----------------------------------------------------------------------------
+
+static void noise_run(void *state) {
+    static unsigned char noise[NOISE_SIZE * NOISE_SIZE * 4];
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        noise[i] = rand_xoshiro();
+    }
+    sink += noise[0];
+}
+
+// rocket_track_name
+// ----------------------------------------------------------------------------
+
+static void track_name_run(void *state) {
+    static const uniform_t ufm = {
+        .type = GL_FLOAT_VEC3, .name_len = 9, .name = "r_Cam.Pos"};
+    sink += rocket_track_name(&ufm, 'x')[0];
+    sink += rocket_track_name(&ufm, 'y')[0];
+    sink += rocket_track_name(&ufm, 'z')[0];
+}
+
+// Vorbis decoding, one second of music per iteration, and seeking to a
+// random sample. Each runs on the music opened from memory (map_file), like
+// music_player.c and spectrum.c do, and opened with stb_vorbis_open_filename
+// for comparison. In SELF_CONTAINED builds the latter reads through the
+// wrapped stdio (filesystem.c).
+// ----------------------------------------------------------------------------
+
+typedef struct {
+    const void *file;
+    size_t len;
+    stb_vorbis *vorbis;
+    unsigned length;
+    float samples[4096 * 2];
+} vorbis_state_t;
+
+static int vorbis_setup(void *state) {
+    vorbis_state_t *s = state;
+    s->file = map_file("data/music.ogg", &s->len);
+    if (!s->file) {
+        return 0;
+    }
+    int error = 0;
+    s->vorbis = stb_vorbis_open_memory(s->file, (int)s->len, &error, NULL);
+    if (!s->vorbis) {
+        return 0;
+    }
+    s->length = stb_vorbis_stream_length_in_samples(s->vorbis);
+    return s->length > 0;
+}
+
+static int vorbis_stdio_setup(void *state) {
+    vorbis_state_t *s = state;
+    int error = 0;
+    s->vorbis = stb_vorbis_open_filename("data/music.ogg", &error, NULL);
+    if (!s->vorbis) {
+        return 0;
+    }
+    s->length = stb_vorbis_stream_length_in_samples(s->vorbis);
+    return s->length > 0;
+}
+
+static void vorbis_run(void *state) {
+    vorbis_state_t *s = state;
+    stb_vorbis_info info = stb_vorbis_get_info(s->vorbis);
+    stb_vorbis_seek_start(s->vorbis);
+    for (unsigned decoded = 0; decoded < info.sample_rate;) {
+        int frames = stb_vorbis_get_samples_float_interleaved(
+            s->vorbis, 2, s->samples, sizeof(s->samples) / sizeof(float));
+        if (frames == 0) {
+            break;
+        }
+        decoded += frames;
+    }
+    sink += s->samples[0] != 0.f;
+}
+
+// Seeks like scrubbing in the editor does (see music_player.c), and decodes
+// the first samples there
+static void vorbis_seek_run(void *state) {
+    vorbis_state_t *s = state;
+    stb_vorbis_seek(s->vorbis, rand_xoshiro() % s->length);
+    sink += stb_vorbis_get_samples_float_interleaved(s->vorbis, 2, s->samples,
+                                                     256);
+}
+
+static void vorbis_teardown(void *state) {
+    vorbis_state_t *s = state;
+    if (s->vorbis) {
+        stb_vorbis_close(s->vorbis);
+    }
+    unmap_file(s->file);
+}
+
+// Per-frame uniform evaluation with set_rocket_uniforms, for a program with
+// a typical set of rocket uniforms. GL calls are stubs, so this measures
+// looking up and evaluating the tracks.
+// ----------------------------------------------------------------------------
+
+typedef struct {
+    demo_t demo;
+    program_t program;
+    uniform_t uniforms[6];
+    struct sync_device *rocket;
+    double row;
+} uniforms_state_t;
+
+static void add_uniform(uniforms_state_t *s, GLenum type, const char *name) {
+    uniform_t *ufm = s->uniforms + s->program.uniform_count++;
+    *ufm = (uniform_t){.type = type, .block_index = -1};
+    ufm->name_len = strlen(name);
+    memcpy(ufm->name, name, ufm->name_len + 1);
+}
+
+static int uniforms_setup(void *state) {
+    uniforms_state_t *s = state;
+    s->program.uniforms = s->uniforms;
+    add_uniform(s, GL_FLOAT_VEC3, "r_Cam.Pos");
+    add_uniform(s, GL_FLOAT_VEC3, "r_Cam.Target");
+    add_uniform(s, GL_FLOAT, "r_Cam.Fov");
+    add_uniform(s, GL_FLOAT_VEC3, "p_Cam.Pos");
+    add_uniform(s, GL_FLOAT_VEC3, "p_Cam.Target");
+    add_uniform(s, GL_FLOAT, "r_AnimationTime");
+    // Rocket's tracks without an editor connection, like debug builds before
+    // the editor is started
+    s->rocket = sync_create_device("data/sync");
+    return s->rocket != NULL;
+}
+
+static void uniforms_run(void *state) {
+    uniforms_state_t *s = state;
+    s->row += 0.25;
+    set_rocket_uniforms(&s->demo, &s->program, s->rocket, s->row,
+                        s->row - 0.25);
+}
+
+static void uniforms_teardown(void *state) {
+    uniforms_state_t *s = state;
+    if (s->rocket) {
+        sync_destroy_device(s->rocket);
+    }
+}
+
+// Baked sync tracks, evaluated once per frame in release builds. Needs
+// data/sync.tracks (see scripts/bake_sync.py).
+// ----------------------------------------------------------------------------
+
+typedef struct {
+    sync_tracks_t *tracks;
+    float *values;
+    double row;
+} tracks_state_t;
+
+static int tracks_setup(void *state) {
+    tracks_state_t *s = state;
+    s->tracks = sync_tracks_load("data/sync.tracks");
+    if (!s->tracks) {
+        return 0;
+    }
+    s->values = calloc(sync_tracks_count(s->tracks) + 1, sizeof(float));
+    return s->values != NULL;
+}
+
+static void tracks_run(void *state) {
+    tracks_state_t *s = state;
+    s->row += 0.25;
+    sync_tracks_evaluate(s->tracks, s->row, s->values);
+}
+
+static void tracks_teardown(void *state) {
+    tracks_state_t *s = state;
+    sync_tracks_deinit(s->tracks);
+    free(s->values);
+}
+
+// ----------------------------------------------------------------------------
+
+static const bench_t benches[] = {
+    {"preprocess_glsl", preprocess_setup, preprocess_run, preprocess_teardown},
+    {"read_file", NULL, read_file_run, NULL},
+    {"map_file", NULL, map_file_run, NULL},
+    {"noise_fill", NULL, noise_run, NULL},
+    {"rocket_track_name", NULL, track_name_run, NULL},
+    {"vorbis_decode_1s", vorbis_setup, vorbis_run, vorbis_teardown},
+    {"vorbis_decode_1s_stdio", vorbis_stdio_setup, vorbis_run,
+     vorbis_teardown},
+    {"vorbis_seek", vorbis_setup, vorbis_seek_run, vorbis_teardown},
+    {"vorbis_seek_stdio", vorbis_stdio_setup, vorbis_seek_run,
+     vorbis_teardown},
+    {"set_rocket_uniforms", uniforms_setup, uniforms_run, uniforms_teardown},
+    {"sync_tracks_evaluate", tracks_setup, tracks_run, tracks_teardown},
+};
+
+#define BENCHES (sizeof(benches) / sizeof(*benches))
+
+// Large enough for any benchmark's state
+static union {
+    preprocess_state_t preprocess;
+    vorbis_state_t vorbis;
+    uniforms_state_t uniforms;
+    tracks_state_t tracks;
+} state;
+
+static double seconds(uint64_t counter_diff) {
+    return (double)counter_diff / SDL_GetPerformanceFrequency();
+}
+
+// Times one batch of `iterations`, returns seconds
+static double run_batch(const bench_t *bench, uint64_t iterations) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->fn(&state);
+    }
+    return seconds(SDL_GetPerformanceCounter() - start);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts `values` and returns their median
+static double median(double *values, size_t count) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2]
+                     : (values[count / 2 - 1] + values[count / 2]) / 2.;
+}
+
+static result_t run_bench(const bench_t *bench) {
+    result_t result = {.name = bench->name};
+    memset(&state, 0, sizeof(state));
+    if (bench->setup && !bench->setup(&state)) {
+        result.skipped = 1;
+        if (bench->teardown) {
+            bench->teardown(&state);
+        }
+        return result;
+    }
+
+    // Double the batch until it's long enough for the timer's resolution
+    uint64_t iterations = 1;
+    while (run_batch(bench, iterations) < BATCH_SECONDS) {
+        iterations *= 2;
+    }
+    for (int i = 0; i < WARMUP; i++) {
+        run_batch(bench, iterations);
+    }
+
+    double times[SAMPLES], deviations[SAMPLES];
+    for (int i = 0; i < SAMPLES; i++) {
+        times[i] = run_batch(bench, iterations) * 1e9 / iterations;
+    }
+    result.iterations = iterations;
+    result.median_ns = median(times, SAMPLES);
+    result.min_ns = times[0];
+    for (int i = 0; i < SAMPLES; i++) {
+        deviations[i] = fabs(times[i] - result.median_ns);
+    }
+    result.mad_ns = median(deviations, SAMPLES);
+
+    if (bench->teardown) {
+        bench->teardown(&state);
+    }
+    return result;
+}
+
+static void write_json(FILE *file, const result_t *results, size_t count) {
+    fprintf(file, "{\n  \"warmup\": %d,\n  \"samples\": %d,\n", WARMUP,
+            SAMPLES);
+    fprintf(file, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < count; i++) {
+        const result_t *r = results + i;
+        fprintf(file, "    {\"name\": \"%s\", ", r->name);
+        if (r->skipped) {
+            fprintf(file, "\"skipped\": true}");
+        } else {
+            fprintf(file,
+                    "\"iterations\": %llu, \"median_ns\": %.1f, "
+                    "\"mad_ns\": %.1f, \"min_ns\": %.1f}",
+                    (unsigned long long)r->iterations, r->median_ns,
+                    r->mad_ns, r->min_ns);
+        }
+        fprintf(file, i + 1 < count ? ",\n" : "\n");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+// The benchmarks read files relative to the repository's root, where
+// `make bench` runs this
+int main(int argc, char *argv[]) {
+    result_t results[BENCHES];
+    fprintf(stderr, "%-22s %14s %12s %12s\n", "benchmark", "median ns",
+            "MAD ns", "min ns");
+    for (size_t i = 0; i < BENCHES; i++) {
+        results[i] = run_bench(benches + i);
+        if (results[i].skipped) {
+            fprintf(stderr, "%-22s %14s\n", results[i].name, "skipped");
+        } else {
+            fprintf(stderr, "%-22s %14.1f %12.1f %12.1f\n", results[i].name,
+                    results[i].median_ns, results[i].mad_ns,
+                    results[i].min_ns);
+        }
+    }
+
+    FILE *file = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    write_json(file, results, BENCHES);
+    if (file != stdout && fclose(file) != 0) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
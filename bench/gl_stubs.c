@@ -0,0 +1,303 @@
+// No-op OpenGL entry points for the CPU microbenchmarks (bench.c), so that the
+// src/ units link without a GL library or context. Object names count up
+// from 1, queries return zeroes, and framebuffers are always complete. Calls
+// which the benchmarks time (glUniform*) do nothing, so their results measure
+// only the demo's own CPU work of looking up and evaluating the values.
+
+#include "gl.h"
+#include <stddef.h>
+
+void glActiveTexture(GLenum texture) {}
+
+void glAttachShader(GLuint program, GLuint shader) {}
+
+void glBeginQuery(GLenum target, GLuint id) {}
+
+void glBindBuffer(GLenum target, GLuint buffer) {}
+
+void glBindBufferBase(GLenum target, GLuint index, GLuint buffer) {}
+
+void glBindFramebuffer(GLenum target, GLuint framebuffer) {}
+
+void glBindImageTexture(GLuint unit, GLuint texture, GLint level,
+                        GLboolean layered, GLint layer, GLenum access,
+                        GLenum format) {}
+
+void glBindRenderbuffer(GLenum target, GLuint renderbuffer) {}
+
+void glBindTexture(GLenum target, GLuint texture) {}
+
+void glBindVertexArray(GLuint array) {}
+
+void glBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+                       GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1,
+                       GLbitfield mask, GLenum filter) {}
+
+void glBufferData(GLenum target, GLsizeiptr size, const void *data,
+                  GLenum usage) {}
+
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
+                     const void *data) {}
+
+GLenum glCheckFramebufferStatus(GLenum target) {
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+
+void glClear(GLbitfield mask) {}
+
+void glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) {}
+
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    return GL_ALREADY_SIGNALED;
+}
+
+void glCompileShader(GLuint shader) {}
+
+void glCompressedTexImage2D(GLenum target, GLint level, GLenum internalformat,
+                            GLsizei width, GLsizei height, GLint border,
+                            GLsizei imageSize, const GLvoid *data) {}
+
+void glCompressedTexSubImage2D(GLenum target, GLint level, GLint xoffset,
+                               GLint yoffset, GLsizei width, GLsizei height,
+                               GLenum format, GLsizei imageSize,
+                               const GLvoid *data) {}
+
+GLuint glCreateProgram(void) {
+    return 1;
+}
+
+GLuint glCreateShader(GLenum type) {
+    return 1;
+}
+
+void glDeleteBuffers(GLsizei n, const GLuint *buffers) {}
+
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers) {}
+
+void glDeleteProgram(GLuint program) {}
+
+void glDeleteQueries(GLsizei n, const GLuint *ids) {}
+
+void glDeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers) {}
+
+void glDeleteShader(GLuint shader) {}
+
+void glDeleteSync(GLsync sync) {}
+
+void glDeleteTextures(GLsizei n, const GLuint *textures) {}
+
+void glDeleteVertexArrays(GLsizei n, const GLuint *arrays) {}
+
+void glDepthFunc(GLenum func) {}
+
+void glDisable(GLenum cap) {}
+
+void glDispatchCompute(GLuint num_groups_x, GLuint num_groups_y,
+                       GLuint num_groups_z) {}
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count) {}
+
+void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count,
+                           GLsizei instancecount) {}
+
+void glDrawBuffers(GLsizei n, const GLenum *bufs) {}
+
+void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+                             const void *indices, GLsizei instancecount) {}
+
+void glEnable(GLenum cap) {}
+
+void glEnableVertexAttribArray(GLuint index) {}
+
+void glEndQuery(GLenum target) {}
+
+GLsync glFenceSync(GLenum condition, GLbitfield flags) {
+    return (GLsync)1;
+}
+
+void glFramebufferRenderbuffer(GLenum target, GLenum attachment,
+                               GLenum renderbuffertarget, GLuint renderbuffer) {}
+
+void glFramebufferTexture2D(GLenum target, GLenum attachment,
+                            GLenum textarget, GLuint texture, GLint level) {}
+
+void glGenBuffers(GLsizei n, GLuint *buffers) {
+    for (GLsizei i = 0; i < n; i++) {
+        buffers[i] = i + 1;
+    }
+}
+
+void glGenFramebuffers(GLsizei n, GLuint *framebuffers) {
+    for (GLsizei i = 0; i < n; i++) {
+        framebuffers[i] = i + 1;
+    }
+}
+
+void glGenQueries(GLsizei n, GLuint *ids) {
+    for (GLsizei i = 0; i < n; i++) {
+        ids[i] = i + 1;
+    }
+}
+
+void glGenRenderbuffers(GLsizei n, GLuint *renderbuffers) {
+    for (GLsizei i = 0; i < n; i++) {
+        renderbuffers[i] = i + 1;
+    }
+}
+
+void glGenTextures(GLsizei n, GLuint *textures) {
+    for (GLsizei i = 0; i < n; i++) {
+        textures[i] = i + 1;
+    }
+}
+
+void glGenVertexArrays(GLsizei n, GLuint *arrays) {
+    for (GLsizei i = 0; i < n; i++) {
+        arrays[i] = i + 1;
+    }
+}
+
+void glGenerateMipmap(GLenum target) {}
+
+void glGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize,
+                        GLsizei *length, GLint *size, GLenum *type,
+                        GLchar *name) {
+    *length = *size = 0;
+    *type = 0;
+}
+
+void glGetActiveUniformBlockiv(GLuint program, GLuint uniformBlockIndex,
+                               GLenum pname, GLint *params) {
+    *params = 0;
+}
+
+void glGetActiveUniformsiv(GLuint program, GLsizei uniformCount,
+                           const GLuint *uniformIndices, GLenum pname,
+                           GLint *params) {}
+
+void glGetAttachedShaders(GLuint program, GLsizei maxCount, GLsizei *count,
+                          GLuint *shaders) {
+    *count = 0;
+}
+
+void glGetIntegerv(GLenum pname, GLint *params) {
+    *params = 0;
+}
+
+void glGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei *length,
+                         GLchar *infoLog) {
+    if (length) {
+        *length = 0;
+    }
+    if (bufSize > 0) {
+        infoLog[0] = '\0';
+    }
+}
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
+    *params = 0;
+}
+
+#ifndef GLES
+void glGetQueryObjectiv(GLuint id, GLenum pname, GLint *params) {
+    *params = 0;
+}
+#endif
+
+#ifndef GLES
+void glGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params) {
+    *params = 0;
+}
+#endif
+
+void glGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei *length,
+                        GLchar *infoLog) {
+    if (length) {
+        *length = 0;
+    }
+    if (bufSize > 0) {
+        infoLog[0] = '\0';
+    }
+}
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
+    *params = 0;
+}
+
+const GLubyte *glGetStringi(GLenum name, GLuint index) {
+    return NULL;
+}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name) {
+    return -1;
+}
+
+void glLinkProgram(GLuint program) {}
+
+void *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length,
+                       GLbitfield access) {
+    return NULL;
+}
+
+void glMemoryBarrier(GLbitfield barriers) {}
+
+void glPixelStorei(GLenum pname, GLint param) {}
+
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height,
+                  GLenum format, GLenum type, GLvoid *pixels) {}
+
+void glRenderbufferStorage(GLenum target, GLenum internalformat,
+                           GLsizei width, GLsizei height) {}
+
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const*string,
+                    const GLint *length) {}
+
+void glTexImage2D(GLenum target, GLint level, GLint internalFormat,
+                  GLsizei width, GLsizei height, GLint border, GLenum format,
+                  GLenum type, const GLvoid *pixels) {}
+
+void glTexImage3D(GLenum target, GLint level, GLint internalformat,
+                  GLsizei width, GLsizei height, GLsizei depth, GLint border,
+                  GLenum format, GLenum type, const void *pixels) {}
+
+void glTexParameteri(GLenum target, GLenum pname, GLint param) {}
+
+void glTexStorage2D(GLenum target, GLsizei levels, GLenum internalformat,
+                    GLsizei width, GLsizei height) {}
+
+void glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+                     GLsizei width, GLsizei height, GLenum format,
+                     GLenum type, const GLvoid *pixels) {}
+
+void glUniform1f(GLint location, GLfloat v0) {}
+
+void glUniform1fv(GLint location, GLsizei count, const GLfloat *value) {}
+
+void glUniform1i(GLint location, GLint v0) {}
+
+void glUniform1iv(GLint location, GLsizei count, const GLint *value) {}
+
+void glUniform2f(GLint location, GLfloat v0, GLfloat v1) {}
+
+void glUniform2fv(GLint location, GLsizei count, const GLfloat *value) {}
+
+void glUniform3fv(GLint location, GLsizei count, const GLfloat *value) {}
+
+void glUniform4fv(GLint location, GLsizei count, const GLfloat *value) {}
+
+void glUniformBlockBinding(GLuint program, GLuint uniformBlockIndex,
+                           GLuint uniformBlockBinding) {}
+
+GLboolean glUnmapBuffer(GLenum target) {
+    return GL_TRUE;
+}
+
+void glUseProgram(GLuint program) {}
+
+void glVertexAttribDivisor(GLuint index, GLuint divisor) {}
+
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type,
+                           GLboolean normalized, GLsizei stride,
+                           const void *pointer) {}
+
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {}
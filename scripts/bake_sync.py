@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Bakes rocket tracks into one binary file which release builds load without
+# parsing (src/sync_tracks.c). Input is either the rocket editor's XML file
+# (sync.rocket) or the .track files which the demo saves (data/sync_*.track).
+#
+# Usage: scripts/bake_sync.py data/sync.rocket > data/sync.tracks
+#        scripts/bake_sync.py data/sync_*.track > data/sync.tracks
+#
+# File layout (little endian, every section starts at a multiple of 16 bytes):
+#   header:  char magic[4] = "TRKS", uint32 version, track_count, key_count,
+#            rows_offset, values_offset, types_offset, names_offset
+#   tracks:  track_count * (uint32 first_key, key_count, name_offset),
+#            right after the header
+#   rows:    key_count * int32
+#   values:  key_count * float32
+#   types:   key_count * uint8 (interpolation: step, linear, smooth, ramp)
+#   names:   null-terminated track names
+# Tracks are sorted by name, and every track's keys are sorted by row.
+
+import os
+import re
+import struct
+import sys
+import xml.etree.ElementTree as ET
+
+VERSION = 1
+HEADER = struct.Struct("<4s7I")
+TRACK = struct.Struct("<3I")
+
+
+def read_xml(path):
+    tracks = {}
+    for track in ET.parse(path).getroot().iter("track"):
+        keys = [(int(k.get("row")), float(k.get("value")),
+                 int(k.get("interpolation"))) for k in track.iter("key")]
+        tracks[track.get("name")] = keys
+    return tracks
+
+
+# Rocket escapes characters such as ':' in track file names as -XX (hex)
+def decode_name(path):
+    name = os.path.basename(path)
+    name = name[name.index("_") + 1:-len(".track")]
+    return re.sub("-([0-9a-fA-F]{2})", lambda m: chr(int(m.group(1), 16)),
+                  name)
+
+
+def read_track(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    (count,) = struct.unpack_from("<i", data)
+    return [struct.unpack_from("<ifB", data, 4 + i * 9) for i in range(count)]
+
+
+def align(data):
+    return data + b"\0" * (-len(data) % 16)
+
+
+tracks = {}
+for path in sys.argv[1:]:
+    if path.endswith(".track"):
+        tracks[decode_name(path)] = read_track(path)
+    else:
+        tracks.update(read_xml(path))
+
+rows, values, types, names = [], [], [], b""
+table = b""
+for name in sorted(tracks):
+    keys = sorted(tracks[name])
+    table += TRACK.pack(len(rows), len(keys), len(names))
+    names += name.encode() + b"\0"
+    for row, value, interpolation in keys:
+        rows.append(row)
+        values.append(value)
+        types.append(interpolation)
+
+sections = [align(table),
+            align(struct.pack(f"<{len(rows)}i", *rows)),
+            align(struct.pack(f"<{len(values)}f", *values)),
+            align(bytes(types)),
+            align(names)]
+offsets = []
+offset = len(align(bytes(HEADER.size)))
+for section in sections:
+    offsets.append(offset)
+    offset += len(section)
+
+header = HEADER.pack(b"TRKS", VERSION, len(tracks), len(rows), *offsets[1:])
+sys.stdout.buffer.write(align(header) + b"".join(sections))
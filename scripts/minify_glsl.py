@@ -0,0 +1,370 @@
+#!/usr/bin/env python3
+# Minifies the shaders which self-contained builds embed (see the data.c rule
+# in the Makefile). For every shader stage in the input directory (.vert,
+# .frag, .comp) this resolves #include directives the same way src/preprocessor.c
+# does, strips comments and whitespace, removes functions which nothing
+# reachable from main() calls, and renames function parameters and local
+# variables to short names.
+#
+# Preprocessor directives are kept as they are, because demo.c compiles the
+# same files with different #defines at runtime. Functions and locals which
+# appear in any directive are never removed or renamed, and functions in
+# every #if branch count as reachable.
+#
+# Usage: scripts/minify_glsl.py shaders/ build/shaders/ build/shader_maps/
+#
+# The third directory gets a .map file for each shader, which tells where
+# the minified code came from. Every line of a map is
+#   minified_line:column source_file:line
+# for the first token that came from a new source line. The minified line
+# numbers are the ones which shader compile errors report, because
+# preprocess_glsl starts the source with #line 1.
+
+import os
+import re
+import sys
+
+STAGES = (".vert", ".frag", ".comp")
+
+TOKEN = re.compile(r"""
+    (?P<space>[ \t\r\f\v]+|\n)
+  | (?P<comment>//[^\n]*|/\*.*?\*/)
+  | (?P<number>0[xX][0-9a-fA-F]+[uU]?
+              |(?:\d+\.\d*|\.\d+|\d+)(?:[eE][+-]?\d+)?[uUfF]?)
+  | (?P<ident>[A-Za-z_]\w*)
+  | (?P<op><<=|>>=|\+\+|--|<<|>>|<=|>=|==|!=|&&|\|\||\^\^
+           |\+=|-=|\*=|/=|%=|&=|\|=|\^=|[^\s\w])
+""", re.X | re.S)
+
+# Pairs of characters which would lex differently without a space between
+# two operator tokens
+MERGING = {"++", "--", "+=", "-=", "*=", "/=", "%=", "<=", ">=", "==", "!=",
+           "&&", "||", "^^", "<<", ">>", "&=", "|=", "^=", "//", "/*", "*/"}
+
+# Names which a renamed variable must never get
+KEYWORDS = {"do", "if", "in", "for", "int", "out", "asm", "new", "not", "and",
+            "or"}
+
+TYPES = {"void", "bool", "int", "uint", "float", "double", "vec2", "vec3",
+         "vec4", "ivec2", "ivec3", "ivec4", "uvec2", "uvec3", "uvec4",
+         "bvec2", "bvec3", "bvec4", "mat2", "mat3", "mat4", "mat2x2",
+         "mat2x3", "mat2x4", "mat3x2", "mat3x3", "mat3x4", "mat4x2",
+         "mat4x3", "mat4x4"}
+
+
+class Token:
+    def __init__(self, kind, text, path, line):
+        self.kind, self.text, self.path, self.line = kind, text, path, line
+
+
+def tokenize(filename, directory):
+    path = os.path.normpath(os.path.join(directory, filename))
+    with open(path) as f:
+        src = f.read()
+    tokens = []
+    line, pos, line_start = 1, 0, True
+    while pos < len(src):
+        # Directives take the rest of the line
+        if line_start and src[pos] == "#":
+            end = src.find("\n", pos)
+            end = len(src) if end < 0 else end
+            text = re.sub(r"//.*|/\*.*?\*/", "", src[pos:end]).strip()
+            include = re.match(r'#\s*include\s+"([^"]+)"', text)
+            if include:
+                tokens += tokenize(include.group(1), directory)
+            else:
+                tokens.append(Token("directive", text, path, line))
+            pos = end
+            continue
+        m = TOKEN.match(src, pos)
+        kind, text = m.lastgroup, m.group()
+        pos = m.end()
+        if kind == "space" or kind == "comment":
+            line += text.count("\n")
+            if "\n" in text:
+                line_start = True
+            continue
+        tokens.append(Token(kind, text, path, line))
+        line_start = False
+    return tokens
+
+
+# 1.0 -> 1., 0.50 -> .5
+def shorten_number(text):
+    if "." not in text or re.search("[eExXuUfF]", text):
+        return text
+    whole, frac = text.split(".")
+    text = whole.lstrip("0") + "." + frac.rstrip("0")
+    return "0." if text == "." else text
+
+
+def needs_space(prev, cur):
+    a, b = prev.text[-1], cur.text[0]
+    word = lambda c: c.isalnum() or c == "_"
+    if word(a) and word(b):
+        return True
+    # 1. e would lex as an exponent, a .5 as member access
+    if prev.kind == "number" and a == "." and word(b):
+        return True
+    if cur.kind == "number" and b == "." and word(a):
+        return True
+    return prev.kind == "op" and cur.kind == "op" and a + b in MERGING
+
+
+def minify_directive(text):
+    m = re.match(r"#\s*(\w+)\s*(.*)", text)
+    if not m:
+        return text
+    keyword, rest = m.groups()
+    if not rest:
+        return "#" + keyword
+    if keyword == "define":
+        # Function-like macros have no space before the parameter list
+        m = re.match(r"(\w+(?:\([^)]*\))?)\s*(.*)", rest)
+        name = re.sub(r"\s+", "", m.group(1))
+        return f"#define {name} {join(tokens_of(m.group(2)))}".rstrip()
+    return f"#{keyword} {join(tokens_of(rest))}"
+
+
+def tokens_of(text):
+    tokens = []
+    for m in TOKEN.finditer(text):
+        if m.lastgroup == "number":
+            tokens.append(Token("number", shorten_number(m.group()), "", 0))
+        elif m.lastgroup not in ("space", "comment"):
+            tokens.append(Token(m.lastgroup, m.group(), "", 0))
+    return tokens
+
+
+def join(tokens):
+    out = ""
+    prev = None
+    for token in tokens:
+        if prev and needs_space(prev, token):
+            out += " "
+        out += token.text
+        prev = token
+    return out
+
+
+# Index of the token which closes the bracket at tokens[i]
+def matching(tokens, i):
+    pairs = {"(": ")", "{": "}", "[": "]"}
+    opening, closing = tokens[i].text, pairs[tokens[i].text]
+    depth = 0
+    for j in range(i, len(tokens)):
+        if tokens[j].kind != "op":
+            continue
+        if tokens[j].text == opening:
+            depth += 1
+        elif tokens[j].text == closing:
+            depth -= 1
+            if depth == 0:
+                return j
+    sys.exit(f"{tokens[i].path}:{tokens[i].line}: unmatched {opening}")
+
+
+# Splits the top level into items: directives, declarations and functions.
+# Returns a list of dicts with the item's tokens, and for functions and
+# prototypes, the function's name and the index of its parameter list.
+def split_items(tokens):
+    items, start, i = [], 0, 0
+    while i < len(tokens):
+        token = tokens[i]
+        if token.kind == "directive" and i == start:
+            items.append({"tokens": [token]})
+            start = i = i + 1
+            continue
+        if token.text == "(" and token.kind == "op":
+            close = matching(tokens, i)
+            name = tokens[i - 1] if i > start else None
+            after = tokens[close + 1] if close + 1 < len(tokens) else None
+            # A function: type name(params) { body }
+            if (name and name.kind == "ident" and after and
+                    after.text in ("{", ";") and
+                    not any(t.text in ("=", "{") for t in tokens[start:i])):
+                end = matching(tokens, close + 1) if after.text == "{" \
+                    else close + 1
+                items.append({"tokens": tokens[start:end + 1],
+                              "name": name.text, "params": i - start,
+                              "body": after.text == "{"})
+                start = i = end + 1
+                continue
+            i = close + 1
+            continue
+        if token.text == "{" and token.kind == "op":
+            i = matching(tokens, i) + 1
+            continue
+        if token.text == ";" and token.kind == "op":
+            items.append({"tokens": tokens[start:i + 1]})
+            start = i + 1
+        i += 1
+    if start < len(tokens):
+        items.append({"tokens": tokens[start:]})
+    return items
+
+
+def identifiers(tokens):
+    names = set()
+    for token in tokens:
+        if token.kind == "ident":
+            names.add(token.text)
+        elif token.kind == "directive":
+            names.update(t.text for t in tokens_of(token.text)
+                         if t.kind == "ident")
+    return names
+
+
+def remove_unreachable(items):
+    functions = {}
+    roots = {"main"}
+    for item in items:
+        if "name" in item:
+            functions.setdefault(item["name"], set()).update(
+                identifiers(item["tokens"]) - {item["name"]})
+        else:
+            roots |= identifiers(item["tokens"])
+    reachable, stack = set(), [n for n in roots if n in functions]
+    while stack:
+        name = stack.pop()
+        if name not in reachable:
+            reachable.add(name)
+            stack += [n for n in functions[name] if n in functions]
+    return [item for item in items
+            if "name" not in item or item["name"] in reachable]
+
+
+def short_names(reserved):
+    letters = "abcdefghijklmnopqrstuvwxyz"
+    names = list(letters)
+    names += [a + b for a in letters for b in letters + "0123456789_"]
+    return (n for n in names if n not in reserved and n not in KEYWORDS)
+
+
+# Finds the parameters and local variables which a function declares
+def declared_names(tokens, params, types):
+    names = set()
+    # Parameters: the last identifier of every comma separated declaration
+    close = matching(tokens, params)
+    param = []
+    for token in tokens[params + 1:close + 1]:
+        if token.text in (",", ")") and token.kind == "op":
+            idents = [t for t in param if t.kind == "ident"]
+            if len(idents) > 1 and idents[-1].text not in types:
+                names.add(idents[-1].text)
+            param = []
+        elif token.text != "[":
+            param.append(token)
+    # Locals: a type followed by a name, and further names after commas at
+    # the same parenthesis depth, until the end of the statement
+    depth, declaring = 0, None
+    for i in range(close + 1, len(tokens) - 1):
+        token, after = tokens[i], tokens[i + 1]
+        if token.kind == "op":
+            if token.text in "({[":
+                depth += 1
+            elif token.text in ")}]":
+                depth -= 1
+                if declaring is not None and depth < declaring:
+                    declaring = None
+            elif token.text == ";":
+                declaring = None
+            elif (token.text == "," and depth == declaring and
+                  after.kind == "ident"):
+                names.add(after.text)
+        elif token.text in types and after.kind == "ident":
+            names.add(after.text)
+            declaring = depth
+    return names
+
+
+def rename_locals(item, globals_, types):
+    tokens = item["tokens"]
+    declared = declared_names(tokens, item["params"], types) - globals_
+    # Never rename names which are also called as functions
+    for i, token in enumerate(tokens[:-1]):
+        if tokens[i + 1].text == "(":
+            declared.discard(token.text)
+    uses = {}
+    for i, token in enumerate(tokens):
+        if token.text in declared and tokens[i - 1].text != ".":
+            uses[token.text] = uses.get(token.text, 0) + 1
+    reserved = identifiers(tokens) - declared | globals_
+    new_names = dict(zip(sorted(uses, key=lambda n: -uses[n]),
+                         short_names(reserved)))
+    for i, token in enumerate(tokens):
+        if token.text in new_names and tokens[i - 1].text != ".":
+            tokens[i] = Token("ident", new_names[token.text], token.path,
+                              token.line)
+
+
+def minify(filename, directory):
+    tokens = tokenize(filename, directory)
+    for token in tokens:
+        if token.kind == "number":
+            token.text = shorten_number(token.text)
+    items = remove_unreachable(split_items(tokens))
+
+    # Everything visible outside of functions, and names used in directives
+    types = set(TYPES)
+    globals_ = set()
+    for item in items:
+        names = identifiers(item["tokens"])
+        if "name" in item:
+            globals_.add(item["name"])
+            names = identifiers(t for t in item["tokens"]
+                                if t.kind == "directive")
+        else:
+            item_tokens = item["tokens"]
+            types.update(item_tokens[i + 1].text
+                         for i, t in enumerate(item_tokens[:-1])
+                         if t.text == "struct")
+        globals_ |= names
+    for item in items:
+        if item.get("body"):
+            rename_locals(item, globals_, types)
+
+    # One line per top level item, and directives on their own lines
+    out, source_map = [], []
+    line, last = 1, None
+    for item in items:
+        text, prev = "", None
+        for token in item["tokens"]:
+            if token.kind == "directive":
+                if text:
+                    out.append(text)
+                    line += 1
+                text = minify_directive(token.text)
+                source_map.append(f"{line}:1 {token.path}:{token.line}")
+                last = (token.path, token.line)
+                out.append(text)
+                line += 1
+                text, prev = "", None
+                continue
+            if prev and needs_space(prev, token):
+                text += " "
+            if (token.path, token.line) != last:
+                last = (token.path, token.line)
+                source_map.append(
+                    f"{line}:{len(text) + 1} {token.path}:{token.line}")
+            text += token.text
+            prev = token
+        if text:
+            out.append(text)
+            line += 1
+    return "\n".join(out) + "\n", "\n".join(source_map) + "\n"
+
+
+if len(sys.argv) != 4:
+    sys.exit("Usage: minify_glsl.py input_dir output_dir map_dir")
+src_dir, out_dir, map_dir = sys.argv[1:]
+os.makedirs(out_dir, exist_ok=True)
+os.makedirs(map_dir, exist_ok=True)
+for filename in sorted(os.listdir(src_dir)):
+    if not filename.endswith(STAGES):
+        continue
+    code, source_map = minify(filename, src_dir)
+    with open(os.path.join(out_dir, filename), "w") as f:
+        f.write(code)
+    with open(os.path.join(map_dir, filename + ".map"), "w") as f:
+        f.write(source_map)
@@ -4,15 +4,19 @@ set -e
 
 IN=$(find $@ -type f)
 
-# Convert every data file to C source with xxd
+# Files get embedded by their paths, without STRIP_PREFIX at the beginning.
+# This way generated files in e.g. build/shaders/ replace shaders/.
+
+# Convert every data file to C source with xxd. The arrays are aligned so
+# that binary files can be used in place (see map_file in filesystem.c).
 for file in $IN; do
-  xxd -i $file
+  xxd -i $file | sed 's/\[\] = {/[] __attribute__((aligned(16))) = {/'
 done
 
 # Write an array of filenames (null-terminated) for indexing
 printf 'const char *data_filenames ='
 for file in $IN; do
-  printf \ \"$file\\\\0\"
+  printf \ \"${file#$STRIP_PREFIX}\\\\0\"
 done
 # Write a final null sentinel to end of array
 printf ' "\\0";\n'
@@ -1,5 +1,20 @@
 #!/bin/sh
-[ -z "$1" ] && echo 'Usage: pack.sh executable' && exit 1
-xz --format=lzma --lzma1=preset=9,lc=1,lp=0,pb=0 "$1"
-cat "$(dirname $0)/start.sh" "$1.lzma" > "$1"
+# Compresses an executable into a self-extracting one. By default the result
+# starts with a native loader (stub.c), which decompresses the executable in
+# memory. With --shell, it starts with start.sh instead, which needs lzcat
+# and an executable /tmp, but no liblzma headers at build time.
+shell=0
+[ "$1" = "--shell" ] && shell=1 && shift
+[ -z "$1" ] && echo 'Usage: pack.sh [--shell] executable' && exit 1
+xz --format=lzma --lzma1=preset=9,lc=1,lp=0,pb=0 "$1" || exit 1
+if [ $shell = 1 ]; then
+    cat "$(dirname $0)/start.sh" "$1.lzma" > "$1"
+else
+    ${CC:-cc} -Os -s -o "$1.stub" "$(dirname $0)/stub.c" -llzma || exit 1
+    # The stub finds the compressed data from the offset at the end
+    offset=$(wc -c < "$1.stub")
+    { cat "$1.stub" "$1.lzma"; printf '%016d' $offset; } > "$1"
+    rm "$1.stub"
+fi
+rm "$1.lzma"
 chmod +x "$1"
@@ -0,0 +1,119 @@
+// Self-extracting loader for packed executables, see pack.sh. A packed file
+// is this program, followed by the executable compressed with xz's LZMA
+// format, followed by the compressed data's offset in the file as 16 decimal
+// digits. The executable gets decompressed into an anonymous memory file
+// (memfd) and executed from there, so nothing gets written to disk, and it
+// works even when /tmp is mounted noexec.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <lzma.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRAILER_SIZE 16
+
+// Not in older glibc headers
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U
+#endif
+
+extern char **environ;
+
+// Writes all of a buffer, write can do less at once
+static int write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Decompresses `len` bytes of LZMA data to a file descriptor. Returns the
+// decompressed size, or 0 if it fails.
+static uint64_t decompress(const uint8_t *data, size_t len, int fd) {
+    static uint8_t buffer[1 << 20];
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (lzma_alone_decoder(&strm, UINT64_MAX) != LZMA_OK) {
+        return 0;
+    }
+
+    strm.next_in = data;
+    strm.avail_in = len;
+    lzma_ret ret = LZMA_OK;
+    while (ret == LZMA_OK) {
+        strm.next_out = buffer;
+        strm.avail_out = sizeof(buffer);
+        ret = lzma_code(&strm, LZMA_FINISH);
+        if (!write_all(fd, buffer, sizeof(buffer) - strm.avail_out)) {
+            ret = LZMA_PROG_ERROR;
+        }
+    }
+
+    uint64_t total = strm.total_out;
+    lzma_end(&strm);
+    return ret == LZMA_STREAM_END ? total : 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Map this file to find the compressed data
+    int self = open("/proc/self/exe", O_RDONLY);
+    struct stat st;
+    if (self < 0 || fstat(self, &st) != 0 || st.st_size <= TRAILER_SIZE) {
+        fprintf(stderr, "Can't read /proc/self/exe\n");
+        return 1;
+    }
+    size_t size = st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, self, 0);
+    close(self);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Can't map /proc/self/exe\n");
+        return 1;
+    }
+    char trailer[TRAILER_SIZE + 1] = {0};
+    for (int i = 0; i < TRAILER_SIZE; i++) {
+        trailer[i] = file[size - TRAILER_SIZE + i];
+    }
+    size_t offset = strtoull(trailer, NULL, 10);
+    if (offset == 0 || offset >= size - TRAILER_SIZE) {
+        fprintf(stderr, "No packed executable found\n");
+        return 1;
+    }
+
+    // memfd_create through syscall, glibc only has a wrapper since 2.27
+    int fd = syscall(SYS_memfd_create, "demo", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create");
+        return 1;
+    }
+    uint64_t unpacked =
+        decompress(file + offset, size - TRAILER_SIZE - offset, fd);
+    munmap((void *)file, size);
+    if (unpacked == 0) {
+        fprintf(stderr, "Failed to decompress\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Unpacked %llu bytes in %.1f ms\n",
+            (unsigned long long)unpacked,
+            (end.tv_sec - start.tv_sec) * 1e3 +
+                (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    fexecve(fd, argv, environ);
+    perror("fexecve");
+    return 1;
+}
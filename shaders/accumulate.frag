@@ -0,0 +1,18 @@
+// Averages the jittered samples of a paused frame, see demo_skip_frame in
+// demo.c. Sample number u_Samples gets weight 1 / (u_Samples + 1), so that
+// every sample contributes equally to the result.
+
+precision highp float;
+
+out vec4 FragColor;
+
+uniform sampler2D u_InputSampler;
+uniform sampler2D u_HistorySampler;
+uniform int u_Samples;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec3 color = texelFetch(u_InputSampler, pixel, 0).rgb;
+    vec3 history = texelFetch(u_HistorySampler, pixel, 0).rgb;
+    FragColor = vec4(mix(history, color, 1. / float(u_Samples + 1)), 1.);
+}
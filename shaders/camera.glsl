@@ -0,0 +1,35 @@
+// Look-at camera helpers, shared by passes which need to turn screen
+// coordinates into rays or world positions back into screen coordinates.
+
+// Clipping planes of the depth buffer which meshes get depth tested in
+#define NEAR 0.01
+#define FAR 1024.
+
+// Rotation from view space (z forward) to world space
+mat3 viewMatrix(vec3 pos, vec3 target) {
+    vec3 f = normalize(target - pos);
+    vec3 s = normalize(cross(f, vec3(0., 1., 0.)));
+    vec3 u = cross(s, f);
+    return mat3(s, u, f);
+}
+
+// Distance from the camera to a view plane which spans -1..1 vertically
+float focalLength(float fov) {
+    return tan((90. - fov / 2.) * (PI / 180.));
+}
+
+// View space ray direction through `coord` (-1..1) on the view plane
+vec3 cameraRay(vec2 coord, float aspect, float focal) {
+    return normalize(vec3(coord * vec2(aspect, 1.), focal));
+}
+
+// Inverse of cameraRay: projects a view space position to the view plane
+vec2 projectView(vec3 v, float aspect, float focal) {
+    return v.xy / v.z * focal / vec2(aspect, 1.);
+}
+
+// Window space depth (0..1) of a view space z, the same which the GPU
+// computes for gl_Position in mesh.vert
+float projectDepth(float z) {
+    return ((FAR + NEAR) - 2. * FAR * NEAR / z) / (FAR - NEAR) * 0.5 + 0.5;
+}
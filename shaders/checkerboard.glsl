@@ -0,0 +1,12 @@
+// Checkerboard rendering shades only one of every `period` pixels per frame:
+// 1 shades every pixel, 2 is a checkerboard and 4 is a 2x2 pattern.
+// The pattern rotates every frame, so that every pixel gets shaded once
+// in `period` frames.
+bool shadedOnFrame(ivec2 pixel, int frame, int period) {
+    if (period == 2) {
+        return ((pixel.x + pixel.y + frame) & 1) == 0;
+    } else if (period == 4) {
+        return (pixel.x & 1) + (pixel.y & 1) * 2 == (frame & 3);
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+// Sorts the G-buffer into screen tiles for the lighting pass, one tile per
+// output pixel (see shading_tiles.glsl). A tile is sky when all of its pixels
+// are fogged out, water or solid when all of its other pixels have water or
+// other materials, and mixed otherwise. Pixels which the lighting pass skips
+// on this frame (see checkerboard.glsl) don't count.
+
+precision highp float;
+
+out vec4 FragColor;
+
+uniform int u_Frame;
+uniform int u_Checkerboard;
+uniform int u_ShadingTileSize;
+
+// G-buffer: ray hit distance, and normal with material ID in alpha
+uniform sampler2D u_DistanceSampler;
+uniform sampler2D u_NormalSampler;
+
+#include "checkerboard.glsl"
+#include "shading_tiles.glsl"
+
+void main() {
+    ivec2 size = textureSize(u_DistanceSampler, 0);
+    ivec2 first = ivec2(gl_FragCoord.xy) * u_ShadingTileSize;
+    ivec2 last = min(first + u_ShadingTileSize, size) - 1;
+
+    bool sky = true, water = true, solid = true;
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            ivec2 pixel = ivec2(x, y);
+            if (!shadedOnFrame(pixel, u_Frame, u_Checkerboard) ||
+                    texelFetch(u_DistanceSampler, pixel, 0).r >= FOG_END) {
+                continue;
+            }
+            int mtlID = int(texelFetch(u_NormalSampler, pixel, 0).w);
+            sky = false;
+            water = water && mtlID == 0;
+            solid = solid && mtlID != 0;
+        }
+    }
+
+    int tileClass = sky ? TILE_SKY
+        : water ? TILE_WATER
+        : solid ? TILE_SOLID
+        : TILE_MIXED;
+    FragColor = vec4(float(tileClass));
+}
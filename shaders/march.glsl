@@ -24,3 +24,25 @@ vec3 march(vec3 o, vec3 d, vec3 param, float f) {
     }
     return vec3(t, dist.y, shadow);
 }
+
+// Cone marching for the low resolution depth pre-pass. Instead of a thin ray,
+// this traces a cone whose radius grows by `cone` per unit of distance, and
+// stops as soon as a surface might touch the cone.
+// Returns a distance from which any ray inside the cone can start marching
+// without skipping over a surface. param.x = start, param.y = max distance.
+float coneMarch(vec3 o, vec3 d, vec2 param, float cone, float f) {
+    float t = param.x;
+    float safe = t;
+    for (int i = 0; i < 128; i++) {
+        float dist = sdf(o + d * t, f).x;
+        if (dist < max(t * cone, EPSILON)) {
+            break;
+        }
+        safe = t;
+        t += dist * 0.8;
+        if (t > param.y) {
+            return param.y;
+        }
+    }
+    return safe;
+}
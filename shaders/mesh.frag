@@ -0,0 +1,33 @@
+// Writes glTF mesh surfaces to the G-buffer after the geometry pass, in the
+// same format: hit distance, and normal with material ID. The depth test
+// keeps whichever of the meshes and the raymarched surfaces is closer, with
+// the depth from mesh.vert which the geometry pass matches. Not writing
+// gl_FragDepth here lets the GPU test the depth before shading.
+
+precision highp float;
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragNormal;
+
+in vec3 ViewPos;
+in vec3 Normal;
+
+uniform int u_Frame;
+uniform int u_Checkerboard;
+
+// Meshes use the buoy's painted material (MTL_COLORS in shader.frag)
+#define MESH_MATERIAL 3.
+
+#include "checkerboard.glsl"
+
+void main() {
+    // Skip the same pixels as the geometry pass
+    if (!shadedOnFrame(ivec2(gl_FragCoord.xy), u_Frame, u_Checkerboard)) {
+        discard;
+    }
+
+    float dist = length(ViewPos);
+    vec3 n = normalize(Normal);
+    FragColor = vec4(dist);
+    FragNormal = vec4(gl_FrontFacing ? n : -n, MESH_MATERIAL);
+}
@@ -0,0 +1,46 @@
+// Draws glTF meshes (see src/mesh.c) with the same camera as the raymarched
+// passes (see camera.glsl), also when rendering tiles and jittered samples.
+
+precision highp float;
+
+// Position in the mesh's bounding cube, and normal, both quantized to -1..1
+layout(location = 0) in vec4 a_Position;
+layout(location = 1) in vec4 a_Normal;
+// Per instance: from the bounding cube to world space (locations 2 to 5)
+layout(location = 2) in mat4 a_Model;
+
+out vec3 ViewPos;
+out vec3 Normal;
+
+uniform vec2 u_Resolution;
+uniform vec4 u_TileRect;
+uniform vec2 u_Jitter;
+
+uniform r_Cam {
+    float fov;
+    vec3 pos;
+    vec3 target;
+} cam;
+
+#define PI 3.14159265
+
+#include "camera.glsl"
+
+void main() {
+    vec3 world = (a_Model * vec4(a_Position.xyz, 1.)).xyz;
+    // viewMatrix rotates from view space to world space, its transpose back
+    vec3 v = transpose(viewMatrix(cam.pos, cam.target)) * (world - cam.pos);
+
+    // projectView(v) is this pixel's ImageCoord, so FragCoord (which
+    // gl_Position.xy / w becomes) is the inverse of the vertex shader in
+    // demo.c. Multiplied by w = v.z, because the GPU divides by it.
+    vec2 image = u_Resolution / u_TileRect.zw;
+    vec2 coord = v.xy * focalLength(cam.fov) / vec2(image.x / image.y, 1.);
+    gl_Position.xy = (coord - (u_TileRect.xy + u_Jitter) * v.z) / u_TileRect.zw;
+    gl_Position.z = (v.z * (FAR + NEAR) - 2. * FAR * NEAR) / (FAR - NEAR);
+    gl_Position.w = v.z;
+
+    ViewPos = v;
+    // Inverse transpose keeps normals perpendicular under uneven scaling
+    Normal = transpose(inverse(mat3(a_Model))) * a_Normal.xyz;
+}
@@ -0,0 +1,71 @@
+// The post processing which post.frag and post.comp share. It currently
+// features bloom, tone mapping, chromatic aberration and noise.
+
+uniform sampler2D u_InputSampler;
+uniform sampler2D u_NoiseSampler;
+uniform sampler2D u_BloomSampler;
+uniform int u_NoiseSize;
+uniform float u_RocketRow;
+uniform vec2 u_Resolution;
+
+uniform r_Post {
+    float aberration;
+} post;
+
+#define BLUR_SAMPLES 8
+
+// https://64.github.io/tonemapping/
+vec3 acesApprox(vec3 v) {
+    v *= 0.6;
+    float a = 2.51;
+    float b = 0.03;
+    float c = 2.43;
+    float d = 0.59;
+    float e = 0.14;
+    return clamp((v * (a * v + b)) / (v * (c * v + d) + e), 0., 1.);
+}
+
+// This is used to achieve chromatic aberration
+vec3 radialSum(vec2 r, vec2 fragCoord, vec2 imageCoord) {
+    vec3 color = vec3(0.);
+    for (int i = 0; i < BLUR_SAMPLES; i++) {
+        vec2 d = (r * float(i) * post.aberration) / float(BLUR_SAMPLES);
+        vec2 uv = fragCoord * 0.5 + 0.5 - imageCoord * d;
+        color += textureLod(u_InputSampler, uv, 0.).rgb;
+    }
+    return color;
+}
+
+// Post processes the pixel at `pixel`, whose position is `fragCoord` in the
+// output (-1..1) and `imageCoord` in the whole image (see FragCoord and
+// ImageCoord in demo.c's vertex shader). Compute shaders have no implicit
+// derivatives, so textures are sampled with textureLod.
+vec3 postProcess(vec2 fragCoord, vec2 imageCoord, ivec2 pixel) {
+    // Input color with RGB aberration, measured in input pixels so that it
+    // looks the same when this renders straight to a bigger window
+    vec2 texel = 1. / vec2(textureSize(u_InputSampler, 0));
+    vec3 color = vec3(
+            radialSum(texel * 3., fragCoord, imageCoord).r,
+            radialSum(texel * 2., fragCoord, imageCoord).g,
+            radialSum(texel * 1., fragCoord, imageCoord).b
+        ) / float(BLUR_SAMPLES);
+
+    // Add bloom
+    color += textureLod(u_BloomSampler, fragCoord * 0.5 + 0.5, 0.).rgb;
+
+    // Tone mapping
+    color = acesApprox(color);
+
+    // Add noise
+    color += texelFetch(u_NoiseSampler, pixel % u_NoiseSize, 0).rgb * 0.08 - 0.04;
+
+    // Vignette
+    color -= length(imageCoord) * 0.1;
+
+    // Gamma correct on GL ES, sRGB framebuffer doesn't seem to work on ES
+    #ifdef GL_ES
+    color = pow(color, vec3(2.2));
+    #endif
+
+    return clamp(color, 0., 1.);
+}
@@ -0,0 +1,84 @@
+// This shader fills in the pixels which the effect shader did not shade on
+// this frame (see checkerboard.glsl). The missing pixels are reprojected
+// from the previous frame with the previous frame's camera, and clamped to
+// the colors of their freshly shaded neighbours to reject stale history.
+// The alpha channel carries the ray hit distance from the effect shader.
+
+precision highp float;
+
+out vec4 FragColor;
+
+in vec2 FragCoord;
+in vec2 ImageCoord;
+
+uniform vec2 u_Resolution;
+uniform vec4 u_TileRect;
+uniform int u_Frame;
+uniform int u_Checkerboard;
+
+// Uniforms prefixed with p_ get the rocket values of the previous frame
+uniform r_Cam {
+    float fov;
+    vec3 pos;
+    vec3 target;
+} cam;
+
+uniform p_Cam {
+    float fov;
+    vec3 pos;
+    vec3 target;
+} prevCam;
+
+uniform sampler2D u_InputSampler;
+uniform sampler2D u_HistorySampler;
+
+#define PI 3.14159265
+
+#include "camera.glsl"
+#include "checkerboard.glsl"
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if (shadedOnFrame(pixel, u_Frame, u_Checkerboard)) {
+        FragColor = texelFetch(u_InputSampler, pixel, 0);
+        return;
+    }
+
+    // Find the color range and nearest hit distance of shaded neighbours
+    ivec2 size = textureSize(u_InputSampler, 0);
+    vec3 lo = vec3(1e9);
+    vec3 hi = vec3(-1e9);
+    float depth = 1e9;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 p = clamp(pixel + ivec2(x, y), ivec2(0), size - 1);
+            if (!shadedOnFrame(p, u_Frame, u_Checkerboard)) {
+                continue;
+            }
+            vec4 s = texelFetch(u_InputSampler, p, 0);
+            lo = min(lo, s.rgb);
+            hi = max(hi, s.rgb);
+            depth = min(depth, s.a);
+        }
+    }
+
+    // Reconstruct a world position with the current camera, and find where
+    // it was on the screen in the previous frame
+    vec2 image = u_Resolution / u_TileRect.zw;
+    float aspect = image.x / image.y;
+    vec3 ray = viewMatrix(cam.pos, cam.target) *
+            cameraRay(ImageCoord, aspect, focalLength(cam.fov));
+    vec3 pos = cam.pos + ray * depth;
+    vec3 v = transpose(viewMatrix(prevCam.pos, prevCam.target)) *
+            (pos - prevCam.pos);
+    vec2 prev = projectView(v, aspect, focalLength(prevCam.fov));
+
+    // Fall back to the neighbourhood average when the position was not
+    // visible in the previous frame
+    vec3 color = (lo + hi) * 0.5;
+    if (v.z > 0. && all(lessThan(abs(prev), vec2(1.)))) {
+        color = texture(u_HistorySampler, prev * 0.5 + 0.5).rgb;
+    }
+
+    FragColor = vec4(clamp(color, lo, hi), depth);
+}
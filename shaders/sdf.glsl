@@ -15,6 +15,19 @@ float sdTorus(vec3 p, vec2 t) {
     return length(q) - t.y;
 }
 
+// Samples a distance field baked into a 3D texture (see src/mesh_sdf.c),
+// which covers the cube at bounds.xyz with half size bounds.w. Outside of the
+// cube, the distance to it gets added to the value at its border. Half size
+// 0 means there is no texture, and nothing gets hit.
+float sdTexture(vec3 p, highp sampler3D tex, vec4 bounds) {
+    if (bounds.w <= 0.) {
+        return 1e9;
+    }
+    vec3 q = (p - bounds.xyz) / bounds.w;
+    float outside = length(max(abs(q) - 1., 0.)) * bounds.w;
+    return textureLod(tex, clamp(q, -1., 1.) * .5 + .5, 0.).r + outside;
+}
+
 vec2 opUnion(vec2 a, vec2 b, float f) {
     if (a.x < b.x && a.y + EPSILON >= f) {
         return a;
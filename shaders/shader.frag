@@ -2,15 +2,32 @@
 // https://jamie-wong.com/2016/07/15/ray-marching-signed-distance-functions
 // and Inigo Quilez
 // https://iquilezles.org/articles/distfunctions/
+//
+// This file contains the scene and every pass which traces it. demo.c
+// compiles it once per pass with one of these defines:
+//   PREPASS:       Low resolution cone marched depth pre-pass
+//   GEOMETRY_PASS: Primary rays, writes the G-buffer (distance, normal, ID)
+//   SHADOW_PASS:   Shadow rays from G-buffer surfaces, at a lower resolution
+//   (none):        Lighting, shades the G-buffer surfaces
 
 precision highp float;
 
+#ifdef GEOMETRY_PASS
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragNormal;
+#else
 out vec4 FragColor;
+#endif
 
 in vec2 FragCoord;
+in vec2 ImageCoord;
 
 uniform float u_RocketRow;
 uniform vec2 u_Resolution;
+uniform vec4 u_TileRect;
+uniform vec2 u_Jitter;
+uniform int u_Frame;
+uniform int u_Checkerboard;
 uniform float r_MotionBlur;
 uniform float r_AnimationTime;
 
@@ -32,27 +49,42 @@ uniform r_Light {
 } dlight;
 
 uniform sampler2D u_FeedbackSampler;
+uniform sampler2D u_DepthSampler;
+uniform sampler2D u_ShadowSampler;
+uniform sampler2D u_TerrainSampler;
+// G-buffer: ray hit distance, and normal with material ID in alpha
+uniform sampler2D u_DistanceSampler;
+uniform sampler2D u_NormalSampler;
+#ifdef MESH_SDF
+// Meshes baked into a distance field, see sdTexture
+uniform highp sampler3D u_MeshSampler;
+uniform vec4 u_MeshBounds;
+#endif
 
 #define PI 3.14159265
 #define EPSILON 0.001
 
+// Uncomment to evaluate the mountains' fbm at every march step instead of
+// sampling the terrain texture baked at startup (src/terrain.c)
+//#define ANALYTIC_TERRAIN
+
 #include "rotation.glsl"
 #include "sdf.glsl"
+#include "camera.glsl"
+#include "checkerboard.glsl"
+#include "spectrum.glsl"
+#include "shading_tiles.glsl"
 
+// Aspect ratio of the whole image, also when rendering one tile of it
 float aspectRatio() {
-    return u_Resolution.x / u_Resolution.y;
-}
-
-mat3 viewMatrix() {
-    vec3 f = normalize(cam.target - cam.pos);
-    vec3 s = normalize(cross(f, vec3(0., 1., 0.)));
-    vec3 u = cross(s, f);
-    return mat3(s, u, f);
+    vec2 image = u_Resolution / u_TileRect.zw;
+    return image.x / image.y;
 }
 
-vec3 cameraRay() {
-    float c = tan((90. - cam.fov / 2.) * (PI / 180.));
-    return normalize(vec3(FragCoord * vec2(aspectRatio(), 1.), c));
+// World space ray direction for this pixel
+vec3 worldRay() {
+    return viewMatrix(cam.pos, cam.target) *
+        cameraRay(ImageCoord, aspectRatio(), focalLength(cam.fov));
 }
 
 float motion(vec2 st, float phase) {
@@ -75,6 +107,15 @@ float fbm(vec2 st) {
     return value;
 }
 
+float terrain(vec2 st) {
+#ifdef ANALYTIC_TERRAIN
+    return fbm(st);
+#else
+    // fbm repeats every 2 PI, and the texture holds one period of it
+    return textureLod(u_TerrainSampler, st / (2. * PI), 0.).r;
+#endif
+}
+
 const vec3 MTL_COLORS[] = vec3[](
         vec3(0.04, 0.033, 0.03) * 0.7, // Water absorptivity
         vec3(0.9),
@@ -107,7 +148,7 @@ vec2 sdSea(vec3 p) {
 }
 
 vec2 sdMtn(vec3 p) {
-    p.y -= 20. + fbm(p.xz / 40.) * 3.4;
+    p.y -= 20. + terrain(p.xz / 40.) * 3.4;
     p.y += length(p.xz) * 0.7 + sin(p.x / 10.) * 3.;
     float stripes = clamp(sin(p.x) * 1000., 0.0, 1.);
     return vec2(sdPlaneXZ(p), stripes + 1.);
@@ -126,11 +167,19 @@ vec2 sdBuoy(vec3 p, float f) {
 }
 
 vec2 sdf(vec3 p, float f) {
-    return opUnion(
-        opUnion(sdSea(p), sdMtn(p), f),
+    vec2 scene = opUnion(sdSea(p), sdMtn(p), f);
+#ifndef NO_BUOY
+    scene = opUnion(
+        scene,
         sdBuoy(rotation3D(vec3(0.1, 1., 0.5), r_AnimationTime * 0.16) * (p - vec3(200, sin(r_AnimationTime) * 0.7 + sin(r_AnimationTime * 0.4), 0.)), f),
         f
     );
+#endif
+#ifdef MESH_SDF
+    // Meshes (when MESH_SDF_SIZE is set) use the buoy's painted material
+    scene = opUnion(scene, vec2(sdTexture(p, u_MeshSampler, u_MeshBounds), 3.), f);
+#endif
+    return scene;
 }
 
 #include "march.glsl"
@@ -204,12 +253,11 @@ vec3 brdf(vec3 L, vec3 V, vec3 N, float metallic, float roughness, vec3 baseColo
 // Radiance out to view = Emitted radiance to view
 // + integral (sort of like sum) over the whole hemisphere:
 // brdf(v, l) * incoming irradiance (radiance per area)
-vec3 light(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc, vec3 ga, int mtlID, vec3 paramOffset) {
+// The shadow is traced separately, see traceShadows
+vec3 light(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc, vec3 ga, int mtlID, vec3 paramOffset, float shadow) {
     // No emissive surfaces
     vec3 albedo = MTL_COLORS[mtlID];
     vec3 params = clamp(MTL_PARAMS[mtlID] + paramOffset, 0., 1.);
-    // Trace shadow
-    float shadow = clamp(march(pos, l, vec3(1., 1024., 30.), 1.).z, 0., 1.);
     // Light received by the surface
     vec3 irradiance = max(dot(l, n), 0.) * shadow * lc;
     // Add a bit of fake ambient light from the sky
@@ -222,7 +270,9 @@ vec3 light(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc, vec3 ga, int mtlID, vec3
     return irradiance * brd;
 }
 
-vec3 water(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc) {
+// shadows.x is the shadow of the underwater surface and shadows.y is the
+// shadow of the scattering samples, see traceShadows
+vec3 water(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc, vec2 shadows) {
     // This is how much the water medium absorbs light (RGB)
     vec3 absorptivity = MTL_COLORS[0];
 
@@ -247,8 +297,7 @@ vec3 water(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc) {
     vec3 scatterAlbedo = vec3(0.1, 0.2, 0.1) * 0.005;
     for (int i = 0; i < 4; i++) {
         vec3 samplePos = pos - vec3(0., float(i) * 0.5, 0.);
-        float shadow = clamp(march(samplePos, l, vec3(1., 256., 10.), 1.).z, 0., 1.);
-        vec3 irradiance = max(dot(l, n), 0.) * lc * shadow;
+        vec3 irradiance = max(dot(l, n), 0.) * lc * shadows.y;
         float t = max(-rd.y - samplePos.y, 0.) * 2.;
         scattered += exp(-absorptivity * t) * lc * scatterAlbedo * irradiance;
     }
@@ -262,7 +311,7 @@ vec3 water(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc) {
     // (Beer-Lambert law), also the surface reflection blocks some light
     vec3 fl = fresnelSchlick(dot(vec3(0., 1., 0), l), vec3(0.02));
     vec3 attenuation = max(exp(-absorptivity * -pos.y) - fl, 0.);
-    vec3 transmitted = light(pos, rd, n, l, lc, attenuation, int(hit.y), vec3(1., 0., 0.));
+    vec3 transmitted = light(pos, rd, n, l, lc, attenuation, int(hit.y), vec3(1., 0., 0.), shadows.x);
     // The light transmitted by the water is attenuated exponentially
     // (Beer-Lambert law)
     transmitted *= exp(-absorptivity * hit.x);
@@ -271,29 +320,195 @@ vec3 water(vec3 pos, vec3 dir, vec3 n, vec3 l, vec3 lc) {
     return mix(transmitted + scattered, reflected, fresnel);
 }
 
+float traceShadow(vec3 pos, vec3 l, float far, float k) {
+    return clamp(march(pos, l, vec3(1., far, k), 1.).z, 0., 1.);
+}
+
+// Traces all shadow rays needed to light a primary ray hit. Solid surfaces
+// need one shadow ray (x). Water needs one for the underwater surface seen
+// through it (x), and an average of four for the light scattered in the
+// water (y).
+vec2 traceShadows(vec3 pos, vec3 dir, vec3 n, vec3 l, int mtlID) {
+    if (mtlID != 0) {
+        return vec2(traceShadow(pos, l, 1024., 30.), 1.);
+    }
+
+    float scatter = 0.;
+    for (int i = 0; i < 4; i++) {
+        vec3 samplePos = pos - vec3(0., float(i) * 0.5, 0.);
+        scatter += traceShadow(samplePos, l, 256., 10.);
+    }
+
+    vec3 rd = refract(dir, n, 1. / 1.333);
+    vec3 hit = march(pos, rd, vec3(EPSILON, 1024., 20.), 1.);
+    return vec2(traceShadow(pos + rd * hit.x, l, 1024., 30.), scatter / 4.);
+}
+
+// Returns the distance this pixel's ray can skip, traced by the pre-pass
+float prepassDepth() {
+    ivec2 size = textureSize(u_DepthSampler, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy * vec2(size) / u_Resolution);
+    return max(texelFetch(u_DepthSampler, min(texel, size - 1), 0).r, EPSILON);
+}
+
+// World space ray direction through the center of a G-buffer pixel
+vec3 pixelRay(ivec2 pixel) {
+    vec2 coord = (vec2(pixel) + 0.5) / vec2(textureSize(u_DistanceSampler, 0));
+    coord = (coord * 2. - 1.) * u_TileRect.zw + u_TileRect.xy + u_Jitter;
+    return viewMatrix(cam.pos, cam.target) *
+        cameraRay(coord, aspectRatio(), focalLength(cam.fov));
+}
+
+// The G-buffer pixel which a shadow pass texel traces from. This is the
+// first pixel in the texel's block which was shaded on this frame, because
+// with checkerboard rendering, the rest of the G-buffer isn't written on
+// this frame and only holds cleared values.
+ivec2 shadowSource(ivec2 texel) {
+    int divisor = textureSize(u_DistanceSampler, 0).x /
+            textureSize(u_ShadowSampler, 0).x;
+    for (int i = 0; i < divisor * divisor; i++) {
+        ivec2 pixel = texel * divisor + ivec2(i % divisor, i / divisor);
+        if (shadedOnFrame(pixel, u_Frame, u_Checkerboard)) {
+            return pixel;
+        }
+    }
+    return texel * divisor;
+}
+
+#if defined(PREPASS)
+
 void main() {
-    vec3 ray = viewMatrix() * cameraRay();
-    vec3 lightDir = normalize(dlight.direction);
+    vec3 ray = worldRay();
+
+    // The cone must contain the rays of every full resolution pixel covered
+    // by this low resolution pixel, so its radius is half of this pixel's
+    // diagonal on the view plane. The extra 1.5 is a safety margin, because
+    // sdSea is not an exact distance function.
+    float height = u_Resolution.y / u_TileRect.w;
+    float cone = 1.5 * sqrt(2.) / (height * focalLength(cam.fov));
+    FragColor = vec4(coneMarch(cam.pos, ray, vec2(EPSILON, 1024.), cone, 0.));
+}
+
+#elif defined(GEOMETRY_PASS)
 
-    // Spheretrace all surfaces in view
-    vec3 hit = march(cam.pos, ray, vec3(EPSILON, 1024., 20.), 0.);
+void main() {
+    // With checkerboard rendering, the resolve pass fills in skipped pixels
+    if (!shadedOnFrame(ivec2(gl_FragCoord.xy), u_Frame, u_Checkerboard)) {
+        discard;
+    }
+
+    // Spheretrace all surfaces in view, starting from the pre-pass distance
+    vec3 ray = worldRay();
+    vec3 hit = march(cam.pos, ray, vec3(prepassDepth(), 1024., 20.), 0.);
     vec3 pos = cam.pos + ray * hit.x;
-    vec3 n = normal(pos, 0.);
-    int mtlID = int(hit.y);
+
+    FragColor = vec4(hit.x);
+    FragNormal = vec4(normal(pos, 0.), hit.y);
+    // Meshes get depth tested against this, so it's projected like theirs
+    // (see mesh.vert) from the hit's distance along the view direction
+    vec3 forward = viewMatrix(cam.pos, cam.target)[2];
+    gl_FragDepth = projectDepth(hit.x * dot(ray, forward));
+}
+
+#elif defined(SHADOW_PASS)
+
+// Shadow pass: traces the shadow rays of G-buffer surfaces at a lower
+// resolution than the lighting pass. Writes the shadows (see traceShadows)
+// and the surface's hit distance for depth aware upsampling.
+void main() {
+    ivec2 pixel = shadowSource(ivec2(gl_FragCoord.xy));
+    float dist = texelFetch(u_DistanceSampler, pixel, 0).r;
+
+    // Fogged out into the sky (see classify.frag), the shadows wouldn't show
+    if (dist >= FOG_END) {
+        FragColor = vec4(1., 1., dist, 0.);
+        return;
+    }
+
+    vec4 normalID = texelFetch(u_NormalSampler, pixel, 0);
+    vec3 ray = pixelRay(pixel);
+    vec3 pos = cam.pos + ray * dist;
+    vec3 l = -normalize(dlight.direction);
+
+    FragColor = vec4(traceShadows(pos, ray, normalID.xyz, l, int(normalID.w)), dist, 0.);
+}
+
+#else
+
+// Upsamples the shadow pass result for a full resolution pixel.
+// The four nearest shadow pass samples are weighted bilinearly, and also by
+// how close each sample's surface position is to this pixel's surface plane,
+// so that shadows don't bleed over depth and normal discontinuities.
+vec2 upsampleShadows(vec3 pos, vec3 n, float depth) {
+    ivec2 size = textureSize(u_ShadowSampler, 0);
+    vec2 st = gl_FragCoord.xy * vec2(size) / u_Resolution - 0.5;
+    ivec2 base = ivec2(floor(st));
+    vec2 f = fract(st);
+
+    vec2 shadows = vec2(0.);
+    float total = 0.;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), size - 1);
+        vec4 s = texelFetch(u_ShadowSampler, texel, 0);
+
+        // Reconstruct the sample's surface position from its hit distance
+        vec3 p = cam.pos + pixelRay(shadowSource(texel)) * s.z;
+        float plane = abs(dot(p - pos, n)) / (depth * 0.02);
+
+        vec2 bilinear = mix(1. - f, f, vec2(offset));
+        float w = bilinear.x * bilinear.y * (exp(-plane * plane) + 0.001);
+        shadows += s.xy * w;
+        total += w;
+    }
+    return shadows / total;
+}
+
+// Lighting pass: shades the surfaces in the G-buffer
+void main() {
+    // With checkerboard rendering, the resolve pass fills in skipped pixels
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if (!shadedOnFrame(pixel, u_Frame, u_Checkerboard)) {
+        discard;
+    }
+
+    vec3 ray = worldRay();
+    vec3 lightDir = normalize(dlight.direction);
+
+    // Read the surface from the G-buffer
+    float dist = texelFetch(u_DistanceSampler, pixel, 0).r;
 
     // Compute a mask for parts of the image that should be sky (ray didn't hit)
     // Ideally, this would be done with the shadow parameter (hit.z)
     // but a fog works well in this case for now
-    float mask = clamp(hit.x / 350. - 1., 0., 1.);
+    float mask = clamp((dist - FOG_START) / (FOG_END - FOG_START), 0., 1.);
+
+    // Fully fogged pixels only show the sky. Sky tiles skip everything else,
+    // and the other variants below only shade their tile's class.
+    if (TILE_CLASS == TILE_SKY || mask >= 1.) {
+        FragColor = vec4(sky(ray), dist);
+        return;
+    }
+
+    vec4 normalID = texelFetch(u_NormalSampler, pixel, 0);
+    vec3 pos = cam.pos + ray * dist;
+    vec3 n = normalID.xyz;
+    int mtlID = int(normalID.w);
 
     vec3 radiance = vec3(0.);
 
+    // Shadows come from the lower resolution shadow pass
+    vec2 shadows = upsampleShadows(pos, n, dist);
+
     // Material 0 is water, special case
-    if (mtlID == 0) {
-        radiance = water(pos, ray, n, -lightDir, dlight.color);
+    if (TILE_CLASS == TILE_WATER || (TILE_CLASS == TILE_MIXED && mtlID == 0)) {
+        radiance = water(pos, ray, n, -lightDir, dlight.color, shadows);
     } else {
-        radiance = light(pos, ray, n, -lightDir, dlight.color, vec3(1.), int(hit.y), vec3(0.));
+        radiance = light(pos, ray, n, -lightDir, dlight.color, vec3(1.), mtlID, vec3(0.), shadows.x);
     }
 
-    FragColor = vec4(mix(radiance, sky(ray), mask), 1.);
+    // Alpha holds the hit distance for reprojection in the resolve pass
+    FragColor = vec4(mix(radiance, sky(ray), mask), dist);
 }
+
+#endif
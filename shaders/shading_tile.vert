@@ -0,0 +1,32 @@
+// Draws the lighting pass as one quad per screen tile (see classify.frag),
+// with an instance per tile. Every variant of the lighting pass draws all of
+// them, and the tiles of other classes than u_TileClass collapse to a point
+// outside of the viewport, so that they don't get shaded. The outputs are
+// the same as in demo.c's full screen vertex shader.
+
+uniform vec2 u_Resolution;
+uniform vec4 u_TileRect;
+uniform vec2 u_Jitter;
+uniform int u_ShadingTileSize;
+uniform int u_TileClass;
+// One texel per tile, holding its class
+uniform highp sampler2D u_TileClassSampler;
+
+out vec2 FragCoord;
+out vec2 ImageCoord;
+
+void main() {
+    ivec2 tiles = textureSize(u_TileClassSampler, 0);
+    ivec2 tile = ivec2(gl_InstanceID % tiles.x, gl_InstanceID / tiles.x);
+    if (int(texelFetch(u_TileClassSampler, tile, 0).r) != u_TileClass) {
+        gl_Position = vec4(2., 2., 2., 1.);
+        return;
+    }
+
+    // The same corner order as the full screen quad, clamped to the viewport
+    ivec2 corner = tile + ivec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 pixel = vec2(corner * u_ShadingTileSize);
+    FragCoord = min(pixel / u_Resolution, 1.) * 2. - 1.;
+    ImageCoord = FragCoord * u_TileRect.zw + u_TileRect.xy + u_Jitter;
+    gl_Position = vec4(FragCoord, 0., 1.);
+}
@@ -0,0 +1,17 @@
+// The lighting pass shades the screen in tiles of u_ShadingTileSize pixels,
+// which classify.frag sorts into these classes. Every class has its own
+// variant of the lighting pass, compiled with TILE_CLASS set to the class.
+// Keep the numbers in sync with the lighting passes' order in demo.c.
+#define TILE_SKY 0
+#define TILE_WATER 1
+#define TILE_SOLID 2
+#define TILE_MIXED 3
+
+#ifndef TILE_CLASS
+#define TILE_CLASS TILE_MIXED
+#endif
+
+// Surfaces fade into the sky between these hit distances, beyond FOG_END
+// only the sky is visible
+#define FOG_START 350.
+#define FOG_END 700.
@@ -0,0 +1,24 @@
+// The music's spectrogram, baked at startup by src/spectrum.c. Rows are time
+// steps (u_SpectrumRate rows per rocket row) and columns are frequency bands
+// from 40 Hz to 16 kHz on a logarithmic scale. The including shader must
+// declare u_RocketRow.
+uniform sampler2D u_SpectrumSampler;
+uniform float u_SpectrumRate;
+
+// Loudness (0..1, 60 dB range) of the music at the current row, in the
+// frequency band at `band` (0 is the lowest, 1 the highest)
+float spectrum(float band) {
+    float rows = float(textureSize(u_SpectrumSampler, 0).y);
+    float row = u_RocketRow * u_SpectrumRate + 0.5;
+    return texture(u_SpectrumSampler, vec2(band, row / rows)).r;
+}
+
+// Average loudness of the bands from `low` to `high` (0..1), for example
+// spectrumRange(0., 0.2) follows the bass
+float spectrumRange(float low, float high) {
+    float sum = 0.;
+    for (int i = 0; i < 8; i++) {
+        sum += spectrum(mix(low, high, (float(i) + 0.5) / 8.));
+    }
+    return sum / 8.;
+}
@@ -9,17 +9,113 @@
 #define RESOLUTION_SCALE 1
 #define BEATS_PER_MINUTE 16
 #define ROWS_PER_BEAT 32.
+// Rocket rows per second. The surrounding () parentheses are actually
+// important! Without them, the expression could be changed by it's
+// surroundings after the macro is "inlined" in the preprocessor.
+#define ROW_RATE ((BEATS_PER_MINUTE / 60.) * ROWS_PER_BEAT)
 
 // A RGBA noise texture is generated for every frame. It's pixel count is this
 // value squared. This value affects required CPU->GPU bandwidth per frame.
 #define NOISE_SIZE (256 / 2)
 
+// The raymarcher first traces cones at 1/PREPASS_DIVISOR of the resolution
+// (in both directions) to find how far each full resolution ray can safely
+// skip ahead. Larger values make the pre-pass cheaper but less effective.
+#define PREPASS_DIVISOR 4
+
+// Shadow rays are traced in a separate pass at 1/SHADOW_DIVISOR of the
+// resolution, and upsampled in the effect shader.
+#define SHADOW_DIVISOR 2
+
+// The mountains' fbm is baked at startup into a TERRAIN_SIZE squared texture
+// which the shaders sample instead of evaluating fbm at every march step.
+#define TERRAIN_SIZE 1024
+
+// The music's spectrogram is baked at startup into a texture with
+// SPECTRUM_BINS frequency bands (columns) and SPECTRUM_RATE rows per second,
+// which shaders sample with spectrum() (shaders/spectrum.glsl).
+#define SPECTRUM_BINS 64
+#define SPECTRUM_RATE 60
+
+// glTF file (.gltf or .glb) with meshes to draw along with the raymarched
+// scene, see mesh.c. Without the file, there are no meshes.
+#define MESH_FILE "data/scene.glb"
+
+// With MESH_SDF_SIZE > 0, the meshes get baked into a signed distance field
+// of MESH_SDF_SIZE^3 voxels and raymarched instead of rasterized, so that
+// they get shadows and reflections. Baking is slow, so the result is cached
+// in MESH_SDF_CACHE, and gets baked again when the meshes or size change.
+#define MESH_SDF_SIZE 0
+#define MESH_SDF_CACHE "data/scene.sdf"
+
+// Image files which every pass can sample as u_Texture0, u_Texture1 and so
+// on, see textures.c. PNG and JPEG files get decoded at startup on other
+// threads, and KTX2 files with ETC2 (GLES builds) or BC1, BC3 or BC7 (GL
+// builds) compressed levels get uploaded as they are. Textures sample as
+// black until they are uploaded, or when their files are missing. Passes
+// have 16 texture units, so keep this list short. List the files with a
+// comma after each, for example
+// #define TEXTURE_FILES "data/texture0.png", "data/texture1.png",
+#define TEXTURE_FILES
+
+// Textures get uploaded at most TEXTURE_UPLOAD_BYTES per frame, through a
+// ring of TEXTURE_PBOS pixel buffer objects. One row of the widest texture
+// must fit: width * 4 bytes for RGBA (or one row of compressed blocks).
+#define TEXTURE_UPLOAD_BYTES (1024 * 1024)
+#define TEXTURE_PBOS 3
+
+// GPU memory for all textures with their mip levels. Textures which don't fit
+// get reduced to half their size until they do.
+#define TEXTURE_BUDGET (128 * 1024 * 1024)
+
+// The CPU renderer (main.c --cpu) renders at 1/CPU_DIVISOR of the resolution
+#define CPU_DIVISOR 2
+
+// Video export (main.c --export) renders at EXPORT_FPS, and reads frames back
+// from the GPU through a ring of EXPORT_PBOS buffers, so each frame is
+// copied out EXPORT_PBOS frames after it was rendered.
+#define EXPORT_FPS 60
+#define EXPORT_PBOS 3
+
+// The effect shader can shade only one of every CHECKERBOARD pixels per frame
+// in a rotating pattern, and reproject the rest from the previous frame.
+// 1 shades every pixel (off), 2 is a checkerboard and 4 is a 2x2 pattern.
+#define CHECKERBOARD 1
+
+// The lighting pass classifies the screen into SHADING_TILE_SIZE *
+// SHADING_TILE_SIZE pixel tiles of sky, water or solid surfaces (or a mix),
+// and shades each class with a program specialised for it.
+#define SHADING_TILE_SIZE 16
+
+// When POST_TO_WINDOW is 1, the post processing pass draws straight into the
+// window instead of an offscreen framebuffer which then gets scaled to the
+// window. This saves a full resolution image and a copy every frame. Video
+// export (exporter.c) still gets an offscreen image.
+#define POST_TO_WINDOW 1
+
+// Tiled rendering (main.c --poster) renders POSTER_TILE * POSTER_TILE pixels at
+// a time, with POSTER_GUARD extra pixels on every side so that bloom and
+// chromatic aberration are seamless. POSTER_GUARD should cover the bloom blur's
+// reach (shaders/blur_kernel.glsl, the weights are negligible after about 25
+// quarter resolution pixels). Both must be multiples of 8, so that the low
+// resolution passes' pixels line up.
+#define POSTER_TILE 512
+#define POSTER_GUARD 128
+
+// In debug builds, a paused frame only gets rendered again when something
+// which affects it changes. Before that, it gets refined with this many
+// jittered samples, which anti-aliases it. 0 disables refinement.
+#define REFINE_SAMPLES 64
+
 // GLSL_VERSION is prefixed to every shader, change it if you need some other
-// version than specified here.
+// version than specified here. Compute shaders (.comp) get
+// GLSL_COMPUTE_VERSION instead, the first version which has them.
 #ifdef GLES
 #define GLSL_VERSION "#version 300 es\n"
+#define GLSL_COMPUTE_VERSION "#version 310 es\n"
 #else
 #define GLSL_VERSION "#version 330 core\n"
+#define GLSL_COMPUTE_VERSION "#version 430 core\n"
 #endif
 
 #endif
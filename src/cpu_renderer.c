@@ -0,0 +1,914 @@
+// A native C version of the scene in shaders/shader.frag and the post
+// processing chain, for machines without a GPU. It renders without any
+// OpenGL, straight into an SDL surface.
+//
+// Rays are traced in packets of LANES neighbouring pixels. Every packet
+// stores its vectors as a "struct of arrays" (all x coordinates together,
+// then all y coordinates...), and the scene functions loop over the lanes,
+// which lets the compiler turn those loops into SIMD instructions. The
+// Makefile compiles this file with extra optimization flags for that.
+//
+// The image is split into tiles which run on a thread pool (thread_pool.c).
+//
+// Keep this in sync with shaders/shader.frag, sdf.glsl, march.glsl and the
+// post processing shaders. Differences to the OpenGL renderer:
+// - No depth pre-pass, checkerboard rendering or shadow upsampling, every
+//   pixel traces all of its rays.
+// - The mountains always use the baked terrain (no ANALYTIC_TERRAIN).
+
+#include "config.h"
+#include "rand.h"
+#include "terrain.h"
+#include "thread_pool.h"
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sync.h>
+
+// Rays per packet. 8 fills an AVX register, and two SSE registers.
+#define LANES 8
+// Tile width and height in pixels, must be a multiple of LANES
+#define TILE_SIZE 32
+
+#define PI 3.14159265f
+#define EPSILON 0.001f
+
+// These match the bloom blur kernel (see scripts/kernel.py and
+// shaders/blur_kernel.glsl)
+#define KERNEL_SIZE 50
+#define KERNEL_VARIANCE 8.f
+#define BLUR_SAMPLES 8
+
+typedef struct {
+    float x, y, z;
+} vec3_t;
+
+// A packet of LANES vectors
+typedef struct {
+    float x[LANES], y[LANES], z[LANES];
+} vec3_lanes_t;
+
+// Everything a frame needs from rocket, and values computed from them
+typedef struct {
+    float time;
+    // rotation3D(...) for the buoy, column-major like GLSL's mat3
+    float buoy_rotation[9];
+    vec3_t buoy_center;
+    vec3_t cam_pos;
+    // viewMatrix(...) columns
+    vec3_t cam_s, cam_u, cam_f;
+    float focal;
+    vec3_t sky_color1, sky_color2;
+    float sky_brightness[2];
+    vec3_t light_color;
+    // Direction towards the light
+    vec3_t light;
+    float aberration;
+    float bloom_threshold;
+} frame_t;
+
+typedef struct {
+    int width, height;
+    thread_pool_t *pool;
+    float *terrain;
+    // RGB float images. Rows are stored bottom to top like in OpenGL.
+    float *hdr;
+    float *bloom[2];
+    float kernel[KERNEL_SIZE];
+    unsigned char noise[NOISE_SIZE * NOISE_SIZE * 4];
+    // Final image, gets scaled to the target surface
+    SDL_Surface *output;
+    frame_t frame;
+} cpu_renderer_t;
+
+// Vector helpers for the scalar parts (shading)
+// ----------------------------------------------------------------------------
+
+static vec3_t v3(float x, float y, float z) { return (vec3_t){x, y, z}; }
+static vec3_t v3_add(vec3_t a, vec3_t b) {
+    return v3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+static vec3_t v3_sub(vec3_t a, vec3_t b) {
+    return v3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+static vec3_t v3_mul(vec3_t a, vec3_t b) {
+    return v3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+static vec3_t v3_scale(vec3_t a, float s) {
+    return v3(a.x * s, a.y * s, a.z * s);
+}
+static float v3_dot(vec3_t a, vec3_t b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+static vec3_t v3_normalize(vec3_t a) {
+    return v3_scale(a, 1.f / sqrtf(v3_dot(a, a)));
+}
+static vec3_t v3_mix(vec3_t a, vec3_t b, vec3_t t) {
+    return v3(a.x + (b.x - a.x) * t.x, a.y + (b.y - a.y) * t.y,
+              a.z + (b.z - a.z) * t.z);
+}
+static vec3_t v3_exp(vec3_t a) { return v3(expf(a.x), expf(a.y), expf(a.z)); }
+static float clampf(float x, float lo, float hi) {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+static vec3_t reflect(vec3_t i, vec3_t n) {
+    return v3_sub(i, v3_scale(n, 2.f * v3_dot(n, i)));
+}
+
+static vec3_t refract(vec3_t i, vec3_t n, float eta) {
+    float d = v3_dot(n, i);
+    float k = 1.f - eta * eta * (1.f - d * d);
+    if (k < 0.f) {
+        return v3(0.f, 0.f, 0.f);
+    }
+    return v3_sub(v3_scale(i, eta), v3_scale(n, eta * d + sqrtf(k)));
+}
+
+static vec3_t lane(const vec3_lanes_t *v, int i) {
+    return v3(v->x[i], v->y[i], v->z[i]);
+}
+
+static void set_lane(vec3_lanes_t *v, int i, vec3_t a) {
+    v->x[i] = a.x;
+    v->y[i] = a.y;
+    v->z[i] = a.z;
+}
+
+// Sine without a libm call, so that loops calling it can be vectorized.
+// Reduces x to a quarter period and evaluates a Taylor polynomial. The error
+// is a few times 1e-6, growing to about 2e-5 at x = 300.
+static inline float fast_sin(float x) {
+    // Period count, rounded to nearest
+    float q = x * (1.f / (2.f * PI));
+    q -= (float)(int)(q + (q < 0.f ? -.5f : .5f));
+    // Now q is in -0.5..0.5 periods, mirror it to -0.25..0.25
+    q = q > .25f ? .5f - q : q;
+    q = q < -.25f ? -.5f - q : q;
+    float y = q * (2.f * PI);
+    float y2 = y * y;
+    return y * (1.f +
+                y2 * (-1.f / 6.f +
+                      y2 * (1.f / 120.f +
+                            y2 * (-1.f / 5040.f + y2 * (1.f / 362880.f)))));
+}
+
+// Scene, see shader.frag and sdf.glsl
+// ----------------------------------------------------------------------------
+
+static const vec3_t MTL_COLORS[] = {
+    {0.04f * .7f, 0.033f * .7f, 0.03f * .7f}, // Water absorptivity
+    {0.9f, 0.9f, 0.9f},
+    {0.56f, 0.57f, 0.58f},
+    {0.8f, 0.14f, 0.12f},
+};
+
+// x = roughness, y = metalness, z = reflectance
+static const vec3_t MTL_PARAMS[] = {
+    {0.f, 0.f, 0.f}, // Unused
+    {0.1f, 0.f, 0.9f},
+    {0.9f, 0.f, 0.1f},
+    {0.4f, 0.3f, 0.2f},
+};
+
+// Rotates lanes of (x, z) by rotation2D(angle) in the shader
+#define ROTATE_XZ(x, z, angle)                                                 \
+    do {                                                                       \
+        const float c_ = cosf(angle), s_ = sinf(angle);                       \
+        for (int i = 0; i < LANES; i++) {                                      \
+            float rx = c_ * x[i] + s_ * z[i];                                  \
+            z[i] = -s_ * x[i] + c_ * z[i];                                     \
+            x[i] = rx;                                                         \
+        }                                                                      \
+    } while (0)
+
+static void sd_sea(const frame_t *fr, const vec3_lanes_t *p, float *dist) {
+    const float t = fr->time;
+    float x[LANES], y[LANES], z[LANES];
+    for (int i = 0; i < LANES; i++) {
+        x[i] = p->x[i];
+        z[i] = p->z[i];
+        y[i] = p->y[i] + fast_sin(z[i] * 0.225f + t * 0.3f) * 1.f +
+               fast_sin(z[i] * 0.15f + t * 0.4f) * 0.6f +
+               fast_sin(z[i] * 0.15f - t * 0.6f) * 0.6f +
+               fast_sin(x[i] * 0.125f + t * 0.3f) * 1.f;
+    }
+    ROTATE_XZ(x, z, .1f);
+    for (int i = 0; i < LANES; i++) {
+        y[i] += fabsf(fast_sin(x[i] * 0.25f + t * 0.8f)) * 0.5f +
+                fabsf(fast_sin(x[i] * 0.22f - t * 0.2f)) * 0.5f;
+    }
+    ROTATE_XZ(x, z, .6f);
+    for (int i = 0; i < LANES; i++) {
+        y[i] += fabsf(fast_sin(x[i] * 0.5f + t * 0.7f)) * 0.25f +
+                fabsf(fast_sin(x[i] * 0.22f - t * 0.2f)) * 0.5f;
+    }
+    ROTATE_XZ(x, z, 1.9f);
+    for (int i = 0; i < LANES; i++) {
+        dist[i] = y[i] + fabsf(fast_sin(x[i] + t)) * 0.125f;
+    }
+}
+
+// Same as textureLod(u_TerrainSampler, st / (2. * PI), 0.) in the shader,
+// with linear filtering and repeat wrapping
+static float terrain(const float *heights, float s, float t) {
+    float u = s * (TERRAIN_SIZE / (2.f * PI)) - .5f;
+    float v = t * (TERRAIN_SIZE / (2.f * PI)) - .5f;
+    float fu = floorf(u), fv = floorf(v);
+    int x0 = ((int)fu % TERRAIN_SIZE + TERRAIN_SIZE) % TERRAIN_SIZE;
+    int y0 = ((int)fv % TERRAIN_SIZE + TERRAIN_SIZE) % TERRAIN_SIZE;
+    int x1 = (x0 + 1) % TERRAIN_SIZE, y1 = (y0 + 1) % TERRAIN_SIZE;
+    float a = u - fu, b = v - fv;
+    float h0 = heights[y0 * TERRAIN_SIZE + x0] * (1.f - a) +
+               heights[y0 * TERRAIN_SIZE + x1] * a;
+    float h1 = heights[y1 * TERRAIN_SIZE + x0] * (1.f - a) +
+               heights[y1 * TERRAIN_SIZE + x1] * a;
+    return h0 * (1.f - b) + h1 * b;
+}
+
+static void sd_mtn(const float *heights, const vec3_lanes_t *p, float *dist,
+                   float *mtl) {
+    float h[LANES];
+    // Texture lookups can't be vectorized, so they get their own loop
+    for (int i = 0; i < LANES; i++) {
+        h[i] = terrain(heights, p->x[i] / 40.f, p->z[i] / 40.f);
+    }
+    for (int i = 0; i < LANES; i++) {
+        float x = p->x[i], z = p->z[i];
+        dist[i] = p->y[i] - (20.f + h[i] * 3.4f) + sqrtf(x * x + z * z) * 0.7f +
+                  fast_sin(x / 10.f) * 3.f;
+        mtl[i] = clampf(fast_sin(x) * 1000.f, 0.f, 1.f) + 1.f;
+    }
+}
+
+// opUnion in sdf.glsl
+static inline void op_union(float *d, float *m, float d2, float m2, float f) {
+    if (!(*d < d2 && *m + EPSILON >= f)) {
+        *d = d2;
+        *m = m2;
+    }
+}
+
+static void sd_buoy(const frame_t *fr, const vec3_lanes_t *p, float f,
+                    float *dist, float *mtl) {
+    const float *r = fr->buoy_rotation;
+    for (int i = 0; i < LANES; i++) {
+        float x = p->x[i] - fr->buoy_center.x;
+        float y = p->y[i] - fr->buoy_center.y;
+        float z = p->z[i] - fr->buoy_center.z;
+        float qx = r[0] * x + r[3] * y + r[6] * z;
+        float qy = r[1] * x + r[4] * y + r[7] * z;
+        float qz = r[2] * x + r[5] * y + r[8] * z;
+
+        float d = sqrtf(qx * qx + qy * qy + qz * qz) - 5.f, m = 3.f;
+        qx *= 0.99f;
+        qy *= 0.99f;
+        qz *= 0.99f;
+        float top = qy - 1.2f, bottom = qy + 1.2f;
+        float d1 = sqrtf(qx * qx + top * top + qz * qz) - 5.f, m1 = 1.f;
+        float d2 = sqrtf(qx * qx + bottom * bottom + qz * qz) - 5.f;
+        op_union(&d1, &m1, d2, 1.f, f);
+        op_union(&d, &m, d1, m1, f);
+        dist[i] = d;
+        mtl[i] = m;
+    }
+}
+
+static void sdf(const cpu_renderer_t *r, const vec3_lanes_t *p, float f,
+                float *dist, float *mtl) {
+    float mtn[LANES], mtn_mtl[LANES], buoy[LANES], buoy_mtl[LANES];
+    sd_sea(&r->frame, p, dist);
+    sd_mtn(r->terrain, p, mtn, mtn_mtl);
+    sd_buoy(&r->frame, p, f, buoy, buoy_mtl);
+    for (int i = 0; i < LANES; i++) {
+        mtl[i] = 0.f;
+        op_union(dist + i, mtl + i, mtn[i], mtn_mtl[i], f);
+        op_union(dist + i, mtl + i, buoy[i], buoy_mtl[i], f);
+    }
+}
+
+static void normal(const cpu_renderer_t *r, const vec3_lanes_t *p, float f,
+                   vec3_lanes_t *n) {
+    float d0[LANES], d1[LANES], unused[LANES];
+    float *axes[3] = {n->x, n->y, n->z};
+    for (int a = 0; a < 3; a++) {
+        vec3_lanes_t q = *p;
+        float *c = (float *[]){q.x, q.y, q.z}[a];
+        const float *pc = (const float *[]){p->x, p->y, p->z}[a];
+        for (int i = 0; i < LANES; i++) {
+            c[i] = pc[i] + EPSILON;
+        }
+        sdf(r, &q, f, d0, unused);
+        for (int i = 0; i < LANES; i++) {
+            c[i] = pc[i] - EPSILON;
+        }
+        sdf(r, &q, f, d1, unused);
+        for (int i = 0; i < LANES; i++) {
+            axes[a][i] = d0[i] - d1[i];
+        }
+    }
+    for (int i = 0; i < LANES; i++) {
+        float len = sqrtf(n->x[i] * n->x[i] + n->y[i] * n->y[i] +
+                          n->z[i] * n->z[i]);
+        n->x[i] /= len;
+        n->y[i] /= len;
+        n->z[i] /= len;
+    }
+}
+
+// Result of march for a packet, like the vec3 returned by march.glsl
+typedef struct {
+    float t[LANES], mtl[LANES], shadow[LANES];
+} hit_lanes_t;
+
+// march.glsl for a packet of rays. Only lanes which are set in `active` get
+// traced, the rest of the result is left as zeroes.
+static void march(const cpu_renderer_t *r, const vec3_lanes_t *o,
+                  const vec3_lanes_t *d, float start, float far, float k,
+                  float f, const int *active, hit_lanes_t *hit) {
+    int running[LANES];
+    memset(hit, 0, sizeof(hit_lanes_t));
+    for (int i = 0; i < LANES; i++) {
+        running[i] = active[i];
+        hit->t[i] = start;
+        hit->shadow[i] = 1.f;
+    }
+
+    for (int step = 0; step < 256; step++) {
+        int any = 0;
+        for (int i = 0; i < LANES; i++) {
+            any |= running[i];
+        }
+        if (!any) {
+            break;
+        }
+
+        // Every lane gets evaluated, because skipping finished lanes would
+        // cost more than what it saves
+        vec3_lanes_t p;
+        float dist[LANES], mtl[LANES];
+        for (int i = 0; i < LANES; i++) {
+            p.x[i] = o->x[i] + d->x[i] * hit->t[i];
+            p.y[i] = o->y[i] + d->y[i] * hit->t[i];
+            p.z[i] = o->z[i] + d->z[i] * hit->t[i];
+        }
+        sdf(r, &p, f, dist, mtl);
+
+        for (int i = 0; i < LANES; i++) {
+            if (running[i]) {
+                float t = hit->t[i] + dist[i] * 0.8f;
+                float shadow = k * dist[i] / t;
+                hit->t[i] = t;
+                hit->mtl[i] = mtl[i];
+                hit->shadow[i] =
+                    shadow < hit->shadow[i] ? shadow : hit->shadow[i];
+                if (dist[i] < EPSILON) {
+                    hit->shadow[i] = 0.f;
+                    running[i] = 0;
+                } else if (t > far) {
+                    running[i] = 0;
+                }
+            }
+        }
+    }
+}
+
+// Shading, see shader.frag
+// ----------------------------------------------------------------------------
+
+static vec3_t sky(const frame_t *fr, vec3_t v) {
+    float t = powf(clampf(v.y * .5f + .5f, 0.f, 1.f), .4f);
+    return v3_mix(v3_scale(fr->sky_color1, fr->sky_brightness[0]),
+                  v3_scale(fr->sky_color2, fr->sky_brightness[1]),
+                  v3(t, t, t));
+}
+
+static vec3_t fresnel_schlick(float cos_theta, vec3_t f0) {
+    float a = 1.f - cos_theta;
+    float a5 = a * a * a * a * a;
+    return v3(f0.x + (1.f - f0.x) * a5, f0.y + (1.f - f0.y) * a5,
+              f0.z + (1.f - f0.z) * a5);
+}
+
+static float d_ggx(float n_dot_h, float roughness) {
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+    float b = n_dot_h * n_dot_h * (alpha2 - 1.f) + 1.f;
+    return alpha2 / (PI * b * b);
+}
+
+static float g1_ggx_schlick(float n_dot_v, float k) {
+    return fmaxf(n_dot_v, EPSILON) / (n_dot_v * (1.f - k) + k);
+}
+
+static float g_smith(float n_dot_v, float n_dot_l, float roughness) {
+    float k = roughness * roughness / 2.f;
+    return g1_ggx_schlick(n_dot_l, k) * g1_ggx_schlick(n_dot_v, k);
+}
+
+static vec3_t brdf(vec3_t l, vec3_t v, vec3_t n, float metallic,
+                   float roughness, vec3_t base_color, float reflectance) {
+    vec3_t h = v3_normalize(v3_add(v, l));
+    float n_dot_v = clampf(v3_dot(n, v), EPSILON, 1.f);
+    float n_dot_l = clampf(v3_dot(n, l), EPSILON, 1.f);
+    float n_dot_h = clampf(v3_dot(n, h), EPSILON, 1.f);
+    float v_dot_h = clampf(v3_dot(v, h), EPSILON, 1.f);
+    float l_dot_v = clampf(v3_dot(l, v), EPSILON, 1.f);
+
+    float f0s = 0.16f * reflectance * reflectance;
+    vec3_t f0 = v3_mix(v3(f0s, f0s, f0s), base_color,
+                       v3(metallic, metallic, metallic));
+
+    vec3_t fresnel = fresnel_schlick(v_dot_h, f0);
+    float spec = d_ggx(n_dot_h, roughness) *
+                 g_smith(n_dot_v, n_dot_l, roughness) /
+                 (4.f * n_dot_v * n_dot_l);
+
+    // Oren-Nayar diffuse
+    float sigma2 = roughness * roughness;
+    float term_a = 1.f - .5f * sigma2 / (sigma2 + .57f);
+    float term_b = .45f * sigma2 / (sigma2 + .09f);
+    float cos_azimuth =
+        (l_dot_v - n_dot_v * n_dot_l) / fmaxf(n_dot_v, n_dot_l);
+    float diff = (1.f - metallic) *
+                 (term_a + term_b * fmaxf(0.f, cos_azimuth)) / PI;
+
+    return v3(base_color.x * (1.f - fresnel.x) * diff + fresnel.x * spec,
+              base_color.y * (1.f - fresnel.y) * diff + fresnel.y * spec,
+              base_color.z * (1.f - fresnel.z) * diff + fresnel.z * spec);
+}
+
+static int material_id(float mtl) {
+    int id = (int)mtl;
+    return id < 0 ? 0 : (id > 3 ? 3 : id);
+}
+
+static vec3_t light(const frame_t *fr, vec3_t dir, vec3_t n, vec3_t ga,
+                    int mtl_id, vec3_t param_offset, float shadow) {
+    vec3_t albedo = MTL_COLORS[mtl_id];
+    vec3_t params = v3_add(MTL_PARAMS[mtl_id], param_offset);
+    params = v3(clampf(params.x, 0.f, 1.f), clampf(params.y, 0.f, 1.f),
+                clampf(params.z, 0.f, 1.f));
+    vec3_t irradiance =
+        v3_scale(fr->light_color, fmaxf(v3_dot(fr->light, n), 0.f) * shadow);
+    irradiance = v3_mul(v3_add(irradiance, sky(fr, n)), ga);
+    vec3_t b = brdf(fr->light, v3_scale(dir, -1.f), n, params.y, params.x,
+                    albedo, params.z);
+    return v3_mul(irradiance, b);
+}
+
+// Everything traced for one water pixel, see water() in shader.frag
+typedef struct {
+    vec3_t refracted;
+    float underwater_t;
+    float underwater_mtl;
+    vec3_t underwater_pos;
+    vec3_t underwater_normal;
+    float shadow;
+    float scatter_shadow;
+} water_hit_t;
+
+static vec3_t water(const frame_t *fr, vec3_t pos, vec3_t dir, vec3_t n,
+                    const water_hit_t *w) {
+    vec3_t absorptivity = MTL_COLORS[0];
+    vec3_t reflected = sky(fr, reflect(dir, n));
+    vec3_t fresnel = fresnel_schlick(v3_dot(n, v3_scale(dir, -1.f)),
+                                     v3(.02f, .02f, .02f));
+    vec3_t rd = w->refracted;
+
+    vec3_t scattered = v3(0.f, 0.f, 0.f);
+    vec3_t scatter_albedo = v3(.1f * .005f, .2f * .005f, .1f * .005f);
+    vec3_t irradiance = v3_scale(
+        fr->light_color,
+        fmaxf(v3_dot(fr->light, n), 0.f) * w->scatter_shadow);
+    for (int i = 0; i < 4; i++) {
+        float sample_y = pos.y - (float)i * .5f;
+        float t = fmaxf(-rd.y - sample_y, 0.f) * 2.f;
+        vec3_t s = v3_mul(v3_exp(v3_scale(absorptivity, -t)),
+                          v3_mul(fr->light_color, scatter_albedo));
+        scattered = v3_add(scattered, v3_mul(s, irradiance));
+    }
+
+    vec3_t fl = fresnel_schlick(fr->light.y, v3(.02f, .02f, .02f));
+    vec3_t attenuation =
+        v3_sub(v3_exp(v3_scale(absorptivity, w->underwater_pos.y)), fl);
+    attenuation = v3(fmaxf(attenuation.x, 0.f), fmaxf(attenuation.y, 0.f),
+                     fmaxf(attenuation.z, 0.f));
+    vec3_t transmitted =
+        light(fr, rd, w->underwater_normal, attenuation,
+              material_id(w->underwater_mtl), v3(1.f, 0.f, 0.f), w->shadow);
+    transmitted = v3_mul(
+        transmitted, v3_exp(v3_scale(absorptivity, -w->underwater_t)));
+
+    return v3_mix(v3_add(transmitted, scattered), reflected, fresnel);
+}
+
+// Traces and shades a packet of LANES pixels on row y, starting from x.
+// Writes RGB into `out`.
+static void trace_packet(const cpu_renderer_t *r, int x, int y, float *out) {
+    const frame_t *fr = &r->frame;
+    float aspect = (float)r->width / (float)r->height;
+
+    // Primary rays, see worldRay and camera.glsl
+    vec3_lanes_t o, d;
+    int all[LANES];
+    for (int i = 0; i < LANES; i++) {
+        float cx = ((float)(x + i) + .5f) / (float)r->width * 2.f - 1.f;
+        float cy = ((float)y + .5f) / (float)r->height * 2.f - 1.f;
+        vec3_t v = v3_normalize(v3(cx * aspect, cy, fr->focal));
+        vec3_t w = v3_add(
+            v3_add(v3_scale(fr->cam_s, v.x), v3_scale(fr->cam_u, v.y)),
+            v3_scale(fr->cam_f, v.z));
+        set_lane(&o, i, fr->cam_pos);
+        set_lane(&d, i, w);
+        all[i] = 1;
+    }
+
+    hit_lanes_t hit;
+    march(r, &o, &d, EPSILON, 1024.f, 20.f, 0.f, all, &hit);
+
+    vec3_lanes_t pos, n;
+    int water_lanes[LANES];
+    int any_water = 0;
+    for (int i = 0; i < LANES; i++) {
+        pos.x[i] = o.x[i] + d.x[i] * hit.t[i];
+        pos.y[i] = o.y[i] + d.y[i] * hit.t[i];
+        pos.z[i] = o.z[i] + d.z[i] * hit.t[i];
+        water_lanes[i] = material_id(hit.mtl[i]) == 0;
+        any_water |= water_lanes[i];
+    }
+    normal(r, &pos, 0.f, &n);
+
+    // Water refracts rays into the water, see traceShadows and water
+    water_hit_t water_hits[LANES];
+    vec3_lanes_t refracted, shadow_origin, light_dir;
+    for (int i = 0; i < LANES; i++) {
+        vec3_t rd = water_lanes[i]
+                        ? refract(lane(&d, i), lane(&n, i), 1.f / 1.333f)
+                        : v3(0.f, 1.f, 0.f);
+        set_lane(&refracted, i, rd);
+        set_lane(&light_dir, i, fr->light);
+        water_hits[i].refracted = rd;
+        water_hits[i].scatter_shadow = 1.f;
+    }
+    shadow_origin = pos;
+    if (any_water) {
+        hit_lanes_t under;
+        vec3_lanes_t under_pos, under_n;
+        march(r, &pos, &refracted, EPSILON, 1024.f, 20.f, 1.f, water_lanes,
+              &under);
+        for (int i = 0; i < LANES; i++) {
+            under_pos.x[i] = pos.x[i] + refracted.x[i] * under.t[i];
+            under_pos.y[i] = pos.y[i] + refracted.y[i] * under.t[i];
+            under_pos.z[i] = pos.z[i] + refracted.z[i] * under.t[i];
+        }
+        normal(r, &under_pos, 1.f, &under_n);
+        for (int i = 0; i < LANES; i++) {
+            if (water_lanes[i]) {
+                water_hits[i].underwater_t = under.t[i];
+                water_hits[i].underwater_mtl = under.mtl[i];
+                water_hits[i].underwater_pos = lane(&under_pos, i);
+                water_hits[i].underwater_normal = lane(&under_n, i);
+                set_lane(&shadow_origin, i, lane(&under_pos, i));
+            }
+        }
+
+        // Light scattered in the water is shadowed from four sample points
+        for (int i = 0; i < LANES; i++) {
+            if (water_lanes[i]) {
+                water_hits[i].scatter_shadow = 0.f;
+            }
+        }
+        for (int s = 0; s < 4; s++) {
+            vec3_lanes_t sample = pos;
+            for (int i = 0; i < LANES; i++) {
+                sample.y[i] -= (float)s * .5f;
+            }
+            hit_lanes_t scatter;
+            march(r, &sample, &light_dir, 1.f, 256.f, 10.f, 1.f, water_lanes,
+                  &scatter);
+            for (int i = 0; i < LANES; i++) {
+                if (water_lanes[i]) {
+                    water_hits[i].scatter_shadow +=
+                        clampf(scatter.shadow[i], 0.f, 1.f) / 4.f;
+                }
+            }
+        }
+    }
+
+    // Shadow of the surface, or the underwater surface for water
+    hit_lanes_t shadow;
+    march(r, &shadow_origin, &light_dir, 1.f, 1024.f, 30.f, 1.f, all, &shadow);
+
+    for (int i = 0; i < LANES; i++) {
+        vec3_t ray = lane(&d, i);
+        vec3_t radiance;
+        float s = clampf(shadow.shadow[i], 0.f, 1.f);
+        if (water_lanes[i]) {
+            water_hits[i].shadow = s;
+            radiance = water(fr, lane(&pos, i), ray, lane(&n, i),
+                             water_hits + i);
+        } else {
+            radiance = light(fr, ray, lane(&n, i), v3(1.f, 1.f, 1.f),
+                             material_id(hit.mtl[i]), v3(0.f, 0.f, 0.f), s);
+        }
+
+        // Fog towards the sky
+        float mask = clampf(hit.t[i] / 350.f - 1.f, 0.f, 1.f);
+        vec3_t color = v3_mix(radiance, sky(fr, ray), v3(mask, mask, mask));
+        out[i * 3 + 0] = color.x;
+        out[i * 3 + 1] = color.y;
+        out[i * 3 + 2] = color.z;
+    }
+}
+
+static void trace_tile(void *userdata, size_t index) {
+    cpu_renderer_t *r = (cpu_renderer_t *)userdata;
+    int tiles_x = (r->width + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (int)(index % tiles_x) * TILE_SIZE;
+    int y0 = (int)(index / tiles_x) * TILE_SIZE;
+
+    for (int y = y0; y < y0 + TILE_SIZE && y < r->height; y++) {
+        for (int x = x0; x < x0 + TILE_SIZE && x < r->width; x += LANES) {
+            float rgb[LANES * 3];
+            trace_packet(r, x, y, rgb);
+            // The last packet of a row may be partly outside of the image
+            int count = r->width - x < LANES ? r->width - x : LANES;
+            memcpy(r->hdr + (y * r->width + x) * 3, rgb,
+                   sizeof(float) * 3 * count);
+        }
+    }
+}
+
+// Post processing, see bloom_pre.frag, blur.frag and post.frag
+// ----------------------------------------------------------------------------
+
+// Bilinear texture lookup with clamp to edge wrapping
+static vec3_t sample_linear(const float *image, int w, int h, float u,
+                            float v) {
+    u = u * w - .5f;
+    v = v * h - .5f;
+    float fu = floorf(u), fv = floorf(v);
+    float a = u - fu, b = v - fv;
+    int x0 = (int)fu, y0 = (int)fv;
+    int x1 = x0 + 1, y1 = y0 + 1;
+    x0 = x0 < 0 ? 0 : (x0 >= w ? w - 1 : x0);
+    x1 = x1 < 0 ? 0 : (x1 >= w ? w - 1 : x1);
+    y0 = y0 < 0 ? 0 : (y0 >= h ? h - 1 : y0);
+    y1 = y1 < 0 ? 0 : (y1 >= h ? h - 1 : y1);
+    const float *p00 = image + (y0 * w + x0) * 3;
+    const float *p10 = image + (y0 * w + x1) * 3;
+    const float *p01 = image + (y1 * w + x0) * 3;
+    const float *p11 = image + (y1 * w + x1) * 3;
+    float c[3];
+    for (int i = 0; i < 3; i++) {
+        float top = p00[i] * (1.f - a) + p10[i] * a;
+        float bottom = p01[i] * (1.f - a) + p11[i] * a;
+        c[i] = top * (1.f - b) + bottom * b;
+    }
+    return v3(c[0], c[1], c[2]);
+}
+
+static void bloom_pre_row(void *userdata, size_t y) {
+    cpu_renderer_t *r = (cpu_renderer_t *)userdata;
+    int w = r->width / 2, h = r->height / 2;
+    for (int x = 0; x < w; x++) {
+        vec3_t c = sample_linear(r->hdr, r->width, r->height,
+                                 ((float)x + .5f) / w, ((float)y + .5f) / h);
+        float brightness = v3_dot(c, v3(.2126f, .7152f, .0722f));
+        if (brightness < 1.f + r->frame.bloom_threshold) {
+            c = v3(0.f, 0.f, 0.f);
+        }
+        float *out = r->bloom[0] + (y * w + x) * 3;
+        out[0] = c.x;
+        out[1] = c.y;
+        out[2] = c.z;
+    }
+}
+
+// Blurs a row of bloom[0] horizontally into bloom[1], or a row of bloom[1]
+// vertically into bloom[0]. Pixels outside of the image are black.
+static void blur(cpu_renderer_t *r, int y, int horizontal) {
+    int w = r->width / 2, h = r->height / 2;
+    const float *in = r->bloom[horizontal ? 0 : 1];
+    float *out = r->bloom[horizontal ? 1 : 0];
+    for (int x = 0; x < w; x++) {
+        float c[3] = {0.f, 0.f, 0.f};
+        for (int i = 1 - KERNEL_SIZE; i < KERNEL_SIZE; i++) {
+            int sx = horizontal ? x + i : x;
+            int sy = horizontal ? y : y + i;
+            if (sx < 0 || sx >= w || sy < 0 || sy >= h) {
+                continue;
+            }
+            float k = r->kernel[abs(i)];
+            const float *p = in + (sy * w + sx) * 3;
+            c[0] += p[0] * k;
+            c[1] += p[1] * k;
+            c[2] += p[2] * k;
+        }
+        memcpy(out + (y * w + x) * 3, c, sizeof(c));
+    }
+}
+
+static void blur_x_row(void *userdata, size_t y) {
+    blur((cpu_renderer_t *)userdata, (int)y, 1);
+}
+
+static void blur_y_row(void *userdata, size_t y) {
+    blur((cpu_renderer_t *)userdata, (int)y, 0);
+}
+
+// https://64.github.io/tonemapping/
+static float aces_approx(float v) {
+    v *= .6f;
+    return clampf((v * (2.51f * v + .03f)) / (v * (2.43f * v + .59f) + .14f),
+                  0.f, 1.f);
+}
+
+static void post_row(void *userdata, size_t y) {
+    cpu_renderer_t *r = (cpu_renderer_t *)userdata;
+    const frame_t *fr = &r->frame;
+    int w = r->width, h = r->height;
+    // Output rows are top to bottom
+    uint32_t *row = (uint32_t *)((unsigned char *)r->output->pixels +
+                                 (h - 1 - (int)y) * r->output->pitch);
+
+    for (int x = 0; x < w; x++) {
+        float fx = ((float)x + .5f) / w * 2.f - 1.f;
+        float fy = ((float)y + .5f) / h * 2.f - 1.f;
+
+        // Input color with RGB aberration, see radialSum
+        float c[3] = {0.f, 0.f, 0.f};
+        for (int i = 0; i < BLUR_SAMPLES; i++) {
+            for (int ch = 0; ch < 3; ch++) {
+                float s = (float)(3 - ch) * (float)i * fr->aberration /
+                          (float)BLUR_SAMPLES;
+                vec3_t v = sample_linear(r->hdr, w, h,
+                                         fx * (.5f - s / w) + .5f,
+                                         fy * (.5f - s / h) + .5f);
+                c[ch] += ch == 0 ? v.x : (ch == 1 ? v.y : v.z);
+            }
+        }
+
+        vec3_t bloom = sample_linear(r->bloom[0], w / 2, h / 2,
+                                     fx * .5f + .5f, fy * .5f + .5f);
+        float color[3] = {c[0] / BLUR_SAMPLES + bloom.x,
+                          c[1] / BLUR_SAMPLES + bloom.y,
+                          c[2] / BLUR_SAMPLES + bloom.z};
+
+        const unsigned char *noise =
+            r->noise + ((y % NOISE_SIZE) * NOISE_SIZE + x % NOISE_SIZE) * 4;
+        float vignette = sqrtf(fx * fx + fy * fy) * .1f;
+        uint32_t pixel = 0xff000000;
+        for (int ch = 0; ch < 3; ch++) {
+            float v = aces_approx(color[ch]);
+            v += noise[ch] / 255.f * .08f - .04f;
+            v = clampf(v - vignette, 0.f, 1.f);
+            pixel |= (uint32_t)(v * 255.f + .5f) << (16 - ch * 8);
+        }
+        row[x] = pixel;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// Reads a vec3 from rocket tracks "<name>.x", "<name>.y" and "<name>.z"
+static vec3_t get_vec3(struct sync_device *rocket, const char *name,
+                       double row) {
+    char track[64];
+    float v[3];
+    for (int i = 0; i < 3; i++) {
+        SDL_snprintf(track, sizeof(track), "%s.%c", name, "xyz"[i]);
+        v[i] = sync_get_val(sync_get_track(rocket, track), row);
+    }
+    return v3(v[0], v[1], v[2]);
+}
+
+// Gets this frame's values from the same rocket tracks that the shaders use
+// (see rocket_track_name in demo.c)
+static void update_frame(frame_t *fr, struct sync_device *rocket,
+                         double row) {
+    fr->time = sync_get_val(sync_get_track(rocket, "AnimationTime"), row);
+
+    // rotation3D(vec3(0.1, 1., 0.5), time * 0.16)
+    vec3_t axis = v3_normalize(v3(.1f, 1.f, .5f));
+    float s = sinf(fr->time * .16f), c = cosf(fr->time * .16f);
+    float oc = 1.f - c;
+    float m[9] = {
+        oc * axis.x * axis.x + c,          oc * axis.x * axis.y - axis.z * s,
+        oc * axis.z * axis.x + axis.y * s, oc * axis.x * axis.y + axis.z * s,
+        oc * axis.y * axis.y + c,          oc * axis.y * axis.z - axis.x * s,
+        oc * axis.z * axis.x - axis.y * s, oc * axis.y * axis.z + axis.x * s,
+        oc * axis.z * axis.z + c,
+    };
+    memcpy(fr->buoy_rotation, m, sizeof(m));
+    fr->buoy_center =
+        v3(200.f, sinf(fr->time) * .7f + sinf(fr->time * .4f), 0.f);
+
+    // viewMatrix and focalLength in camera.glsl
+    float fov = sync_get_val(sync_get_track(rocket, "Cam:fov"), row);
+    fr->cam_pos = get_vec3(rocket, "Cam:pos", row);
+    vec3_t target = get_vec3(rocket, "Cam:target", row);
+    fr->cam_f = v3_normalize(v3_sub(target, fr->cam_pos));
+    fr->cam_s = v3_normalize(v3(-fr->cam_f.z, 0.f, fr->cam_f.x));
+    fr->cam_u = v3(fr->cam_s.y * fr->cam_f.z - fr->cam_s.z * fr->cam_f.y,
+                   fr->cam_s.z * fr->cam_f.x - fr->cam_s.x * fr->cam_f.z,
+                   fr->cam_s.x * fr->cam_f.y - fr->cam_s.y * fr->cam_f.x);
+    fr->focal = tanf((90.f - fov / 2.f) * (PI / 180.f));
+
+    fr->sky_color1 = get_vec3(rocket, "Sky:color1", row);
+    fr->sky_color2 = get_vec3(rocket, "Sky:color2", row);
+    fr->sky_brightness[0] =
+        sync_get_val(sync_get_track(rocket, "Sky:brightness.x"), row);
+    fr->sky_brightness[1] =
+        sync_get_val(sync_get_track(rocket, "Sky:brightness.y"), row);
+
+    fr->light_color = get_vec3(rocket, "Light:color", row);
+    fr->light =
+        v3_scale(v3_normalize(get_vec3(rocket, "Light:direction", row)), -1.f);
+
+    fr->aberration = sync_get_val(sync_get_track(rocket, "Post:aberration"),
+                                  row);
+    fr->bloom_threshold =
+        sync_get_val(sync_get_track(rocket, "Post:bloomTreshold"), row);
+}
+
+cpu_renderer_t *cpu_renderer_init(int width, int height) {
+    cpu_renderer_t *r = calloc(1, sizeof(cpu_renderer_t));
+    if (!r) {
+        return NULL;
+    }
+
+    r->width = width;
+    r->height = height;
+    r->pool = thread_pool_init(0);
+    r->terrain = terrain_bake(r->pool, TERRAIN_SIZE);
+    r->hdr = malloc(sizeof(float) * 3 * width * height);
+    r->bloom[0] = malloc(sizeof(float) * 3 * (width / 2) * (height / 2));
+    r->bloom[1] = malloc(sizeof(float) * 3 * (width / 2) * (height / 2));
+    r->output = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32,
+                                               SDL_PIXELFORMAT_ARGB8888);
+    if (!r->terrain || !r->hdr || !r->bloom[0] || !r->bloom[1] ||
+        !r->output) {
+        SDL_Log("CPU renderer initialization failed\n");
+        return NULL;
+    }
+
+    for (int i = 0; i < KERNEL_SIZE; i++) {
+        float c = KERNEL_VARIANCE;
+        r->kernel[i] = 1.f / sqrtf(2.f * PI * c * c) *
+                       expf(-(float)(i * i) / (2.f * c * c));
+    }
+
+    SDL_Log("CPU renderer: %dx%d, %d rays per packet\n", width, height, LANES);
+    return r;
+}
+
+void cpu_renderer_render(cpu_renderer_t *r, struct sync_device *rocket,
+                         double rocket_row, SDL_Surface *target) {
+    update_frame(&r->frame, rocket, rocket_row);
+
+    // MAKE SOME NOISE (like demo.c does)
+    for (size_t i = 0; i < sizeof(r->noise); i++) {
+        r->noise[i] = rand_xoshiro();
+    }
+
+    int tiles = ((r->width + TILE_SIZE - 1) / TILE_SIZE) *
+                ((r->height + TILE_SIZE - 1) / TILE_SIZE);
+    thread_pool_for(r->pool, tiles, trace_tile, r);
+    thread_pool_for(r->pool, r->height / 2, bloom_pre_row, r);
+    thread_pool_for(r->pool, r->height / 2, blur_x_row, r);
+    thread_pool_for(r->pool, r->height / 2, blur_y_row, r);
+    thread_pool_for(r->pool, r->height, post_row, r);
+
+    // Stretch or squash the image to the target in the correct aspect ratio,
+    // like demo_resize and the output blit in demo.c
+    if (!target) {
+        return;
+    }
+    SDL_Rect rect = {0, 0, target->w, target->h};
+    double aspect_ratio = (double)r->width / (double)r->height;
+    if ((double)target->w / target->h > aspect_ratio) {
+        rect.w = target->h * aspect_ratio;
+        rect.x = (target->w - rect.w) / 2;
+    } else {
+        rect.h = target->w / aspect_ratio;
+        rect.y = (target->h - rect.h) / 2;
+    }
+    SDL_FillRect(target, NULL, 0);
+    SDL_BlitScaled(r->output, NULL, target, &rect);
+}
+
+void cpu_renderer_deinit(cpu_renderer_t *r) {
+    if (r) {
+        thread_pool_deinit(r->pool);
+        SDL_FreeSurface(r->output);
+        free(r->terrain);
+        free(r->hdr);
+        free(r->bloom[0]);
+        free(r->bloom[1]);
+        free(r);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef CPU_RENDERER_H
+#define CPU_RENDERER_H
+
+#include <SDL2/SDL.h>
+#include <sync.h>
+
+// Forward declaration so that implementation remains opaque
+typedef struct cpu_renderer_t_ cpu_renderer_t;
+
+cpu_renderer_t *cpu_renderer_init(int width, int height);
+void cpu_renderer_render(cpu_renderer_t *renderer, struct sync_device *rocket,
+                         double rocket_row, SDL_Surface *target);
+void cpu_renderer_deinit(cpu_renderer_t *renderer);
+
+#endif
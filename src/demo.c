@@ -1,38 +1,122 @@
 #include "config.h"
 #include "gl.h"
+#include "gl_state.h"
+#include "gpu_timer.h"
+#include "mesh.h"
+#include "mesh_sdf.h"
 #include "rand.h"
 #include "shader.h"
+#include "spectrum.h"
 #include "sync.h"
+#include "sync_tracks.h"
+#include "task.h"
+#include "terrain.h"
+#include "textures.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "uniforms.h"
 #include <SDL2/SDL.h>
 #include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Allocate this many FBO:s to run render passes.
-#define FBS 3
+#define FBS 2
 // Allocate this many FBO:s with 1/4th resolution (width/2, height/2).
 #define QUARTER_FBS 2
+// Maximum number of textures (render targets) attached to one FBO
+#define MAX_ATTACHMENTS 2
+// Number of shader programs which every scene shares, see the pass_shaders
+// table below
+#define PASSES 7
+// Number of compute shader programs, see the compute_shaders table below
+#define COMPUTE_PASSES 3
+// Number of scenes, see the scene_shaders table below
+#define SCENES 2
+// Number of passes which trace a scene, all compiled from the scene's shader
+// (the lighting pass is four of them, one per class of screen tiles)
+#define SCENE_PASSES 7
+// Steps which prewarm_step takes to make a scene ready: every pass gets
+// compiled, then linked, then drawn once
+#define PREWARM_STEPS (SCENE_PASSES * 3)
+
+// Every pass can sample these images, see textures.c. The list ends with
+// NULL, so that TEXTURE_FILES can be empty.
+static const char *const texture_files[] = {TEXTURE_FILES NULL};
+#define TEXTURES (sizeof(texture_files) / sizeof(*texture_files) - 1)
 
 // A constant vertex shader, which uses gl_VertexID to output
 // a viewport-filling quad. No buffers or Input Assembly needed.
+// FragCoord goes from -1 to 1 across the viewport, and ImageCoord is the
+// same position in the whole image, which differ only when rendering tiles
+// (see demo_render_tiled). u_TileRect holds the tile's center and size.
+// u_Jitter moves ImageCoord by less than a pixel when a paused frame gets
+// refined with more samples (see demo_skip_frame).
 static const char *vertex_shader_src =
+    "uniform vec4 u_TileRect;\n"
+    "uniform vec2 u_Jitter;\n"
     "out vec2 FragCoord;\n"
+    "out vec2 ImageCoord;\n"
     "void main() {\n"
     "    vec2 c = vec2(-1, 1);\n"
     "    vec4 coords[4] = vec4[4](c.xxyy, c.yxyy, c.xyyy, c.yyyy);\n"
     "    FragCoord = coords[gl_VertexID].xy;\n"
+    "    ImageCoord = FragCoord * u_TileRect.zw + u_TileRect.xy + u_Jitter;\n"
     "    gl_Position = coords[gl_VertexID];\n"
     "}\n";
 
 // This struct bundles FBO resources and metadata
 typedef struct {
     GLuint framebuffer;
-    GLuint texture;
+    GLuint textures[MAX_ATTACHMENTS];
+    // Render passes draw to the rectangle at x, y with this size. x and y are
+    // only nonzero for the window's letterboxed area (framebuffer 0).
+    GLint x, y;
     GLsizei width;
     GLsizei height;
+    // Depth renderbuffer, only in the G-buffer when there are meshes
+    GLuint depth;
+    // Memory used by the textures and the depth buffer
+    size_t bytes;
 } fbo_t;
 
+// The passes which trace a scene, as indices to scene_t's programs. The
+// lighting pass has a variant for every class of screen tiles, in the order
+// of the classes in shaders/shading_tiles.glsl.
+enum {
+    SCENE_PREPASS,
+    SCENE_GEOMETRY,
+    SCENE_SHADOW,
+    SCENE_LIGHTING_SKY,
+    SCENE_LIGHTING_WATER,
+    SCENE_LIGHTING_SOLID,
+    SCENE_LIGHTING_MIXED
+};
+
+// One scene pass's fragment shader, which a task preprocesses
+typedef struct {
+    const char *filename;
+    shader_define_t defines[3];
+    size_t n_defs;
+} scene_job_t;
+
+// A scene's shader programs, and the state of getting them ready before the
+// scene is on screen (see prewarm_step)
+typedef struct {
+    program_t programs[SCENE_PASSES];
+    // Preprocessing tasks, NULL when done or not started
+    task_t *tasks[SCENE_PASSES];
+    scene_job_t jobs[SCENE_PASSES];
+    // Programs which the driver is still linking (see submit_program)
+    GLuint pending[SCENE_PASSES];
+    // Prewarming progress, PREWARM_STEPS when the scene is ready
+    int step;
+} scene_t;
+
 // This messy struct is the backbone of our renderer.
 typedef struct {
     // Holds the "internal" aspect ratio, not window aspect ratio
@@ -45,46 +129,280 @@ typedef struct {
     // OpenGL core requires that we use a VAO when issuing any drawcalls
     GLuint vao;
     // Shader programs for render passes. The stars of this show.
-    program_t effect_program;
+    // Every scene has its own programs for the passes which trace it, and
+    // `scene` is the one on screen (see current_scene).
+    scene_t scenes[SCENES];
+    size_t scene;
+    // Index of the baked Scene track, like uniform_t's track_index
+    int scene_track;
+    program_t resolve_program;
     program_t post_program;
     program_t bloom_pre_program;
     program_t bloom_x_program;
     program_t bloom_y_program;
+    program_t accumulate_program;
+    program_t classify_program;
+    // Compute shader versions of the bloom and post passes, see the
+    // compute_shaders table. `compute` is set when the context has compute
+    // shaders, and use_compute picks them over the fragment shader passes.
+    program_t bloom_x_compute_program;
+    program_t bloom_y_compute_program;
+    program_t post_compute_program;
+    int compute;
+    int use_compute;
+    // Draws the glTF meshes to the G-buffer, see mesh.c. Not in the
+    // pass_shaders table, because it has its own vertex shader.
+    program_t mesh_program;
     // If integer value is 0, there is a problem with the shaders
     int programs_ok;
+    // The vertex shader of every pass, kept for linking scenes later. The
+    // lighting passes draw a quad per screen tile with tile_vertex_shader.
+    GLuint vertex_shader;
+    GLuint tile_vertex_shader;
     // A RGBA noise texture is used in rendering
     GLuint noise_texture;
+    // Baked mountain heights (fbm), see terrain.c
+    GLuint terrain_texture;
+    // The music's spectrogram, see spectrum.c. spectrum_rate is its rows per
+    // rocket row.
+    GLuint spectrum_texture;
+    double spectrum_rate;
+    // Meshes loaded from MESH_FILE, NULL when there are none or when they
+    // are baked into an SDF instead (MESH_SDF_SIZE)
+    mesh_t *mesh;
+    // The meshes' baked SDF, see mesh_sdf.c. The bounds are its center and
+    // half size, and half size 0 means there is no SDF.
+    GLuint sdf_texture;
+    GLfloat sdf_bounds[4];
+    // Image textures from TEXTURE_FILES, which stream in while the demo runs.
+    // textures_updated is set when demo_skip_frame already streamed them for
+    // the next demo_render, which then doesn't, to keep to the upload budget.
+    textures_t *textures;
+    int textures_updated;
     // Our FBOs used for rendering every frame
     fbo_t fbs[FBS];
     fbo_t quarter_fbs[QUARTER_FBS];
+    // Gets the post processed image, which then gets scaled to the window.
+    // With POST_TO_WINDOW it only exists when demo_bind_output needs it.
+    fbo_t output_fb;
+    // Low resolution single channel FBO for the raymarch depth pre-pass
+    fbo_t depth_fb;
+    // G-buffer with two targets: hit distance, and normal with material ID
+    fbo_t gbuffer;
+    // Low resolution FBO for the shadow pass
+    fbo_t shadow_fb;
+    // The lighting pass's partial output when CHECKERBOARD is enabled
+    fbo_t sparse_fb;
+    // One pixel per SHADING_TILE_SIZE^2 screen tile, holding the tile's
+    // class for the lighting pass (see classify.frag)
+    fbo_t tiles_fb;
+    // The compute bloom's images, at the same size as quarter_fbs. GL ES
+    // can't store images as packed floats, so they are RGBA16F. Only created
+    // when there are compute shaders.
+    fbo_t bloom_fbs[2];
+    // The compute post pass's image when its output is the window, which
+    // compute shaders can't write to (see compute_target)
+    fbo_t composite_fb;
+    // 1x1 FBs with the same formats as the scene passes' targets, for
+    // drawing with upcoming scenes' programs (see prewarm_step)
+    fbo_t warm_fbs[SCENE_PASSES];
+    // Average of the jittered samples of a paused frame, ping-ponged. Only
+    // created when demo_skip_frame asks for refinement.
+    fbo_t accum_fbs[2];
     // This integer is the index ([] number) of the FB which holds current
     // frame's "main" target FBO. 0 or 1. This FB gets the base rendered image
     // before any post processing etc, and the other (0 or 1) holds the previous
     // frame's first pass result for feedback effects.
     size_t firstpass_fb_idx;
+    // Count of rendered frames, rotates the checkerboard pattern
+    int frame;
+    // Checkerboard period given to shaders, CHECKERBOARD or 1 for tiles
+    int checkerboard;
+    // The rendered area's center and size in the whole image (-1..1), which
+    // is all of it except when rendering tiles
+    GLfloat tile_rect[4];
+    // Previous frame's rocket row for p_ -prefixed uniforms (reprojection)
+    double prev_rocket_row;
+    // Changes when the shaders or render targets change, see demo_skip_frame
+    unsigned generation;
+    // Hash of everything which the previous frame depended on
+    uint64_t state_hash;
+    // When refine is set, the next frame gets averaged into accum_fbs as
+    // sample number `samples`, moved by `jitter` (in -1..1 image coordinates)
+    int refine;
+    int samples;
+    GLfloat jitter[2];
+    // Measures GPU time of render passes, NULL in release builds
+    gpu_timer_t *timer;
+    // Baked sync tracks (release builds only, when data/sync.tracks exists)
+    // and their values at this frame's row [0] and the previous row [1]
+    sync_tracks_t *tracks;
+    float *track_values[2];
+    // Startup work running on other threads between demo_init and
+    // demo_init_gl (see task.c)
+    task_t *shader_tasks[PASSES];
+    task_t *terrain_task;
+    task_t *spectrum_task;
+    int spectrum_rows;
+    task_t *mesh_task;
+    float *mesh_sdf;
+    task_t *tracks_task;
+    int width, height;
 } demo_t;
 
+// This table lists the shader programs which every scene shares: which
+// demo_t field the program goes to, and the fragment shader file and define
+// it is compiled from.
+typedef struct {
+    size_t program_offset;
+    const char *filename;
+    shader_define_t define;
+} pass_shader_t;
+
+static const pass_shader_t pass_shaders[PASSES] = {
+    {offsetof(demo_t, resolve_program), "shaders/resolve.frag", {0}},
+    {offsetof(demo_t, post_program), "shaders/post.frag", {0}},
+    {offsetof(demo_t, bloom_pre_program), "shaders/bloom_pre.frag", {0}},
+    // Setting #define HORIZONTAL 1 makes blur.frag blur along the X axis
+    {offsetof(demo_t, bloom_x_program), "shaders/blur.frag",
+     {.name = "HORIZONTAL", .value = "1"}},
+    {offsetof(demo_t, bloom_y_program), "shaders/blur.frag", {0}},
+    {offsetof(demo_t, accumulate_program), "shaders/accumulate.frag", {0}},
+    {offsetof(demo_t, classify_program), "shaders/classify.frag", {0}},
+};
+
+static program_t *pass_program(demo_t *demo, const pass_shader_t *pass) {
+    return (program_t *)((char *)demo + pass->program_offset);
+}
+
+// This table lists the compute shader programs which replace the bloom and
+// post passes when the context has compute shaders. HORIZONTAL makes
+// bloom.comp separate the bright parts and blur them along the X axis.
+static const pass_shader_t compute_shaders[COMPUTE_PASSES] = {
+    {offsetof(demo_t, bloom_x_compute_program), "shaders/bloom.comp",
+     {.name = "HORIZONTAL", .value = "1"}},
+    {offsetof(demo_t, bloom_y_compute_program), "shaders/bloom.comp", {0}},
+    {offsetof(demo_t, post_compute_program), "shaders/post.comp", {0}},
+};
+
+// This table lists the scenes in the order of the rocket track Scene's
+// values. Every scene is a shader file and a define, which get compiled once
+// for each pass which traces the scene. Scenes can share a file, and tell
+// each other apart by the define.
+typedef struct {
+    const char *filename;
+    shader_define_t define;
+} scene_shader_t;
+
+static const scene_shader_t scene_shaders[SCENES] = {
+    {"shaders/shader.frag", {0}},
+    // The open sea, without the buoy
+    {"shaders/shader.frag", {.name = "NO_BUOY", .value = "1"}},
+};
+
+// A define selects the pass from the scene's shader
+static const shader_define_t scene_pass_defines[SCENE_PASSES] = {
+    [SCENE_PREPASS] = {.name = "PREPASS", .value = "1"},
+    [SCENE_GEOMETRY] = {.name = "GEOMETRY_PASS", .value = "1"},
+    [SCENE_SHADOW] = {.name = "SHADOW_PASS", .value = "1"},
+    [SCENE_LIGHTING_SKY] = {.name = "TILE_CLASS", .value = "TILE_SKY"},
+    [SCENE_LIGHTING_WATER] = {.name = "TILE_CLASS", .value = "TILE_WATER"},
+    [SCENE_LIGHTING_SOLID] = {.name = "TILE_CLASS", .value = "TILE_SOLID"},
+    [SCENE_LIGHTING_MIXED] = {.name = "TILE_CLASS", .value = "TILE_MIXED"},
+};
+
+// Scope names of the scene passes in traces (see trace.h)
+static const char *const scene_pass_names[SCENE_PASSES] = {
+    [SCENE_PREPASS] = "prepass",
+    [SCENE_GEOMETRY] = "geometry",
+    [SCENE_SHADOW] = "shadow",
+    [SCENE_LIGHTING_SKY] = "lighting_sky",
+    [SCENE_LIGHTING_WATER] = "lighting_water",
+    [SCENE_LIGHTING_SOLID] = "lighting_solid",
+    [SCENE_LIGHTING_MIXED] = "lighting_mixed",
+};
+
+// Fills in a scene pass's shader file and defines from the tables above
+static scene_job_t scene_job(size_t scene, size_t pass) {
+    scene_job_t job = {.filename = scene_shaders[scene].filename};
+    if (scene_shaders[scene].define.name) {
+        job.defines[job.n_defs++] = scene_shaders[scene].define;
+    }
+    if (scene_pass_defines[pass].name) {
+        job.defines[job.n_defs++] = scene_pass_defines[pass];
+    }
+    // Jobs start before the meshes are baked, so this goes by config.h, and
+    // sdTexture still returns early when the SDF didn't get made
+    if (MESH_SDF_SIZE > 0) {
+        job.defines[job.n_defs++] =
+            (shader_define_t){.name = "MESH_SDF", .value = "1"};
+    }
+    return job;
+}
+
+// The vertex shader which a scene pass's program gets linked with
+static GLuint scene_vertex_shader(const demo_t *demo, size_t pass) {
+    return pass >= SCENE_LIGHTING_SKY ? demo->tile_vertex_shader
+                                      : demo->vertex_shader;
+}
+
 // Framebuffers/FBs/FBOs are sort of like "invisible images" that you can draw
 // to, instead of drawing directly to the window. This lets us draw stuff but
 // then process the image further in a new pass, by sampling its texture.
-// This function creates FBs with a desired resolution and texture sampling
-// filter.
-static fbo_t create_framebuffer(GLsizei width, GLsizei height, GLint filter) {
+// This function creates FBs with a desired resolution, texture sampling
+// filter and internal texture formats (such as GL_RGBA16F). Each format in
+// `formats` adds a texture to the FB as a separate render target, so that
+// shaders can output to them with layout(location = N).
+static fbo_t create_framebuffer(GLsizei width, GLsizei height, GLint filter,
+                                const GLenum *formats, size_t count) {
     fbo_t fbo = {0};
+    GLenum draw_buffers[MAX_ATTACHMENTS];
+    assert(count <= MAX_ATTACHMENTS);
 
     glGenFramebuffers(1, &fbo.framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, fbo.framebuffer);
-    glActiveTexture(GL_TEXTURE0);
-    glGenTextures(1, &fbo.texture);
-    glBindTexture(GL_TEXTURE_2D, fbo.texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
-                 GL_HALF_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           fbo.texture, 0);
+    glGenTextures(count, fbo.textures);
+
+    for (size_t i = 0; i < count; i++) {
+        // glTexImage2D wants a pixel format and type even when we don't
+        // upload any data, and they have to be compatible with the internal
+        // format.
+        GLenum format = GL_RGBA, type = GL_HALF_FLOAT;
+        size_t pixel_bytes = 8;
+        if (formats[i] == GL_R32F) {
+            format = GL_RED;
+            type = GL_FLOAT;
+            pixel_bytes = 4;
+        } else if (formats[i] == GL_RGBA8) {
+            type = GL_UNSIGNED_BYTE;
+            pixel_bytes = 4;
+        } else if (formats[i] == GL_R11F_G11F_B10F) {
+            format = GL_RGB;
+            pixel_bytes = 4;
+        }
+        fbo.bytes += pixel_bytes * width * height;
+
+        gl_bind_texture(0, fbo.textures[i]);
+#ifdef GLES
+        // GL ES only lets compute shaders store to immutable textures, which
+        // take no pixel format and type
+        glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], width, height);
+        (void)format;
+        (void)type;
+#else
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, format,
+                     type, NULL);
+#endif
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                               GL_TEXTURE_2D, fbo.textures[i], 0);
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+    glDrawBuffers(count, draw_buffers);
+
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         SDL_Log("FBO not complete\n");
         return (fbo_t){0};
@@ -96,6 +414,26 @@ static fbo_t create_framebuffer(GLsizei width, GLsizei height, GLint filter) {
     return fbo;
 }
 
+// Adds a depth buffer to a FB, so that meshes can be depth tested against
+// the raymarched surfaces. Returns 1 when successful, 0 when unsuccessful.
+static int attach_depth(fbo_t *fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo->framebuffer);
+    glGenRenderbuffers(1, &fbo->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, fbo->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, fbo->width,
+                          fbo->height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, fbo->depth);
+    // 24-bit depth is stored in 32 bits
+    fbo->bytes += 4 * fbo->width * fbo->height;
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        SDL_Log("FBO with depth not complete\n");
+        return 0;
+    }
+    return 1;
+}
+
 // This function replaces *old with new, but only if new has a non-zero
 // handle (meaning, it compiled and linked successfully).
 // Return value is 1 if new program is fine to use, 0 otherwise.
@@ -114,83 +452,247 @@ static int replace_program(program_t *old, program_t new) {
     return 1;
 }
 
-// This function drives all shader loading. Gets called on initialization,
-// and also from event handler (main.c) if R is pressed.
-void demo_reload(demo_t *demo) {
-    // First, assume programs are ok.
-    demo->programs_ok = 1;
+// This function compiles a fragment shader file, links it with a vertex
+// shader and replaces *program with the result (see replace_program).
+// Return value is 1 if new program is fine to use, 0 otherwise.
+static int load_program(program_t *program, GLuint vertex_shader,
+                        const char *filename, const shader_define_t *defines,
+                        size_t n_defs) {
+    GLuint fragment_shader = compile_shader_file(filename, defines, n_defs);
+
+    int ok = replace_program(
+        program, link_program((GLuint[]){vertex_shader, fragment_shader}, 2));
+
+    // Cleanup shader object because it has already been linked to a program
+    shader_deinit(fragment_shader);
+
+    return ok;
+}
+
+// Compiles mesh.vert and mesh.frag, and replaces the mesh program with the
+// result (see replace_program).
+// Return value is 1 if new program is fine to use, 0 otherwise.
+static int load_mesh_program(demo_t *demo) {
+    GLuint shaders[] = {compile_shader_file("shaders/mesh.vert", NULL, 0),
+                        compile_shader_file("shaders/mesh.frag", NULL, 0)};
+
+    int ok = replace_program(&demo->mesh_program, link_program(shaders, 2));
+
+    // Cleanup shader objects because they have already been linked
+    shader_deinit(shaders[0]);
+    shader_deinit(shaders[1]);
+
+    return ok;
+}
+
+// Compiles the compute_shaders table's shaders, and replaces their programs
+// with the results (see replace_program). They are few and small, so they
+// don't get preprocessed on other threads at startup.
+// Return value is 1 if the new programs are fine to use, 0 otherwise.
+static int load_compute_programs(demo_t *demo) {
+    int ok = 1;
+    for (size_t i = 0; i < COMPUTE_PASSES; i++) {
+        const pass_shader_t *pass = compute_shaders + i;
+        GLuint shader = compile_shader_file(pass->filename, &pass->define,
+                                            pass->define.name ? 1 : 0);
+        ok &= replace_program(pass_program(demo, pass),
+                              link_program(&shader, 1));
+        shader_deinit(shader);
+    }
+    return ok;
+}
+
+// Stops prewarming a scene (see prewarm_step): waits for its preprocessing
+// tasks and deletes the programs which the driver is still linking
+static void cancel_prewarm(scene_t *scene) {
+    for (size_t i = 0; i < SCENE_PASSES; i++) {
+        free(task_wait(scene->tasks[i]));
+        scene->tasks[i] = NULL;
+        if (scene->pending[i]) {
+            glDeleteProgram(scene->pending[i]);
+            scene->pending[i] = 0;
+        }
+    }
+}
 
-    GLuint vertex_shader = compile_shader(
+// This function reloads all shaders from files. Gets called from event
+// handler (main.c) if R is pressed. At startup, demo_init_gl loads them
+// instead, from sources which were preprocessed on other threads.
+// Every scene gets loaded right away, there's no prewarming.
+void demo_reload(demo_t *demo) {
+    TRACE_BEGIN("demo_reload");
+    for (size_t i = 0; i < SCENES; i++) {
+        cancel_prewarm(demo->scenes + i);
+    }
+    shader_deinit(demo->vertex_shader);
+    demo->vertex_shader = compile_shader(
         vertex_shader_src, strlen(vertex_shader_src), "vert", NULL, 0);
-    GLuint fragment_shader =
-        compile_shader_file("shaders/shader.frag", NULL, 0);
+    shader_deinit(demo->tile_vertex_shader);
+    demo->tile_vertex_shader =
+        compile_shader_file("shaders/shading_tile.vert", NULL, 0);
 
-    // If replace_program returns 0, programs_ok get set to 0 regardless of it's
+    // If load_program returns 0, programs_ok get set to 0 regardless of it's
     // current value.
-    demo->programs_ok &= replace_program(
-        &demo->effect_program,
-        link_program((GLuint[]){vertex_shader, fragment_shader}, 2));
+    demo->programs_ok = 1;
 
-    GLuint post_shader = compile_shader_file("shaders/post.frag", NULL, 0);
+    for (size_t i = 0; i < PASSES; i++) {
+        const pass_shader_t *pass = pass_shaders + i;
+        size_t n_defs = pass->define.name ? 1 : 0;
+        demo->programs_ok &=
+            load_program(pass_program(demo, pass), demo->vertex_shader,
+                         pass->filename, &pass->define, n_defs);
+    }
+    for (size_t i = 0; i < SCENES; i++) {
+        scene_t *scene = demo->scenes + i;
+        for (size_t j = 0; j < SCENE_PASSES; j++) {
+            const scene_job_t *job = scene->jobs + j;
+            demo->programs_ok &= load_program(
+                scene->programs + j, scene_vertex_shader(demo, j),
+                job->filename, job->defines, job->n_defs);
+        }
+        scene->step = PREWARM_STEPS;
+    }
+    if (demo->mesh) {
+        demo->programs_ok &= load_mesh_program(demo);
+    }
+    if (demo->compute) {
+        demo->programs_ok &= load_compute_programs(demo);
+    }
 
-    // If replace_program returns 0, programs_ok get set to 0 regardless of it's
-    // current value.
-    demo->programs_ok &=
-        replace_program(&demo->post_program, link_program(
-                                                 (GLuint[]){
-                                                     vertex_shader,
-                                                     post_shader,
-                                                 },
-                                                 2));
-
-    GLuint bloom_pre_shader =
-        compile_shader_file("shaders/bloom_pre.frag", NULL, 0);
-
-    // If replace_program returns 0, programs_ok get set to 0 regardless of it's
-    // current value.
-    demo->programs_ok &=
-        replace_program(&demo->bloom_pre_program, link_program(
-                                                      (GLuint[]){
-                                                          vertex_shader,
-                                                          bloom_pre_shader,
-                                                      },
-                                                      2));
-
-    GLuint bloom_x_shader =
-        compile_shader_file("shaders/blur.frag",
-                            (shader_define_t[]){(shader_define_t){
-                                .name = "HORIZONTAL", .value = "1"}},
-                            1);
-
-    // If replace_program returns 0, programs_ok get set to 0 regardless of it's
-    // current value.
-    demo->programs_ok &=
-        replace_program(&demo->bloom_x_program, link_program(
-                                                    (GLuint[]){
-                                                        vertex_shader,
-                                                        bloom_x_shader,
-                                                    },
-                                                    2));
+    demo->generation++;
+    TRACE_END();
+}
 
-    GLuint bloom_y_shader = compile_shader_file("shaders/blur.frag", NULL, 0);
+// Reads and preprocesses one pass's fragment shader on a task thread
+static void *preprocess_pass(void *userdata) {
+    const pass_shader_t *pass = (const pass_shader_t *)userdata;
+    return preprocess_shader_file(pass->filename, &pass->define,
+                                  pass->define.name ? 1 : 0);
+}
 
-    // If replace_program returns 0, programs_ok get set to 0 regardless of it's
-    // current value.
-    demo->programs_ok &=
-        replace_program(&demo->bloom_y_program, link_program(
-                                                    (GLuint[]){
-                                                        vertex_shader,
-                                                        bloom_y_shader,
-                                                    },
-                                                    2));
-
-    // Cleanup shader objects because they have already been linked to programs
-    shader_deinit(vertex_shader);
-    shader_deinit(fragment_shader);
-    shader_deinit(post_shader);
-    shader_deinit(bloom_pre_shader);
-    shader_deinit(bloom_x_shader);
-    shader_deinit(bloom_y_shader);
+// Reads and preprocesses one scene pass's fragment shader on a task thread
+static void *preprocess_scene_pass(void *userdata) {
+    const scene_job_t *job = (const scene_job_t *)userdata;
+    return preprocess_shader_file(job->filename, job->defines, job->n_defs);
+}
+
+// Bakes the mountain heights on all CPU cores, on a task thread
+static void *bake_terrain(void *userdata) {
+    thread_pool_t *pool = thread_pool_init(0);
+    float *terrain = terrain_bake(pool, TERRAIN_SIZE);
+    thread_pool_deinit(pool);
+    return terrain;
+}
+
+// Bakes the music's spectrogram on all CPU cores, on a task thread
+static void *bake_spectrum(void *userdata) {
+    int *rows = (int *)userdata;
+    thread_pool_t *pool = thread_pool_init(0);
+    unsigned char *spectrum = spectrum_bake(pool, "data/music.ogg",
+                                            SPECTRUM_BINS, SPECTRUM_RATE, rows);
+    thread_pool_deinit(pool);
+    return spectrum;
+}
+
+// Loads and optimises the meshes, on a task thread. With MESH_SDF_SIZE, bakes
+// them into demo->mesh_sdf on all CPU cores instead.
+static void *load_meshes(void *userdata) {
+    demo_t *demo = (demo_t *)userdata;
+    mesh_t *mesh = mesh_load(MESH_FILE);
+    if (mesh && MESH_SDF_SIZE > 0) {
+        size_t count = 0;
+        float *triangles = mesh_triangles(mesh, &count);
+        if (triangles) {
+            thread_pool_t *pool = thread_pool_init(0);
+            demo->mesh_sdf =
+                mesh_sdf_bake(pool, triangles, count, MESH_SDF_SIZE,
+                              demo->sdf_bounds, MESH_SDF_CACHE);
+            thread_pool_deinit(pool);
+        }
+        free(triangles);
+        mesh_deinit(mesh);
+        mesh = NULL;
+    }
+    return mesh;
+}
+
+#ifdef SYNC_PLAYER
+static void *load_tracks(void *userdata) {
+    return sync_tracks_load((const char *)userdata);
+}
+#endif
+
+// Compiles the fragment shaders of the shared passes and then the first
+// scene's passes to fragment_shaders, each as soon as its preprocessing task
+// finishes. Failed shaders are 0. The other scenes get prewarmed later.
+static void compile_pass_shaders(demo_t *demo, GLuint *fragment_shaders) {
+    const size_t count = PASSES + SCENE_PASSES;
+    task_t **tasks[PASSES + SCENE_PASSES];
+    const char *filenames[PASSES + SCENE_PASSES];
+    for (size_t i = 0; i < PASSES; i++) {
+        tasks[i] = demo->shader_tasks + i;
+        filenames[i] = pass_shaders[i].filename;
+    }
+    for (size_t i = 0; i < SCENE_PASSES; i++) {
+        tasks[PASSES + i] = demo->scenes[0].tasks + i;
+        filenames[PASSES + i] = demo->scenes[0].jobs[i].filename;
+    }
+
+    // Submit the shaders to the driver in the order their sources become
+    // ready. When none is ready, wait for the first remaining one.
+    for (size_t compiled = 0; compiled < count;) {
+        size_t next = count;
+        for (size_t i = 0; i < count && next == count; i++) {
+            if (*tasks[i] && task_done(*tasks[i])) {
+                next = i;
+            }
+        }
+        for (size_t i = 0; i < count && next == count; i++) {
+            if (*tasks[i]) {
+                next = i;
+            }
+        }
+        // The rest of the tasks failed to start (see task_start), so their
+        // shaders stay 0 and link_pass_programs fails them
+        if (next == count) {
+            break;
+        }
+
+        char *src = task_wait(*tasks[next]);
+        *tasks[next] = NULL;
+        if (src) {
+            fragment_shaders[next] = compile_preprocessed_shader(
+                src, shader_file_type(filenames[next]));
+            free(src);
+        }
+        if (!fragment_shaders[next]) {
+            SDL_Log("File: %s\n", filenames[next]);
+        }
+        compiled++;
+    }
+}
+
+// Links every shared pass's program and the first scene's programs from the
+// shaders which compile_pass_shaders compiled, and deletes the shaders.
+// Returns 1 if all programs are fine to use, 0 otherwise.
+static int link_pass_programs(demo_t *demo, GLuint *fragment_shaders) {
+    demo->programs_ok = 1;
+    for (size_t i = 0; i < PASSES + SCENE_PASSES; i++) {
+        program_t *program = i < PASSES
+                                 ? pass_program(demo, pass_shaders + i)
+                                 : demo->scenes[0].programs + i - PASSES;
+        GLuint vertex_shader = i < PASSES
+                                   ? demo->vertex_shader
+                                   : scene_vertex_shader(demo, i - PASSES);
+        demo->programs_ok &= replace_program(
+            program,
+            link_program((GLuint[]){vertex_shader, fragment_shaders[i]}, 2));
+        shader_deinit(fragment_shaders[i]);
+    }
+    // The first scene gets drawn right away, so it isn't prewarmed
+    demo->scenes[0].step = PREWARM_STEPS;
+
+    return demo->programs_ok;
 }
 
 // This ugly function computes rectangle coordinates for scaling/letterboxing
@@ -211,52 +713,404 @@ void demo_resize(demo_t *demo, int width, int height) {
         demo->y0 = remainder;
         demo->y1 = remainder + adjusted;
     }
+    demo->generation++;
+}
+
+// Creates the FB which gets the post processed image. It's clamped to 0..1,
+// so 8 bits per channel are enough. This also lets exporter.c read it back
+// as bytes, which GL ES only allows from 8-bit targets.
+// Returns 1 when successful, 0 when unsuccessful.
+static int create_output(demo_t *demo) {
+    // Same size as the other full resolution FBs
+    demo->output_fb =
+        create_framebuffer(demo->fbs[0].width, demo->fbs[0].height, GL_LINEAR,
+                           (GLenum[]){GL_RGBA8}, 1);
+    return demo->output_fb.framebuffer != 0;
+}
+
+// Creates the FBs which render passes draw to, at a resolution of width *
+// height. Returns 1 when successful, 0 when unsuccessful.
+static int create_targets(demo_t *demo, int width, int height) {
+    // Each target gets the smallest format that holds what gets read from
+    // it. HDR colors without alpha use packed floats, which take half the
+    // memory and bandwidth of RGBA16F.
+    for (size_t i = 0; i < FBS; i++) {
+        demo->fbs[i] = create_framebuffer(width, height, GL_LINEAR,
+                                          (GLenum[]){GL_R11F_G11F_B10F}, 1);
+        if (demo->fbs[i].framebuffer == 0) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < QUARTER_FBS; i++) {
+        demo->quarter_fbs[i] =
+            create_framebuffer(width / 2, height / 2, GL_LINEAR,
+                               (GLenum[]){GL_R11F_G11F_B10F}, 1);
+        if (demo->quarter_fbs[i].framebuffer == 0) {
+            return 0;
+        }
+    }
+    if (!POST_TO_WINDOW && !create_output(demo)) {
+        return 0;
+    }
+    // Depths are not interpolated (GL_NEAREST), passes which read them use
+    // the exact texel that covers each pixel.
+    demo->depth_fb =
+        create_framebuffer(width / PREPASS_DIVISOR, height / PREPASS_DIVISOR,
+                           GL_NEAREST, (GLenum[]){GL_R32F}, 1);
+    if (demo->depth_fb.framebuffer == 0) {
+        return 0;
+    }
+    // Hit distances need full float precision to reconstruct positions, and
+    // the normal's alpha holds the material ID. Meshes also need depth.
+    demo->gbuffer = create_framebuffer(width, height, GL_NEAREST,
+                                       (GLenum[]){GL_R32F, GL_RGBA16F}, 2);
+    if (demo->gbuffer.framebuffer == 0 ||
+        (demo->mesh && !attach_depth(&demo->gbuffer))) {
+        return 0;
+    }
+    // Shadows use three channels, but RGB16F isn't guaranteed to be
+    // renderable
+    demo->shadow_fb =
+        create_framebuffer(width / SHADOW_DIVISOR, height / SHADOW_DIVISOR,
+                           GL_NEAREST, (GLenum[]){GL_RGBA16F}, 1);
+    if (demo->shadow_fb.framebuffer == 0) {
+        return 0;
+    }
+    // The resolve pass reads hit distances from alpha
+    if (CHECKERBOARD > 1) {
+        demo->sparse_fb = create_framebuffer(width, height, GL_NEAREST,
+                                             (GLenum[]){GL_RGBA16F}, 1);
+        if (demo->sparse_fb.framebuffer == 0) {
+            return 0;
+        }
+    }
+    // Tile classes are small integers, stored as floats like the other
+    // single channel targets
+    demo->tiles_fb = create_framebuffer(
+        (width + SHADING_TILE_SIZE - 1) / SHADING_TILE_SIZE,
+        (height + SHADING_TILE_SIZE - 1) / SHADING_TILE_SIZE, GL_NEAREST,
+        (GLenum[]){GL_R32F}, 1);
+    if (demo->tiles_fb.framebuffer == 0) {
+        return 0;
+    }
+    // Drivers may specialise programs for their targets' formats, so
+    // prewarming draws to targets with the same formats as above
+    demo->warm_fbs[SCENE_PREPASS] =
+        create_framebuffer(1, 1, GL_NEAREST, (GLenum[]){GL_R32F}, 1);
+    demo->warm_fbs[SCENE_GEOMETRY] = create_framebuffer(
+        1, 1, GL_NEAREST, (GLenum[]){GL_R32F, GL_RGBA16F}, 2);
+    demo->warm_fbs[SCENE_SHADOW] =
+        create_framebuffer(1, 1, GL_NEAREST, (GLenum[]){GL_RGBA16F}, 1);
+    for (size_t i = SCENE_LIGHTING_SKY; i <= SCENE_LIGHTING_MIXED; i++) {
+        demo->warm_fbs[i] = create_framebuffer(
+            1, 1, GL_NEAREST,
+            (GLenum[]){CHECKERBOARD > 1 ? GL_RGBA16F : GL_R11F_G11F_B10F}, 1);
+    }
+    for (size_t i = 0; i < SCENE_PASSES; i++) {
+        if (demo->warm_fbs[i].framebuffer == 0) {
+            return 0;
+        }
+    }
+    if (demo->mesh && !attach_depth(&demo->warm_fbs[SCENE_GEOMETRY])) {
+        return 0;
+    }
+    for (size_t i = 0; i < 2 && demo->compute; i++) {
+        demo->bloom_fbs[i] = create_framebuffer(
+            width / 2, height / 2, GL_LINEAR, (GLenum[]){GL_RGBA16F}, 1);
+        if (demo->bloom_fbs[i].framebuffer == 0) {
+            return 0;
+        }
+    }
+
+    const fbo_t *all_fbs[] = {&demo->fbs[0],          &demo->fbs[1],
+                              &demo->quarter_fbs[0],  &demo->quarter_fbs[1],
+                              &demo->output_fb,       &demo->depth_fb,
+                              &demo->gbuffer,         &demo->shadow_fb,
+                              &demo->sparse_fb,       &demo->tiles_fb,
+                              &demo->bloom_fbs[0],    &demo->bloom_fbs[1]};
+    size_t fb_bytes = 0;
+    for (size_t i = 0; i < sizeof(all_fbs) / sizeof(*all_fbs); i++) {
+        fb_bytes += all_fbs[i]->bytes;
+    }
+    SDL_Log("Framebuffers use %.1f MiB\n", fb_bytes / (1024. * 1024.));
+
+    demo->generation++;
+    return 1;
+}
+
+// Creates the FBs for refining a paused frame, unless they exist already.
+// Averaging many samples needs more precision than the packed floats have.
+// Returns 1 when successful, 0 when unsuccessful.
+static int create_accumulation(demo_t *demo) {
+    for (size_t i = 0; i < 2; i++) {
+        if (demo->accum_fbs[i].framebuffer == 0) {
+            demo->accum_fbs[i] = create_framebuffer(
+                demo->fbs[0].width, demo->fbs[0].height, GL_LINEAR,
+                (GLenum[]){GL_RGBA16F}, 1);
+            if (demo->accum_fbs[i].framebuffer == 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Deletes a FB with its textures and depth buffer
+static void delete_framebuffer(fbo_t *fbo) {
+    glDeleteFramebuffers(1, &fbo->framebuffer);
+    glDeleteTextures(MAX_ATTACHMENTS, fbo->textures);
+    glDeleteRenderbuffers(1, &fbo->depth);
+    *fbo = (fbo_t){0};
+}
+
+// Deletes the FBs made by create_targets (and create_output)
+static void delete_targets(demo_t *demo) {
+    fbo_t *all_fbs[] = {&demo->fbs[0],         &demo->fbs[1],
+                        &demo->quarter_fbs[0], &demo->quarter_fbs[1],
+                        &demo->output_fb,      &demo->depth_fb,
+                        &demo->gbuffer,        &demo->shadow_fb,
+                        &demo->sparse_fb,      &demo->tiles_fb,
+                        &demo->bloom_fbs[0],   &demo->bloom_fbs[1],
+                        &demo->composite_fb,   &demo->accum_fbs[0],
+                        &demo->accum_fbs[1]};
+    for (size_t i = 0; i < sizeof(all_fbs) / sizeof(*all_fbs); i++) {
+        delete_framebuffer(all_fbs[i]);
+    }
+    for (size_t i = 0; i < SCENE_PASSES; i++) {
+        delete_framebuffer(demo->warm_fbs + i);
+    }
+    // New textures may get the deleted ones' names
+    gl_state_invalidate();
 }
 
 // "demo_t's constructor" (if this were C++...)
+// This only starts loading the demo's data on other threads, and makes no
+// OpenGL calls, so that it can be called before the OpenGL context exists.
+// demo_init_gl finishes the initialization.
 demo_t *demo_init(int width, int height) {
     demo_t *demo = calloc(1, sizeof(demo_t));
     if (!demo) {
         return NULL;
     }
 
+    demo->width = width;
+    demo->height = height;
+    demo->checkerboard = CHECKERBOARD;
+    demo->tile_rect[2] = demo->tile_rect[3] = 1.f;
     demo->aspect_ratio = (double)width / (double)height;
     demo_resize(demo, width, height);
 
+    // Reading and preprocessing the shaders
+    for (size_t i = 0; i < PASSES; i++) {
+        const pass_shader_t *pass = pass_shaders + i;
+        // Passes from the same file are told apart by their define
+        const char *name =
+            pass->define.name ? pass->define.name : pass->filename;
+        demo->shader_tasks[i] =
+            task_start(name, preprocess_pass, (void *)pass);
+    }
+    for (size_t i = 0; i < SCENES; i++) {
+        scene_t *scene = demo->scenes + i;
+        for (size_t j = 0; j < SCENE_PASSES; j++) {
+            scene->jobs[j] = scene_job(i, j);
+            scene->tasks[j] = task_start(scene->jobs[j].filename,
+                                         preprocess_scene_pass,
+                                         scene->jobs + j);
+        }
+    }
+
+    // Baking the terrain, which uses all CPU cores by itself
+    demo->terrain_task = task_start("terrain", bake_terrain, NULL);
+
+    // Analysing the music, which decodes all of it
+    demo->spectrum_task =
+        task_start("spectrum", bake_spectrum, &demo->spectrum_rows);
+
+    // Loading the meshes, and optimising them for the GPU
+    demo->mesh_task = task_start("meshes", load_meshes, demo);
+
+    // Decoding the images, which get uploaded while the demo runs
+    demo->textures = textures_init(texture_files, TEXTURES, TEXTURE_BUDGET);
+
+#ifdef SYNC_PLAYER
+    // Loading baked sync tracks (scripts/bake_sync.py) when they exist
+    demo->tracks_task =
+        task_start("sync tracks", load_tracks, "data/sync.tracks");
+#endif
+
+    return demo;
+}
+
+// Returns 1 if the context has compute shaders, which are core in GL ES 3.1
+// and OpenGL 4.3. main.c asks for 4.3 but falls back to 3.3.
+static int compute_supported(void) {
+#ifdef GLES
+    return 1;
+#else
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 4 || (major == 4 && minor >= 3);
+#endif
+}
+
+// Creates the demo's OpenGL objects with the data which demo_init started
+// loading. The OpenGL context must exist. Returns 1 when successful, 0 when
+// unsuccessful.
+int demo_init_gl(demo_t *demo) {
+    const int width = demo->width, height = demo->height;
+
     // VAO is a must in GL 3.3 core. Don't think about it too much.
+    // Only the meshes have another one.
     glGenVertexArrays(1, &demo->vao);
-    glBindVertexArray(demo->vao);
+    gl_bind_vertex_array(demo->vao);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 
-    // Load shaders
-    demo_reload(demo);
+    // Submit shaders to the driver
+    demo->vertex_shader = compile_shader(
+        vertex_shader_src, strlen(vertex_shader_src), "vert", NULL, 0);
+    demo->tile_vertex_shader =
+        compile_shader_file("shaders/shading_tile.vert", NULL, 0);
+    GLuint fragment_shaders[PASSES + SCENE_PASSES] = {0};
+    compile_pass_shaders(demo, fragment_shaders);
+
+    // The G-buffer needs depth only when there are meshes, so they must be
+    // loaded before creating the FBs
+    demo->mesh = task_wait(demo->mesh_task);
+    demo->mesh_task = NULL;
+    if (demo->mesh &&
+        (!mesh_upload(demo->mesh) || !load_mesh_program(demo))) {
+        return 0;
+    }
+
+    // The bloom and post passes run as compute shaders when they can. Their
+    // images get created with the other FBs.
+    demo->compute = compute_supported();
+    demo->use_compute = demo->compute;
+    SDL_Log("Post processing uses %s shaders\n",
+            demo->compute ? "compute" : "fragment");
 
     // Create FBs
-    for (size_t i = 0; i < FBS; i++) {
-        demo->fbs[i] = create_framebuffer(width, height, GL_LINEAR);
-        if (demo->fbs[i].framebuffer == 0) {
-            return NULL;
-        }
-    }
-    for (size_t i = 0; i < QUARTER_FBS; i++) {
-        demo->quarter_fbs[i] =
-            create_framebuffer(width / 2, height / 2, GL_LINEAR);
-        if (demo->quarter_fbs[i].framebuffer == 0) {
-            return NULL;
-        }
+    if (!create_targets(demo, width, height)) {
+        return 0;
     }
 
     // Allocate noise texture
-    glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &demo->noise_texture);
-    glBindTexture(GL_TEXTURE_2D, demo->noise_texture);
+    gl_bind_texture(0, demo->noise_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, NOISE_SIZE, NOISE_SIZE, 0, GL_RGBA,
                  GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    return demo;
+    // Link shaders. Drivers may compile in the background, so creating the
+    // FBs before this gives them some time.
+    link_pass_programs(demo, fragment_shaders);
+    if (demo->compute) {
+        demo->programs_ok &= load_compute_programs(demo);
+    }
+
+    // Upload the baked terrain as a texture
+    float *terrain = task_wait(demo->terrain_task);
+    demo->terrain_task = NULL;
+    if (!terrain) {
+        return 0;
+    }
+
+    // GL ES doesn't guarantee linear filtering of 32-bit float textures
+#ifdef GLES
+    const GLint float_format = GL_R16F;
+#else
+    const GLint float_format = GL_R32F;
+#endif
+    glGenTextures(1, &demo->terrain_texture);
+    gl_bind_texture(0, demo->terrain_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, float_format, TERRAIN_SIZE, TERRAIN_SIZE,
+                 0, GL_RED, GL_FLOAT, terrain);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    free(terrain);
+
+    // Upload the meshes' baked SDF as a 3D texture
+    if (demo->mesh_sdf) {
+        glGenTextures(1, &demo->sdf_texture);
+        gl_bind_texture_3d(0, demo->sdf_texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, float_format, MESH_SDF_SIZE,
+                     MESH_SDF_SIZE, MESH_SDF_SIZE, 0, GL_RED, GL_FLOAT,
+                     demo->mesh_sdf);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        free(demo->mesh_sdf);
+        demo->mesh_sdf = NULL;
+    } else {
+        demo->sdf_bounds[3] = 0.f;
+    }
+
+    // Upload the music's spectrogram. Shaders still work without it, spectrum()
+    // is then 0.
+    unsigned char *spectrum = task_wait(demo->spectrum_task);
+    demo->spectrum_task = NULL;
+    if (spectrum) {
+        // Long music may not fit in one texture, halve the rows until it
+        // does. An odd last row stays as it is, and the rate is kept exact
+        // so that the halved rows stay in sync with the music.
+        GLint max_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        int rows = demo->spectrum_rows;
+        double rate = SPECTRUM_RATE;
+        while (rows > max_size) {
+            for (int i = 0; i < rows / 2; i++) {
+                for (int j = 0; j < SPECTRUM_BINS; j++) {
+                    unsigned char *a = spectrum + (i * 2) * SPECTRUM_BINS + j;
+                    spectrum[i * SPECTRUM_BINS + j] =
+                        (a[0] + a[SPECTRUM_BINS] + 1) / 2;
+                }
+            }
+            if (rows % 2) {
+                memcpy(spectrum + rows / 2 * SPECTRUM_BINS,
+                       spectrum + (rows - 1) * SPECTRUM_BINS, SPECTRUM_BINS);
+            }
+            rows = (rows + 1) / 2;
+            rate /= 2.;
+        }
+        demo->spectrum_rate = rate / ROW_RATE;
+
+        glGenTextures(1, &demo->spectrum_texture);
+        gl_bind_texture(0, demo->spectrum_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SPECTRUM_BINS, rows, 0, GL_RED,
+                     GL_UNSIGNED_BYTE, spectrum);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        free(spectrum);
+    }
+
+#ifdef DEBUG
+    demo->timer = gpu_timer_init();
+#endif
+
+#ifdef SYNC_PLAYER
+    demo->tracks = task_wait(demo->tracks_task);
+    demo->tracks_task = NULL;
+    if (demo->tracks) {
+        size_t count = sync_tracks_count(demo->tracks) + 1;
+        demo->track_values[0] = calloc(count, sizeof(float));
+        demo->track_values[1] = calloc(count, sizeof(float));
+        if (!demo->track_values[0] || !demo->track_values[1]) {
+            return 0;
+        }
+    } else {
+        SDL_Log("No baked sync tracks, using rocket track files\n");
+    }
+#endif
+
+    return 1;
 }
 
 // This function returns a corresponding rocket track name for an uniform.
@@ -288,18 +1142,40 @@ static const char *rocket_track_name(const uniform_t *ufm, char c) {
     return trackname;
 }
 
+// Gets the value of an uniform's component `c` (see rocket_track_name).
+// With baked tracks, the value comes from the values evaluated for this frame,
+// and the track index gets looked up only once per uniform component.
+// Otherwise rocket finds the track by name.
+static double get_value(const demo_t *demo, struct sync_device *rocket,
+                        uniform_t *ufm, char c, double row, int prev) {
+    if (demo->tracks) {
+        int *index = ufm->track_index + (c == 'w' ? 3 : (c ? c - 'x' : 0));
+        if (*index == 0) {
+            int found =
+                sync_tracks_find(demo->tracks, rocket_track_name(ufm, c));
+            *index = found < 0 ? -1 : found + 1;
+        }
+        // Like in rocket, a track which doesn't exist is 0
+        return *index > 0 ? demo->track_values[prev][*index - 1] : 0.;
+    }
+    return sync_get_val(sync_get_track(rocket, rocket_track_name(ufm, c)), row);
+}
+
 // I don't like C macros, but let's limit the use of this one to the following
 // function `set_rocket_uniforms`.
-#define GET_VALUE(track_name)                                                  \
-    sync_get_val(sync_get_track(rocket, track_name), rocket_row)
+#define GET_VALUE(c) get_value(demo, rocket, ufm, c, rocket_row, prev)
 
 // This iterates all uniforms in program, and calls the appropriate
 // rocket functions and glUniform functions to glue them together.
 // In addition to glUniform, it also supports block uniform buffers.
 // This is unnecessarily complex and might get reduced to support
 // only block uniforms in a later release.
-static void set_rocket_uniforms(const program_t *program,
-                                struct sync_device *rocket, double rocket_row) {
+// Uniforms prefixed with r_ get values at `row`, and uniforms prefixed with
+// p_ get values at `prev_row` (the same tracks, but one frame behind).
+static void set_rocket_uniforms(const demo_t *demo, const program_t *program,
+                                struct sync_device *rocket, double row,
+                                double prev_row) {
+    TRACE_BEGIN("set_rocket_uniforms");
     // Iterate every active uniform in program
     for (size_t i = 0; i < program->uniform_count; i++) {
         uniform_t *ufm = program->uniforms + i;
@@ -313,35 +1189,38 @@ static void set_rocket_uniforms(const program_t *program,
         // Number of elements (e.g. vec3 => 3)
         GLsizeiptr size = 0;
 
-        // Check for r_ -prefix
-        if (ufm->name_len < 3 || ufm->name[0] != 'r' || ufm->name[1] != '_') {
+        // Check for r_ or p_ -prefix
+        if (ufm->name_len < 3 || (ufm->name[0] != 'r' && ufm->name[0] != 'p') ||
+            ufm->name[1] != '_') {
             continue;
         }
+        int prev = ufm->name[0] == 'p';
+        double rocket_row = prev ? prev_row : row;
 
         // Fill the staging buffer and set tag and size
         switch (ufm->type) {
         case GL_FLOAT_VEC4:
-            staging.f[3] = GET_VALUE(rocket_track_name(ufm, 'w'));
+            staging.f[3] = GET_VALUE('w');
             size = 4;
             // fall through
         case GL_FLOAT_VEC3:
-            staging.f[2] = GET_VALUE(rocket_track_name(ufm, 'z'));
+            staging.f[2] = GET_VALUE('z');
             size = size ? size : 3;
             // fall through
         case GL_FLOAT_VEC2:
-            staging.f[1] = GET_VALUE(rocket_track_name(ufm, 'y'));
-            staging.f[0] = GET_VALUE(rocket_track_name(ufm, 'x'));
+            staging.f[1] = GET_VALUE('y');
+            staging.f[0] = GET_VALUE('x');
             size = size ? size : 2;
             tag = F;
             break;
         case GL_FLOAT:
-            staging.f[0] = GET_VALUE(rocket_track_name(ufm, 0));
+            staging.f[0] = GET_VALUE(0);
             size = 1;
             tag = F;
             break;
         case GL_INT:
         case GL_SAMPLER_2D:
-            staging.i = (GLint)GET_VALUE(rocket_track_name(ufm, 0));
+            staging.i = (GLint)GET_VALUE(0);
             size = 1;
             tag = I;
             break;
@@ -371,7 +1250,7 @@ static void set_rocket_uniforms(const program_t *program,
         } else {
             // Block uniform
             GLuint buffer = program->block_buffers[ufm->block_index];
-            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            gl_bind_uniform_buffer(buffer);
             if (tag == F) {
                 size *= sizeof(GLfloat);
             } else if (tag == I) {
@@ -380,136 +1259,861 @@ static void set_rocket_uniforms(const program_t *program,
                 SDL_Log("Oops, check" __FILE__ " line %d\n", __LINE__);
             }
             glBufferSubData(GL_UNIFORM_BUFFER, ufm->offset, size, &staging);
-            glBindBuffer(GL_UNIFORM_BUFFER, 0);
         }
     }
+    TRACE_END();
 }
 
-// This messy function is the most important one here. It uses a shader
-// program, rocket, input textures etc. to draw the shader to an output
-// (`draw_fb`).
-static void render_pass(const demo_t *demo, const fbo_t *draw_fb,
-                        const program_t *program, struct sync_device *rocket,
-                        double rocket_row, const GLuint *textures,
-                        const char **sampler_ufm_names, size_t n_textures) {
-
+// Prepares a draw to an output (`draw_fb`) with a shader program: sets its
+// uniforms from rocket and binds the input textures
+static void begin_pass(const demo_t *demo, const fbo_t *draw_fb,
+                       const program_t *program, struct sync_device *rocket,
+                       double rocket_row, const GLuint *textures,
+                       const char **sampler_ufm_names, size_t n_textures) {
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fb->framebuffer);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glViewport(0, 0, draw_fb->width, draw_fb->height);
-    glUseProgram(program->handle);
-    set_rocket_uniforms(program, rocket, rocket_row);
+    glViewport(draw_fb->x, draw_fb->y, draw_fb->width, draw_fb->height);
+    gl_use_program(program->handle);
+    set_rocket_uniforms(demo, program, rocket, rocket_row,
+                        demo->prev_rocket_row);
     glUniform1f(glGetUniformLocation(program->handle, "u_RocketRow"),
                 rocket_row);
+    glUniform1i(glGetUniformLocation(program->handle, "u_Frame"), demo->frame);
+    glUniform1i(glGetUniformLocation(program->handle, "u_Checkerboard"),
+                demo->checkerboard);
+    glUniform4fv(glGetUniformLocation(program->handle, "u_TileRect"), 1,
+                 demo->tile_rect);
+    glUniform2fv(glGetUniformLocation(program->handle, "u_Jitter"), 1,
+                 demo->jitter);
+    glUniform1i(glGetUniformLocation(program->handle, "u_Samples"),
+                demo->samples);
     glUniform2f(glGetUniformLocation(program->handle, "u_Resolution"),
                 draw_fb->width, draw_fb->height);
     glUniform1i(glGetUniformLocation(program->handle, "u_NoiseSize"),
                 NOISE_SIZE);
-    // Bind uniform blocks
+    glUniform1i(glGetUniformLocation(program->handle, "u_ShadingTileSize"),
+                SHADING_TILE_SIZE);
+    // Bind uniform blocks (block i uses binding point i, see link_program)
     for (size_t i = 0; i < program->block_count; i++) {
-        glUniformBlockBinding(program->handle, i, i);
-        glBindBufferBase(GL_UNIFORM_BUFFER, i, program->block_buffers[i]);
+        gl_bind_uniform_buffer_base(i, program->block_buffers[i]);
     }
 
     // Bind textures for upcoming draw operation
     for (size_t i = 0; i < n_textures; i++) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        gl_bind_texture(i, textures[i]);
         glUniform1i(glGetUniformLocation(program->handle, sampler_ufm_names[i]),
                     i);
     }
+    // Every pass can sample the music's spectrogram (see spectrum.glsl)
+    gl_bind_texture(n_textures, demo->spectrum_texture);
+    glUniform1i(glGetUniformLocation(program->handle, "u_SpectrumSampler"),
+                n_textures);
+    glUniform1f(glGetUniformLocation(program->handle, "u_SpectrumRate"),
+                demo->spectrum_rate);
+    // ...and the meshes' SDF (see sdTexture in sdf.glsl)
+    gl_bind_texture_3d(n_textures + 1, demo->sdf_texture);
+    glUniform1i(glGetUniformLocation(program->handle, "u_MeshSampler"),
+                n_textures + 1);
+    glUniform4fv(glGetUniformLocation(program->handle, "u_MeshBounds"), 1,
+                 demo->sdf_bounds);
+    // ...and the image textures, as u_Texture0, u_Texture1 and so on
+    for (size_t i = 0; texture_files[i]; i++) {
+        char name[UFM_NAME_MAX];
+        snprintf(name, sizeof(name), "u_Texture%zu", i);
+        gl_bind_texture(n_textures + 2 + i, textures_get(demo->textures, i));
+        glUniform1i(glGetUniformLocation(program->handle, name),
+                    n_textures + 2 + i);
+    }
+}
+
+// This messy function is the most important one here. It uses a shader
+// program, rocket, input textures etc. to draw the shader to an output
+// (`draw_fb`). The pass shows up in traces as `name`.
+static void render_pass(const demo_t *demo, const char *name,
+                        const fbo_t *draw_fb, const program_t *program,
+                        struct sync_device *rocket, double rocket_row,
+                        const GLuint *textures, const char **sampler_ufm_names,
+                        size_t n_textures) {
+    TRACE_BEGIN(name);
+    begin_pass(demo, draw_fb, program, rocket, rocket_row, textures,
+               sampler_ufm_names, n_textures);
+    glClear(draw_fb->depth ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT
+                           : GL_COLOR_BUFFER_BIT);
 
     // Draw a screen-filling quad with the shader!
-    glBindVertexArray(demo->vao);
+    gl_bind_vertex_array(demo->vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
+    TRACE_END();
 }
 
-// This gets called once per frame from main loop (main.c)
-void demo_render(demo_t *demo, struct sync_device *rocket, double rocket_row) {
-    static unsigned char noise[NOISE_SIZE * NOISE_SIZE * 4];
-    const size_t cur_fb_idx = demo->firstpass_fb_idx;
-    const size_t alt_fb_idx = cur_fb_idx ? 0 : 1;
+// Runs a compute shader program once for every `width` * `height` pixels of
+// an image (`image_fb`'s texture, which has `format`), in work groups of the
+// size that the shader declares. The program gets its uniforms and textures
+// like a render pass, also `name` in traces. The shader stores to the image
+// at binding 0.
+static void compute_pass(const demo_t *demo, const char *name,
+                         const fbo_t *image_fb, GLenum format,
+                         const program_t *program, struct sync_device *rocket,
+                         double rocket_row, GLuint width, GLuint height,
+                         const GLuint *textures,
+                         const char **sampler_ufm_names, size_t n_textures) {
+    TRACE_BEGIN(name);
+    begin_pass(demo, image_fb, program, rocket, rocket_row, textures,
+               sampler_ufm_names, n_textures);
+    glBindImageTexture(0, image_fb->textures[0], 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       format);
+
+    GLint group[3];
+    glGetProgramiv(program->handle, GL_COMPUTE_WORK_GROUP_SIZE, group);
+    glDispatchCompute((width + group[0] - 1) / group[0],
+                      (height + group[1] - 1) / group[1], 1);
+
+    // Make the stores visible to whatever reads the image next: a pass
+    // sampling it, a blit or glReadPixels (exporter.c)
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT |
+                    GL_PIXEL_BUFFER_BARRIER_BIT);
+    TRACE_END();
+}
 
-#ifdef DEBUG
-    // Early return if shaders are currently unusable
-    if (!demo->programs_ok) {
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-        glClearColor(0.3, 0., 0., 1.);
-        glClear(GL_COLOR_BUFFER_BIT);
-        return;
+// Returns the image which the compute post pass should store to for an
+// output (`post_fb`). Compute shaders can't write to the window, so for it,
+// this returns composite_fb (made with the output's size), which then gets
+// copied to the window. Returns NULL if composite_fb can't be created.
+static const fbo_t *compute_target(demo_t *demo, const fbo_t *post_fb) {
+    if (post_fb->framebuffer) {
+        return post_fb;
     }
-#endif
+    fbo_t *composite_fb = &demo->composite_fb;
+    if (composite_fb->width != post_fb->width ||
+        composite_fb->height != post_fb->height) {
+        delete_framebuffer(composite_fb);
+        *composite_fb = create_framebuffer(post_fb->width, post_fb->height,
+                                           GL_NEAREST, (GLenum[]){GL_RGBA8}, 1);
+    }
+    return composite_fb->framebuffer ? composite_fb : NULL;
+}
 
-    glClearColor(0., 0., 0., 1.);
+// Draws one of the passes which trace a scene with the scene's program. The
+// inputs are the same for every scene, only the target (`draw_fb`) differs
+// when prewarming.
+static void render_scene_pass(demo_t *demo, const scene_t *scene, int pass,
+                              const fbo_t *draw_fb,
+                              struct sync_device *rocket, double rocket_row) {
+    const program_t *program = scene->programs + pass;
+    const GLuint feedback_texture =
+        demo->fbs[demo->firstpass_fb_idx ? 0 : 1].textures[0];
+    const char *name = scene_pass_names[pass];
+
+    switch (pass) {
+    case SCENE_PREPASS:
+        render_pass(demo, name, draw_fb, program, rocket, rocket_row,
+                    (GLuint[]){demo->terrain_texture},
+                    (const char *[]){"u_TerrainSampler"}, 1);
+        break;
+    case SCENE_GEOMETRY:
+        // With meshes, hit distances also get written as depth
+        if (draw_fb->depth) {
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_ALWAYS);
+        }
+        render_pass(
+            demo, name, draw_fb, program, rocket, rocket_row,
+            (GLuint[]){demo->terrain_texture, demo->depth_fb.textures[0]},
+            (const char *[]){"u_TerrainSampler", "u_DepthSampler"}, 2);
+        glDisable(GL_DEPTH_TEST);
+        break;
+    case SCENE_SHADOW:
+        render_pass(demo, name, draw_fb, program, rocket, rocket_row,
+                    (GLuint[]){demo->terrain_texture,
+                               demo->gbuffer.textures[0],
+                               demo->gbuffer.textures[1]},
+                    (const char *[]){"u_TerrainSampler", "u_DistanceSampler",
+                                     "u_NormalSampler"},
+                    3);
+        break;
+    default:
+        // The lighting pass draws a quad per screen tile (shading_tile.vert),
+        // and every variant only shades the tiles of its own class. They
+        // cover every pixel together, so only the first one clears.
+        TRACE_BEGIN(name);
+        begin_pass(
+            demo, draw_fb, program, rocket, rocket_row,
+            (GLuint[]){feedback_texture, demo->noise_texture,
+                       demo->terrain_texture, demo->gbuffer.textures[0],
+                       demo->gbuffer.textures[1], demo->shadow_fb.textures[0],
+                       demo->tiles_fb.textures[0]},
+            (const char *[]){"u_FeedbackSampler", "u_NoiseSampler",
+                             "u_TerrainSampler", "u_DistanceSampler",
+                             "u_NormalSampler", "u_ShadowSampler",
+                             "u_TileClassSampler"},
+            7);
+        glUniform1i(glGetUniformLocation(program->handle, "u_TileClass"),
+                    pass - SCENE_LIGHTING_SKY);
+        if (pass == SCENE_LIGHTING_SKY) {
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        gl_bind_vertex_array(demo->vao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4,
+                              demo->tiles_fb.width * demo->tiles_fb.height);
+        TRACE_END();
+        break;
+    }
+}
+
+// Takes the next step to get a scene ready before it's on screen. First
+// every pass's shader gets submitted to the driver once its preprocessing
+// task is done, then every program gets finished once the driver has linked
+// it, and last every program draws once to a 1x1 target, because some
+// drivers only compile for real on the first draw. Without `wait`, the step
+// doesn't get taken yet if it would have to wait for a task or the driver.
+static void prewarm_step(demo_t *demo, size_t index,
+                        struct sync_device *rocket, double rocket_row,
+                        int wait) {
+    scene_t *scene = demo->scenes + index;
+    const int pass = scene->step % SCENE_PASSES;
+    const scene_job_t *job = scene->jobs + pass;
+
+    if (scene->step < SCENE_PASSES) {
+        if (!wait && !task_done(scene->tasks[pass])) {
+            return;
+        }
+        char *src = task_wait(scene->tasks[pass]);
+        scene->tasks[pass] = NULL;
+        GLuint fragment_shader =
+            src ? submit_shader(src, shader_file_type(job->filename)) : 0;
+        free(src);
+        if (fragment_shader) {
+            scene->pending[pass] = submit_program(
+                (GLuint[]){scene_vertex_shader(demo, pass), fragment_shader},
+                2);
+            // The shader only gets deleted once the program is
+            shader_deinit(fragment_shader);
+        }
+    } else if (scene->step < SCENE_PASSES * 2) {
+        GLuint pending = scene->pending[pass];
+        if (!wait && pending && !program_ready(pending)) {
+            return;
+        }
+        scene->pending[pass] = 0;
+        if (!replace_program(scene->programs + pass,
+                             pending ? finish_program(pending)
+                                     : (program_t){0})) {
+            SDL_Log("File: %s\n", job->filename);
+            demo->programs_ok = 0;
+        }
+    } else if (!wait && scene->programs[pass].handle) {
+        render_scene_pass(demo, scene, pass, demo->warm_fbs + pass, rocket,
+                          rocket_row);
+    }
+
+    scene->step++;
+}
+
+// Takes one prewarm step for the next scene after the current one which
+// isn't ready yet, so that scenes get ready in the order they are likely to
+// be shown. One step per frame keeps the frame times flat.
+static void prewarm(demo_t *demo, struct sync_device *rocket,
+                    double rocket_row) {
+    for (size_t i = 1; i < SCENES; i++) {
+        size_t index = (demo->scene + i) % SCENES;
+        if (demo->scenes[index].step < PREWARM_STEPS) {
+            gpu_timer_begin(demo->timer, "prewarm");
+            prewarm_step(demo, index, rocket, rocket_row, 0);
+            gpu_timer_end(demo->timer);
+            return;
+        }
+    }
+}
+
+// Gets the scene on screen at a row from the rocket track Scene. Like
+// get_value, a baked track's index gets looked up only once.
+static size_t current_scene(demo_t *demo, struct sync_device *rocket,
+                            double rocket_row) {
+    double value = 0.;
+    if (demo->tracks) {
+        if (demo->scene_track == 0) {
+            int found = sync_tracks_find(demo->tracks, "Scene");
+            demo->scene_track = found < 0 ? -1 : found + 1;
+        }
+        if (demo->scene_track > 0) {
+            value = demo->track_values[0][demo->scene_track - 1];
+        }
+    } else {
+        value = sync_get_val(sync_get_track(rocket, "Scene"), rocket_row);
+    }
+    if (!(value > 0.)) {
+        return 0;
+    }
+    return value < SCENES ? (size_t)value : SCENES - 1;
+}
+
+// Prepares the inputs of a frame's render passes which don't depend on the
+// render target: sync track values, the scene and noise
+static void begin_frame(demo_t *demo, struct sync_device *rocket,
+                        double rocket_row) {
+    static unsigned char noise[NOISE_SIZE * NOISE_SIZE * 4];
+
+    // Evaluate all baked sync tracks for this frame in one go
+    sync_tracks_evaluate(demo->tracks, rocket_row, demo->track_values[0]);
+    sync_tracks_evaluate(demo->tracks, demo->prev_rocket_row,
+                         demo->track_values[1]);
+
+    // The next scene should be prewarmed by the time it's on screen, but
+    // seeking can jump to any scene. Then it has to be finished right away.
+    demo->scene = current_scene(demo, rocket, rocket_row);
+    scene_t *scene = demo->scenes + demo->scene;
+    if (scene->step < PREWARM_STEPS) {
+        SDL_Log("Scene %zu wasn't prewarmed in time\n", demo->scene);
+        TRACE_BEGIN("prewarm");
+        while (scene->step < PREWARM_STEPS) {
+            prewarm_step(demo, demo->scene, rocket, rocket_row, 1);
+        }
+        TRACE_END();
+    }
 
     // MAKE SOME NOISE !!!! WOOO
     // ------------------------------------------------------------------------
 
-    glActiveTexture(GL_TEXTURE0);
+    TRACE_BEGIN("noise");
     for (GLsizei i = 0; i < NOISE_SIZE * NOISE_SIZE * 4; i++) {
         noise[i] = rand_xoshiro();
     }
-    glBindTexture(GL_TEXTURE_2D, demo->noise_texture);
+    gl_bind_texture(0, demo->noise_texture);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, NOISE_SIZE, NOISE_SIZE, GL_RGBA,
                     GL_UNSIGNED_BYTE, noise);
+    TRACE_END();
+}
+
+// Runs every render pass of a frame, from the depth pre-pass to post
+// processing, which draws to `post_fb`
+static void render_passes(demo_t *demo, struct sync_device *rocket,
+                          double rocket_row, const fbo_t *post_fb) {
+    const size_t cur_fb_idx = demo->firstpass_fb_idx;
+    const size_t alt_fb_idx = cur_fb_idx ? 0 : 1;
+
+    const scene_t *scene = demo->scenes + demo->scene;
+
+    // Depth pre-pass
+    // ------------------------------------------------------------------------
+    // Traces cones at a low resolution so that the geometry pass's rays can
+    // skip the empty space in front of the scene.
+
+    gpu_timer_begin(demo->timer, "prepass");
+    render_scene_pass(demo, scene, SCENE_PREPASS, &demo->depth_fb, rocket,
+                      rocket_row);
+    gpu_timer_end(demo->timer);
+
+    // Geometry pass
+    // ------------------------------------------------------------------------
+    // Traces primary rays, and writes the surfaces they hit to the G-buffer.
+    // With meshes, it also writes the hit distances as depth.
+
+    gpu_timer_begin(demo->timer, "geometry");
+    render_scene_pass(demo, scene, SCENE_GEOMETRY, &demo->gbuffer, rocket,
+                      rocket_row);
+    gpu_timer_end(demo->timer);
+
+    // Meshes
+    // ------------------------------------------------------------------------
+    // Rasterized on top of the geometry pass's surfaces, where they are
+    // closer. Later passes can't tell them apart from raymarched surfaces.
+
+    if (demo->gbuffer.depth) {
+        gpu_timer_begin(demo->timer, "meshes");
+        begin_pass(demo, &demo->gbuffer, &demo->mesh_program, rocket,
+                   rocket_row, NULL, NULL, 0);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        mesh_draw(demo->mesh);
+        glDisable(GL_DEPTH_TEST);
+        gpu_timer_end(demo->timer);
+    }
+
+    // Tile classification
+    // ------------------------------------------------------------------------
+    // Sorts the screen tiles into sky, water, solid and mixed ones, so that
+    // the lighting pass can shade each class with a specialised program.
+
+    gpu_timer_begin(demo->timer, "classify");
+    render_pass(demo, "classify", &demo->tiles_fb, &demo->classify_program,
+                rocket, rocket_row,
+                (GLuint[]){demo->gbuffer.textures[0],
+                           demo->gbuffer.textures[1]},
+                (const char *[]){"u_DistanceSampler", "u_NormalSampler"}, 2);
+    gpu_timer_end(demo->timer);
+
+    // Shadow pass
+    // ------------------------------------------------------------------------
+    // Shadow rays are the most expensive part of lighting, so they are traced
+    // at a lower resolution.
+
+    gpu_timer_begin(demo->timer, "shadow");
+    render_scene_pass(demo, scene, SCENE_SHADOW, &demo->shadow_fb, rocket,
+                      rocket_row);
+    gpu_timer_end(demo->timer);
+
+    // Lighting pass
+    // ------------------------------------------------------------------------
+    // With checkerboard rendering, only part of the pixels get shaded here,
+    // and the resolve pass completes the frame to the "main" target FBO.
+
+    gpu_timer_begin(demo->timer, "lighting");
+    const fbo_t *lighting_fb =
+        CHECKERBOARD > 1 ? &demo->sparse_fb : &demo->fbs[cur_fb_idx];
+    for (int pass = SCENE_LIGHTING_SKY; pass <= SCENE_LIGHTING_MIXED; pass++) {
+        render_scene_pass(demo, scene, pass, lighting_fb, rocket, rocket_row);
+    }
+    gpu_timer_end(demo->timer);
+
+    // Checkerboard resolve
+    // ------------------------------------------------------------------------
+    // Fills the pixels skipped on this frame by reprojecting the previous
+    // frame's result.
+
+    if (CHECKERBOARD > 1) {
+        gpu_timer_begin(demo->timer, "resolve");
+        render_pass(demo, "resolve", &demo->fbs[cur_fb_idx],
+                    &demo->resolve_program, rocket, rocket_row,
+                    (GLuint[]){demo->sparse_fb.textures[0],
+                               demo->fbs[alt_fb_idx].textures[0]},
+                    (const char *[]){"u_InputSampler", "u_HistorySampler"}, 2);
+        gpu_timer_end(demo->timer);
+    }
+
+    // Accumulation
+    // ------------------------------------------------------------------------
+    // When refining a paused frame, the jittered sample gets averaged with
+    // the previous samples, and the average gets post processed instead.
+
+    GLuint lit_texture = demo->fbs[cur_fb_idx].textures[0];
+    if (demo->refine) {
+        const fbo_t *accum_fb = &demo->accum_fbs[demo->samples % 2];
+        const fbo_t *history_fb = &demo->accum_fbs[(demo->samples + 1) % 2];
+        render_pass(demo, "accumulate", accum_fb, &demo->accumulate_program,
+                    rocket, rocket_row,
+                    (GLuint[]){lit_texture, history_fb->textures[0]},
+                    (const char *[]){"u_InputSampler", "u_HistorySampler"}, 2);
+        lit_texture = accum_fb->textures[0];
+    }
 
-    // Effect shader
+    // Compute bloom and post
     // ------------------------------------------------------------------------
+    // The same as the fragment shader passes below, in three dispatches: the
+    // bright parts get separated and blurred along X, then blurred along Y,
+    // and composited with the lit image. They are timed separately from the
+    // fragment shader passes, so that toggling between them (see
+    // demo_toggle_compute) shows which is faster.
+
+    const fbo_t *image_fb = NULL;
+    if (demo->use_compute && (image_fb = compute_target(demo, post_fb))) {
+        gpu_timer_begin(demo->timer, "post_compute");
+        const fbo_t *bloom_fbs = demo->bloom_fbs;
+        GLuint bloom_width = bloom_fbs[0].width;
+        GLuint bloom_height = bloom_fbs[0].height;
+        // Work groups run along rows, and then along columns
+        compute_pass(demo, "bloom_x_compute", &bloom_fbs[1], GL_RGBA16F,
+                     &demo->bloom_x_compute_program, rocket, rocket_row,
+                     bloom_width, bloom_height, (GLuint[]){lit_texture},
+                     (const char *[]){"u_InputSampler"}, 1);
+        compute_pass(demo, "bloom_y_compute", &bloom_fbs[0], GL_RGBA16F,
+                     &demo->bloom_y_compute_program, rocket, rocket_row,
+                     bloom_height, bloom_width,
+                     (GLuint[]){bloom_fbs[1].textures[0]},
+                     (const char *[]){"u_InputSampler"}, 1);
+        compute_pass(demo, "post_compute", image_fb, GL_RGBA8,
+                     &demo->post_compute_program, rocket, rocket_row,
+                     post_fb->width, post_fb->height,
+                     (GLuint[]){lit_texture, bloom_fbs[0].textures[0],
+                                demo->noise_texture},
+                     (const char *[]){"u_InputSampler", "u_BloomSampler",
+                                      "u_NoiseSampler"},
+                     3);
+        if (image_fb != post_fb) {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, image_fb->framebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, post_fb->framebuffer);
+            // The blit only covers the letterboxed area, black out the rest
+            glClear(GL_COLOR_BUFFER_BIT);
+            glBlitFramebuffer(0, 0, image_fb->width, image_fb->height,
+                              post_fb->x, post_fb->y,
+                              post_fb->x + post_fb->width,
+                              post_fb->y + post_fb->height,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+        gpu_timer_end(demo->timer);
+        return;
+    }
 
-    render_pass(demo, &demo->fbs[cur_fb_idx], &demo->effect_program, rocket,
-                rocket_row,
-                (GLuint[]){demo->fbs[alt_fb_idx].texture, demo->noise_texture},
-                (const char *[]){"u_FeedbackSampler", "u_NoiseSampler"}, 2);
+    // Bloom and post passes are timed together
+    gpu_timer_begin(demo->timer, "post");
 
     // Bloom pre
     // ------------------------------------------------------------------------
 
-    render_pass(demo, &demo->quarter_fbs[0], &demo->bloom_pre_program, rocket,
-                rocket_row, (GLuint[]){demo->fbs[cur_fb_idx].texture},
+    render_pass(demo, "bloom_pre", &demo->quarter_fbs[0],
+                &demo->bloom_pre_program, rocket, rocket_row,
+                (GLuint[]){lit_texture},
                 (const char *[]){"u_InputSampler"}, 1);
 
     // Bloom x
     // ------------------------------------------------------------------------
 
-    render_pass(demo, &demo->quarter_fbs[1], &demo->bloom_x_program, rocket,
-                rocket_row, (GLuint[]){demo->quarter_fbs[0].texture},
+    render_pass(demo, "bloom_x", &demo->quarter_fbs[1],
+                &demo->bloom_x_program, rocket, rocket_row,
+                (GLuint[]){demo->quarter_fbs[0].textures[0]},
                 (const char *[]){"u_InputSampler"}, 1);
 
     // Bloom y
     // ------------------------------------------------------------------------
 
-    render_pass(demo, &demo->quarter_fbs[0], &demo->bloom_y_program, rocket,
-                rocket_row, (GLuint[]){demo->quarter_fbs[1].texture},
+    render_pass(demo, "bloom_y", &demo->quarter_fbs[0],
+                &demo->bloom_y_program, rocket, rocket_row,
+                (GLuint[]){demo->quarter_fbs[1].textures[0]},
                 (const char *[]){"u_InputSampler"}, 1);
 
     // Post shader
     // ------------------------------------------------------------------------
 
     render_pass(
-        demo, &demo->fbs[2], &demo->post_program, rocket, rocket_row,
-        (GLuint[]){demo->fbs[cur_fb_idx].texture, demo->quarter_fbs[0].texture,
+        demo, "post", post_fb, &demo->post_program, rocket, rocket_row,
+        (GLuint[]){lit_texture, demo->quarter_fbs[0].textures[0],
                    demo->noise_texture},
         (const char *[]){"u_InputSampler", "u_BloomSampler", "u_NoiseSampler"},
         3);
 
+    gpu_timer_end(demo->timer);
+}
+
+// This gets called once per frame from main loop (main.c)
+void demo_render(demo_t *demo, struct sync_device *rocket, double rocket_row) {
+#ifdef DEBUG
+    // Early return if shaders are currently unusable
+    if (!demo->programs_ok) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glClearColor(0.3, 0., 0., 1.);
+        glClear(GL_COLOR_BUFFER_BIT);
+        return;
+    }
+#endif
+
+    glClearColor(0., 0., 0., 1.);
+
+    TRACE_BEGIN("demo_render");
+    // A texture which became ready changes how the frame looks
+    if (!demo->textures_updated && textures_update(demo->textures, 0)) {
+        demo->generation++;
+    }
+    demo->textures_updated = 0;
+    begin_frame(demo, rocket, rocket_row);
+    prewarm(demo, rocket, rocket_row);
+
+    // Refinement samples are spread over the pixel with Martin Roberts' R2
+    // sequence, which covers it evenly for any number of samples. The first
+    // sample is at the pixel's center, like a normal frame.
+    if (demo->refine && !create_accumulation(demo)) {
+        demo->refine = 0;
+    }
+    if (demo->refine) {
+        double x = fmod(.5 + demo->samples * .7548776662, 1.) - .5;
+        double y = fmod(.5 + demo->samples * .5698402910, 1.) - .5;
+        demo->jitter[0] = x * 2. / demo->fbs[0].width;
+        demo->jitter[1] = y * 2. / demo->fbs[0].height;
+    }
+
+    // Post processing draws straight into the window's letterboxed area
+    // (framebuffer 0) when there is no output FB. Clearing the window blacks
+    // out the borders.
+    const fbo_t window_fb = {.framebuffer = 0,
+                             .x = demo->x0,
+                             .y = demo->y0,
+                             .width = demo->x1 - demo->x0,
+                             .height = demo->y1 - demo->y0};
+    const int offscreen = demo->output_fb.framebuffer != 0;
+    render_passes(demo, rocket, rocket_row,
+                  offscreen ? &demo->output_fb : &window_fb);
+
     // Output blit
     // ------------------------------------------------------------------------
     // This stretches or squashes the post-processed image to the window in
     // correct aspect ratio (framebuffer 0).
 
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, demo->fbs[2].framebuffer);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBlitFramebuffer(0, 0, demo->fbs[2].width, demo->fbs[2].height, demo->x0,
-                      demo->y0, demo->x1, demo->y1, GL_COLOR_BUFFER_BIT,
-                      GL_LINEAR);
+    if (offscreen) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, demo->output_fb.framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBlitFramebuffer(0, 0, demo->output_fb.width, demo->output_fb.height,
+                          demo->x0, demo->y0, demo->x1, demo->y1,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
 
     // Switch fb to keep render results in memory for feedback effects
-    demo->firstpass_fb_idx = alt_fb_idx;
+    demo->firstpass_fb_idx = demo->firstpass_fb_idx ? 0 : 1;
+    demo->prev_rocket_row = rocket_row;
+    demo->frame++;
+    // A normal frame replaces the refined one on screen
+    if (demo->refine) {
+        demo->samples++;
+        demo->refine = 0;
+        demo->jitter[0] = demo->jitter[1] = 0.f;
+    } else {
+        demo->samples = 0;
+    }
+    gpu_timer_frame(demo->timer);
+    gl_state_frame();
+    TRACE_END();
+}
+
+// FNV-1a hash, continuing from `hash`
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Adds the values of an r_ or p_ -prefixed uniform to a hash, using the same
+// tracks as set_rocket_uniforms
+static uint64_t hash_uniform(uint64_t hash, const demo_t *demo,
+                             struct sync_device *rocket, uniform_t *ufm,
+                             double row) {
+    int prev = ufm->name[0] == 'p';
+    double rocket_row = prev ? demo->prev_rocket_row : row;
+    int components = ufm->type == GL_FLOAT_VEC4   ? 4
+                     : ufm->type == GL_FLOAT_VEC3 ? 3
+                     : ufm->type == GL_FLOAT_VEC2 ? 2
+                                                  : 1;
+    for (int i = 0; i < components; i++) {
+        char c = components > 1 ? "xyzw"[i] : 0;
+        float value = get_value(demo, rocket, ufm, c, rocket_row, prev);
+        hash = hash_bytes(hash, &value, sizeof(value));
+    }
+    return hash;
+}
+
+// Adds the values of a program's r_ and p_ -prefixed uniforms to a hash
+static uint64_t hash_program(uint64_t hash, const demo_t *demo,
+                             struct sync_device *rocket,
+                             const program_t *program, double row) {
+    for (size_t i = 0; i < program->uniform_count; i++) {
+        uniform_t *ufm = program->uniforms + i;
+        if (ufm->name_len >= 3 &&
+            (ufm->name[0] == 'r' || ufm->name[0] == 'p') &&
+            ufm->name[1] == '_') {
+            hash = hash_uniform(hash, demo, rocket, ufm, row);
+        }
+    }
+    return hash;
+}
+
+// Gets called from main loop (main.c) while the demo is paused, and tells
+// whether rendering a frame can be skipped because it would look the same as
+// the previous one: the row, the scene, every rocket uniform's value, the
+// shaders, the textures and the window are unchanged. Before that, the paused
+// frame gets REFINE_SAMPLES jittered samples averaged into it, which
+// anti-aliases it.
+// Returns 1 when demo_render doesn't need to be called.
+int demo_skip_frame(demo_t *demo, struct sync_device *rocket,
+                    double rocket_row) {
+    if (!demo->programs_ok) {
+        return 0;
+    }
+
+    TRACE_BEGIN("demo_skip_frame");
+    // Textures keep streaming while frames get skipped, and one which became
+    // ready changes how the frame looks
+    if (textures_update(demo->textures, 0)) {
+        demo->generation++;
+    }
+    demo->textures_updated = 1;
+
+    uint64_t hash = 0xcbf29ce484222325;
+    hash = hash_bytes(hash, &rocket_row, sizeof(rocket_row));
+    hash = hash_bytes(hash, &demo->prev_rocket_row,
+                      sizeof(demo->prev_rocket_row));
+    hash = hash_bytes(hash, &demo->generation, sizeof(demo->generation));
+    for (size_t i = 0; i < PASSES; i++) {
+        hash = hash_program(hash, demo, rocket,
+                            pass_program(demo, pass_shaders + i), rocket_row);
+    }
+    // Only the scene on screen gets drawn
+    size_t scene = current_scene(demo, rocket, rocket_row);
+    hash = hash_bytes(hash, &scene, sizeof(scene));
+    for (size_t i = 0; i < SCENE_PASSES; i++) {
+        hash = hash_program(hash, demo, rocket,
+                            demo->scenes[scene].programs + i, rocket_row);
+    }
+    TRACE_END();
+
+    if (hash != demo->state_hash) {
+        // Something changed, render a normal frame
+        demo->state_hash = hash;
+        return 0;
+    }
+    if (demo->samples < REFINE_SAMPLES) {
+        demo->refine = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Finishes loading everything which otherwise streams in while the demo
+// runs, so that every frame from now on looks the same as it will later.
+// Gets called before exporting a video (main.c) and rendering posters.
+void demo_finish_loading(demo_t *demo) {
+    if (textures_update(demo->textures, 1)) {
+        demo->generation++;
+    }
+}
+
+// Renders one frame of width * height pixels in tiles of POSTER_TILE pixels,
+// and writes it to a binary PPM file, for posters and other images larger
+// than the GPU or memory would handle at once. Every tile gets rendered with
+// a guard band of POSTER_GUARD pixels around it, so that bloom and chromatic
+// aberration at the tile's edges see the same neighbouring pixels as in one
+// big image. The FBs are only as large as one tile with its guard band, and
+// only one row of tiles is kept in memory before it's written to the file.
+// Returns 1 when successful, 0 when unsuccessful.
+int demo_render_tiled(demo_t *demo, struct sync_device *rocket,
+                      double rocket_row, int width, int height,
+                      const char *filename) {
+    const int tile = POSTER_TILE, guard = POSTER_GUARD, size = tile + guard * 2;
+    const int tiles_x = (width + tile - 1) / tile;
+    const int tiles_y = (height + tile - 1) / tile;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        SDL_Log("Failed to open %s for writing\n", filename);
+        return 0;
+    }
+    unsigned char *band = malloc((size_t)width * tile * 3);
+    unsigned char *pixels = malloc((size_t)tile * tile * 4);
+    int ok = band && pixels;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    // The image must not change between tiles
+    demo_finish_loading(demo);
+
+    // Replace the FBs with tile sized ones. Without POST_TO_WINDOW,
+    // create_targets already made the output FB.
+    delete_targets(demo);
+    ok = ok && create_targets(demo, size, size) &&
+         (demo->output_fb.framebuffer || create_output(demo));
+
+    // Shade every pixel from scratch, there are no previous frames
+    demo->checkerboard = 1;
+    demo->prev_rocket_row = rocket_row;
+    glClearColor(0., 0., 0., 1.);
+    begin_frame(demo, rocket, rocket_row);
+
+    uint64_t start = SDL_GetTicks64();
+    // PPM rows go from top to bottom, OpenGL rows from bottom to top
+    for (int ty = tiles_y - 1; ok && ty >= 0; ty--) {
+        const int y0 = ty * tile;
+        const int rows = height - y0 < tile ? height - y0 : tile;
+        for (int tx = 0; tx < tiles_x; tx++) {
+            const int x0 = tx * tile;
+            const int cols = width - x0 < tile ? width - x0 : tile;
+
+            // Center and size of the tile with its guard band in the image
+            demo->tile_rect[0] = (x0 - guard + size * .5f) / width * 2.f - 1.f;
+            demo->tile_rect[1] =
+                (y0 - guard + size * .5f) / height * 2.f - 1.f;
+            demo->tile_rect[2] = (float)size / width;
+            demo->tile_rect[3] = (float)size / height;
+            render_passes(demo, rocket, rocket_row, &demo->output_fb);
+            gpu_timer_frame(demo->timer);
+
+            // Copy the tile without its guard band to the row of tiles
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, demo->output_fb.framebuffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(guard, guard, cols, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+                         pixels);
+            for (int y = 0; y < rows; y++) {
+                const unsigned char *src = pixels + (size_t)y * cols * 4;
+                unsigned char *dst =
+                    band + ((size_t)(rows - 1 - y) * width + x0) * 3;
+                for (int x = 0; x < cols; x++) {
+                    dst[x * 3] = src[x * 4];
+                    dst[x * 3 + 1] = src[x * 4 + 1];
+                    dst[x * 3 + 2] = src[x * 4 + 2];
+                }
+            }
+
+            int done = (tiles_y - 1 - ty) * tiles_x + tx + 1;
+            SDL_Log("Rendered tile %d/%d, %.1f s\n", done, tiles_x * tiles_y,
+                    (SDL_GetTicks64() - start) / 1000.);
+        }
+        ok = fwrite(band, 3, (size_t)width * rows, file) ==
+             (size_t)width * rows;
+    }
+
+    // Back to normal rendering
+    demo->checkerboard = CHECKERBOARD;
+    demo->tile_rect[0] = demo->tile_rect[1] = 0.f;
+    demo->tile_rect[2] = demo->tile_rect[3] = 1.f;
+    delete_targets(demo);
+    if (!create_targets(demo, demo->width, demo->height)) {
+        ok = 0;
+    }
+
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+    free(band);
+    free(pixels);
+    if (ok) {
+        SDL_Log("Wrote %s\n", filename);
+    }
+    return ok;
+}
+
+// Binds the final image of the latest demo_render (before it gets scaled to
+// the window) as the read framebuffer, for glReadPixels. Sets width and
+// height to the image size. With POST_TO_WINDOW, the first call creates the
+// output FB, and demo_render draws to it from then on.
+void demo_bind_output(demo_t *demo, int *width, int *height) {
+    if (!demo->output_fb.framebuffer && !create_output(demo)) {
+        SDL_Log("Failed to create the output FB\n");
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, demo->output_fb.framebuffer);
+    *width = demo->output_fb.width;
+    *height = demo->output_fb.height;
+}
+
+// Switches the bloom and post passes between compute and fragment shaders,
+// if the context has compute shaders. Gets called from event handler
+// (main.c) if C is pressed.
+void demo_toggle_compute(demo_t *demo) {
+    if (!demo->compute) {
+        SDL_Log("Compute shaders aren't supported by this context\n");
+        return;
+    }
+    demo->use_compute = !demo->use_compute;
+    demo->generation++;
+    SDL_Log("Post processing uses %s shaders\n",
+            demo->use_compute ? "compute" : "fragment");
+}
+
+// Logs how much GPU time each group of render passes takes on average.
+// Gets called from main loop (main.c) along with the FPS reading.
+void demo_log_timings(demo_t *demo) {
+    gpu_timer_log(demo->timer);
+    gl_state_log();
 }
 
 void demo_deinit(demo_t *demo) {
     if (demo) {
+        gpu_timer_deinit(demo->timer);
+        mesh_deinit(demo->mesh);
+        textures_deinit(demo->textures);
+        // Scenes which never got prewarmed may still have tasks running
+        for (size_t i = 0; i < SCENES; i++) {
+            for (size_t j = 0; j < SCENE_PASSES; j++) {
+                free(task_wait(demo->scenes[i].tasks[j]));
+            }
+        }
+        sync_tracks_deinit(demo->tracks);
+        free(demo->track_values[0]);
+        free(demo->track_values[1]);
         free(demo);
     }
 }
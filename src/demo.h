@@ -7,9 +7,19 @@
 typedef struct demo_t_ demo_t;
 
 demo_t *demo_init(int width, int height);
+int demo_init_gl(demo_t *demo);
 void demo_render(demo_t *demo, struct sync_device *rocket, double rocket_row);
+int demo_render_tiled(demo_t *demo, struct sync_device *rocket,
+                      double rocket_row, int width, int height,
+                      const char *filename);
+int demo_skip_frame(demo_t *demo, struct sync_device *rocket,
+                    double rocket_row);
 void demo_reload(demo_t *demo);
+void demo_toggle_compute(demo_t *demo);
 void demo_resize(demo_t *demo, int width, int height);
+void demo_finish_loading(demo_t *demo);
+void demo_bind_output(demo_t *demo, int *width, int *height);
+void demo_log_timings(demo_t *demo);
 void demo_deinit(demo_t *demo);
 
 #endif
@@ -0,0 +1,343 @@
+// Video export. Frames are read back from the GPU asynchronously: each
+// frame's glReadPixels goes into one of EXPORT_PBOS pixel buffer objects, and
+// the pixels get copied out EXPORT_PBOS frames later, when the GPU has long
+// finished with them. A writer thread converts the frames to YUV and writes
+// them to a .y4m file while the next frames render.
+//
+// .y4m is an uncompressed video format which e.g. ffmpeg can read:
+// ffmpeg -i export.y4m -i export.wav -c:v libx264 -crf 18 demo.mp4
+
+#include "config.h"
+#include "demo.h"
+#include "gl.h"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Only declarations, music_player.c includes the implementation
+#define STB_VORBIS_HEADER_ONLY
+#include "stb_vorbis.c"
+
+// Number of read back frames which can wait for the writer thread
+#define QUEUE_FRAMES 4
+
+typedef struct {
+    int width, height, fps;
+    // Ring of PBOs which receive glReadPixels results, and fences which tell
+    // when the results are ready
+    GLuint pbos[EXPORT_PBOS];
+    GLsync fences[EXPORT_PBOS];
+    uint64_t frames_captured;
+
+    // Ring of RGBA frames for the writer thread
+    unsigned char *queue[QUEUE_FRAMES];
+    size_t queue_head, queue_count;
+    int done;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    SDL_Thread *thread;
+
+    FILE *file;
+    uint64_t frames_written;
+    uint64_t start_ticks;
+} exporter_t;
+
+// Converts a bottom-up RGBA frame to 4:2:0 YUV (BT.601, limited range) and
+// writes it as a y4m frame
+static void write_frame(exporter_t *e, const unsigned char *rgba,
+                        unsigned char *planes) {
+    const int w = e->width, h = e->height;
+    const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    unsigned char *y_plane = planes;
+    unsigned char *u_plane = y_plane + w * h;
+    unsigned char *v_plane = u_plane + cw * ch;
+
+    for (int y = 0; y < h; y++) {
+        // OpenGL rows are bottom to top, y4m rows are top to bottom
+        const unsigned char *row = rgba + (size_t)(h - 1 - y) * w * 4;
+        for (int x = 0; x < w; x++) {
+            int r = row[x * 4], g = row[x * 4 + 1], b = row[x * 4 + 2];
+            y_plane[y * w + x] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        }
+    }
+
+    // Chroma is the average of each 2x2 block
+    for (int y = 0; y < ch; y++) {
+        for (int x = 0; x < cw; x++) {
+            int r = 0, g = 0, b = 0;
+            for (int i = 0; i < 4; i++) {
+                int sx = x * 2 + (i & 1), sy = y * 2 + (i >> 1);
+                sx = sx < w ? sx : w - 1;
+                sy = sy < h ? sy : h - 1;
+                const unsigned char *p =
+                    rgba + ((size_t)(h - 1 - sy) * w + sx) * 4;
+                r += p[0];
+                g += p[1];
+                b += p[2];
+            }
+            r /= 4;
+            g /= 4;
+            b /= 4;
+            u_plane[y * cw + x] =
+                ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v_plane[y * cw + x] =
+                ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+
+    fputs("FRAME\n", e->file);
+    fwrite(planes, 1, (size_t)w * h + (size_t)cw * ch * 2, e->file);
+}
+
+// The writer thread takes frames from the queue until exporter_deinit
+static int writer(void *data) {
+    exporter_t *e = (exporter_t *)data;
+    unsigned char *planes =
+        malloc((size_t)e->width * e->height * 3 / 2 + e->width + e->height);
+
+    SDL_LockMutex(e->mutex);
+    for (;;) {
+        while (e->queue_count == 0 && !e->done) {
+            SDL_CondWait(e->cond, e->mutex);
+        }
+        if (e->queue_count == 0) {
+            break;
+        }
+        // The oldest frame stays in the queue while it's written, so that
+        // the main thread doesn't reuse its buffer
+        unsigned char *frame =
+            e->queue[(e->queue_head + QUEUE_FRAMES - e->queue_count) %
+                     QUEUE_FRAMES];
+        SDL_UnlockMutex(e->mutex);
+
+        if (planes) {
+            write_frame(e, frame, planes);
+        }
+
+        SDL_LockMutex(e->mutex);
+        e->queue_count--;
+        e->frames_written++;
+        SDL_CondSignal(e->cond);
+    }
+    SDL_UnlockMutex(e->mutex);
+
+    free(planes);
+    return 0;
+}
+
+// Waits for the PBO in `slot` to get its pixels and hands them to the writer
+// thread
+static void retire(exporter_t *e, size_t slot) {
+    // The fence was created EXPORT_PBOS frames ago, so this rarely waits
+    while (glClientWaitSync(e->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+                            1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(e->fences[slot]);
+    e->fences[slot] = 0;
+
+    // Wait for a free buffer in the queue
+    SDL_LockMutex(e->mutex);
+    while (e->queue_count == QUEUE_FRAMES) {
+        SDL_CondWait(e->cond, e->mutex);
+    }
+    unsigned char *frame = e->queue[e->queue_head];
+    SDL_UnlockMutex(e->mutex);
+
+    size_t size = (size_t)e->width * e->height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, e->pbos[slot]);
+    const void *pixels =
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(frame, pixels, size);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    SDL_LockMutex(e->mutex);
+    e->queue_head = (e->queue_head + 1) % QUEUE_FRAMES;
+    e->queue_count++;
+    SDL_CondSignal(e->cond);
+    SDL_UnlockMutex(e->mutex);
+}
+
+// Opens a .y4m file for writing the demo's output at `fps` frames per second
+exporter_t *exporter_init(const char *filename, demo_t *demo, int fps) {
+    exporter_t *e = calloc(1, sizeof(exporter_t));
+    if (!e) {
+        return NULL;
+    }
+
+    demo_bind_output(demo, &e->width, &e->height);
+    e->fps = fps;
+
+    e->file = fopen(filename, "wb");
+    if (!e->file) {
+        SDL_Log("Failed to open %s for writing\n", filename);
+        return NULL;
+    }
+    fprintf(e->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", e->width,
+            e->height, fps);
+
+    size_t size = (size_t)e->width * e->height * 4;
+    glGenBuffers(EXPORT_PBOS, e->pbos);
+    for (size_t i = 0; i < EXPORT_PBOS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, e->pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (size_t i = 0; i < QUEUE_FRAMES; i++) {
+        e->queue[i] = malloc(size);
+        if (!e->queue[i]) {
+            return NULL;
+        }
+    }
+
+    e->mutex = SDL_CreateMutex();
+    e->cond = SDL_CreateCond();
+    e->thread = SDL_CreateThread(writer, "exporter", e);
+    if (!e->thread) {
+        SDL_Log("Failed to create the exporter thread: %s\n", SDL_GetError());
+        return NULL;
+    }
+
+    SDL_Log("Exporting %dx%d at %d FPS to %s\n", e->width, e->height, fps,
+            filename);
+    e->start_ticks = SDL_GetTicks64();
+    return e;
+}
+
+// Starts reading back the frame which demo_render just rendered. Call this
+// after every demo_render. Returns 0 if the export can't continue, because
+// a dropped frame would make the video shorter than the music.
+int exporter_capture(exporter_t *e, demo_t *demo) {
+    size_t slot = e->frames_captured % EXPORT_PBOS;
+
+    // The slot still holds the frame from EXPORT_PBOS frames ago
+    if (e->fences[slot]) {
+        retire(e, slot);
+    }
+
+    int width, height;
+    demo_bind_output(demo, &width, &height);
+    // The PBOs have room for the size at exporter_init
+    if (width != e->width || height != e->height) {
+        SDL_Log("Demo output size changed during export, aborting\n");
+        return 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, e->pbos[slot]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    // With a PBO bound, this returns immediately and the copy happens on
+    // the GPU later
+    glReadPixels(0, 0, e->width, e->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    e->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    e->frames_captured++;
+    return 1;
+}
+
+// Writes the frames which are still in flight, closes the file and logs how
+// fast the export was
+void exporter_deinit(exporter_t *e) {
+    if (!e) {
+        return;
+    }
+
+    // Retire the remaining PBOs oldest first
+    for (size_t i = 0; i < EXPORT_PBOS; i++) {
+        size_t slot = (e->frames_captured + i) % EXPORT_PBOS;
+        if (e->fences[slot]) {
+            retire(e, slot);
+        }
+    }
+
+    SDL_LockMutex(e->mutex);
+    e->done = 1;
+    SDL_CondSignal(e->cond);
+    SDL_UnlockMutex(e->mutex);
+    SDL_WaitThread(e->thread, NULL);
+
+    double seconds = (SDL_GetTicks64() - e->start_ticks) / 1000.;
+    SDL_Log("Exported %lu frames (%.1f s of video) in %.1f s, %.1f FPS\n",
+            (unsigned long)e->frames_written,
+            (double)e->frames_written / e->fps, seconds,
+            e->frames_written / (seconds > 0. ? seconds : 1.));
+
+    fclose(e->file);
+    glDeleteBuffers(EXPORT_PBOS, e->pbos);
+    for (size_t i = 0; i < QUEUE_FRAMES; i++) {
+        free(e->queue[i]);
+    }
+    SDL_DestroyCond(e->cond);
+    SDL_DestroyMutex(e->mutex);
+    free(e);
+}
+
+static void write_u32(FILE *file, uint32_t v) {
+    unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+    fwrite(b, 1, 4, file);
+}
+
+static void write_u16(FILE *file, uint16_t v) {
+    unsigned char b[2] = {v, v >> 8};
+    fwrite(b, 1, 2, file);
+}
+
+// Decodes an .ogg file to a 16-bit .wav file. Returns the length in seconds,
+// or a negative number if it fails.
+double export_wav(const char *ogg_filename, const char *wav_filename) {
+    int error = 0;
+    stb_vorbis *vorbis = stb_vorbis_open_filename(ogg_filename, &error, NULL);
+    if (!vorbis) {
+        SDL_Log("Failed to parse vorbis file %s\n", ogg_filename);
+        return -1.;
+    }
+    stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+
+    FILE *file = fopen(wav_filename, "wb");
+    if (!file) {
+        SDL_Log("Failed to open %s for writing\n", wav_filename);
+        stb_vorbis_close(vorbis);
+        return -1.;
+    }
+
+    // Sizes in the header get filled in after decoding
+    fwrite("RIFF\0\0\0\0WAVEfmt ", 1, 16, file);
+    write_u32(file, 16);
+    write_u16(file, 1); // PCM
+    write_u16(file, info.channels);
+    write_u32(file, info.sample_rate);
+    write_u32(file, info.sample_rate * info.channels * 2);
+    write_u16(file, info.channels * 2);
+    write_u16(file, 16);
+    fwrite("data\0\0\0\0", 1, 8, file);
+
+    static short buffer[4096 * 2];
+    uint32_t data_size = 0;
+    size_t samples = 0;
+    for (;;) {
+        int n = stb_vorbis_get_samples_short_interleaved(
+            vorbis, info.channels, buffer, sizeof(buffer) / sizeof(short));
+        if (n == 0) {
+            break;
+        }
+        // Samples are written in little endian, like WAV requires
+        for (int i = 0; i < n * info.channels; i++) {
+            write_u16(file, (uint16_t)buffer[i]);
+        }
+        data_size += n * info.channels * 2;
+        samples += n;
+    }
+
+    fseek(file, 4, SEEK_SET);
+    write_u32(file, 36 + data_size);
+    fseek(file, 40, SEEK_SET);
+    write_u32(file, data_size);
+    fclose(file);
+    stb_vorbis_close(vorbis);
+
+    SDL_Log("Wrote %s\n", wav_filename);
+    return (double)samples / info.sample_rate;
+}
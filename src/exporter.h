@@ -0,0 +1,14 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "demo.h"
+
+// Forward declaration so that implementation remains opaque
+typedef struct exporter_t_ exporter_t;
+
+exporter_t *exporter_init(const char *filename, demo_t *demo, int fps);
+int exporter_capture(exporter_t *exporter, demo_t *demo);
+void exporter_deinit(exporter_t *exporter);
+double export_wav(const char *ogg_filename, const char *wav_filename);
+
+#endif
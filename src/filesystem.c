@@ -174,6 +174,33 @@ cleanup:
     return 0;
 }
 
+// Gives the contents of a file without copying them when possible. In
+// SELF_CONTAINED builds this points straight to the data embedded in the
+// executable, otherwise the file is read to memory with read_file.
+// Returns NULL if the file can't be read. Release with unmap_file.
+const void *map_file(const char *filename, size_t *len) {
+#ifdef SELF_CONTAINED
+    unsigned int embedded_len = 0;
+    const unsigned char *data = filesystem_open(filename, &embedded_len);
+    if (!data) {
+        SDL_Log("Failed to read file %s\n", filename);
+        return NULL;
+    }
+    *len = embedded_len;
+    return data;
+#else
+    char *data = NULL;
+    *len = read_file(filename, &data);
+    return data;
+#endif
+}
+
+void unmap_file(const void *data) {
+#ifndef SELF_CONTAINED
+    free((void *)data);
+#endif
+}
+
 char *path_join(const char *path, const char *name) {
     size_t len_path = strlen(path), len_name = strlen(name);
 
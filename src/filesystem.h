@@ -5,5 +5,7 @@
 
 size_t read_file(const char *filename, char **dst);
 char *path_join(const char *path, const char *name);
+const void *map_file(const char *filename, size_t *len);
+void unmap_file(const void *data);
 
 #endif
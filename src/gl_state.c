@@ -0,0 +1,164 @@
+// A cache of OpenGL binding state. demo.c and shader.c bind programs, the
+// VAO, textures and uniform buffers through these functions, which skip the
+// GL call when the binding is already what is asked for. Every GL call costs
+// some CPU time for validation in the driver, which adds up on software
+// drivers like llvmpipe.
+//
+// The cache assumes that the bindings it tracks aren't changed by other GL
+// calls. Call gl_state_invalidate after deleting objects which may be bound,
+// because OpenGL may give their names to new objects.
+
+#include "gl.h"
+#include <SDL2/SDL.h>
+
+// Texture units and uniform buffer binding points which get tracked, binds to
+// higher ones are always issued
+#define MAX_UNITS 16
+// Marks a binding which isn't known, so that the next bind gets issued
+#define UNKNOWN ((GLuint)-1)
+
+static struct {
+    GLuint program;
+    GLuint vao;
+    GLuint active_unit;
+    GLuint textures[MAX_UNITS];
+    GLuint textures_3d[MAX_UNITS];
+    // The generic GL_UNIFORM_BUFFER binding, and the indexed binding points
+    GLuint uniform_buffer;
+    GLuint uniform_buffer_bases[MAX_UNITS];
+} state;
+
+// Counts of GL calls issued and skipped, on this frame and on the previous
+// frame, and totals since the last gl_state_log
+static unsigned issued, skipped, last_issued, last_skipped;
+static unsigned long total_issued, total_skipped, total_frames;
+
+// Returns 1 when the call should be issued and updates the cached value
+static int changes(GLuint *cached, GLuint value) {
+    if (*cached == value) {
+        skipped++;
+        return 0;
+    }
+    *cached = value;
+    issued++;
+    return 1;
+}
+
+// Forgets all cached bindings, so that the next binds get issued
+void gl_state_invalidate(void) {
+    state.program = UNKNOWN;
+    state.vao = UNKNOWN;
+    state.active_unit = UNKNOWN;
+    state.uniform_buffer = UNKNOWN;
+    for (size_t i = 0; i < MAX_UNITS; i++) {
+        state.textures[i] = UNKNOWN;
+        state.textures_3d[i] = UNKNOWN;
+        state.uniform_buffer_bases[i] = UNKNOWN;
+    }
+}
+
+void gl_use_program(GLuint program) {
+    if (changes(&state.program, program)) {
+        glUseProgram(program);
+    }
+}
+
+void gl_bind_vertex_array(GLuint vao) {
+    if (changes(&state.vao, vao)) {
+        glBindVertexArray(vao);
+    }
+}
+
+// Binds a GL_TEXTURE_2D texture to a texture unit (0 for GL_TEXTURE0 etc.)
+// Also makes the unit active, like glActiveTexture, when the bind is issued.
+void gl_bind_texture(GLuint unit, GLuint texture) {
+    if (unit >= MAX_UNITS) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        state.active_unit = UNKNOWN;
+        issued += 2;
+        return;
+    }
+    if (state.textures[unit] == texture) {
+        // Neither glActiveTexture nor glBindTexture is needed
+        skipped += 2;
+        return;
+    }
+    if (changes(&state.active_unit, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    changes(&state.textures[unit], texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+// Binds a GL_TEXTURE_3D texture to a texture unit, like gl_bind_texture.
+// Units have separate bindings for each target.
+void gl_bind_texture_3d(GLuint unit, GLuint texture) {
+    if (unit >= MAX_UNITS) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        state.active_unit = UNKNOWN;
+        issued += 2;
+        return;
+    }
+    if (state.textures_3d[unit] == texture) {
+        skipped += 2;
+        return;
+    }
+    if (changes(&state.active_unit, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    changes(&state.textures_3d[unit], texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+}
+
+// Binds a buffer to the generic GL_UNIFORM_BUFFER target, for glBufferData
+// and glBufferSubData
+void gl_bind_uniform_buffer(GLuint buffer) {
+    if (changes(&state.uniform_buffer, buffer)) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    }
+}
+
+// Binds a buffer to a uniform buffer binding point, like glBindBufferBase.
+// This binds the generic GL_UNIFORM_BUFFER target too.
+void gl_bind_uniform_buffer_base(GLuint index, GLuint buffer) {
+    if (index >= MAX_UNITS) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        state.uniform_buffer = buffer;
+        issued++;
+        return;
+    }
+    if (changes(&state.uniform_buffer_bases[index], buffer)) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        state.uniform_buffer = buffer;
+    }
+}
+
+// Ends a frame's call counting. Gets called once per frame (demo.c).
+void gl_state_frame(void) {
+    last_issued = issued;
+    last_skipped = skipped;
+    total_issued += issued;
+    total_skipped += skipped;
+    total_frames++;
+    issued = skipped = 0;
+}
+
+// Gives the number of GL calls which the previous frame issued and skipped
+void gl_state_counts(unsigned *issued_calls, unsigned *skipped_calls) {
+    *issued_calls = last_issued;
+    *skipped_calls = last_skipped;
+}
+
+// Logs the average number of issued and skipped GL calls per frame since
+// the previous log
+void gl_state_log(void) {
+    if (total_frames == 0) {
+        return;
+    }
+    SDL_Log("GL state calls per frame: %.1f issued, %.1f skipped\n",
+            (double)total_issued / total_frames,
+            (double)total_skipped / total_frames);
+    total_issued = total_skipped = total_frames = 0;
+}
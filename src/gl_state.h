@@ -0,0 +1,17 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include "gl.h"
+
+void gl_state_invalidate(void);
+void gl_use_program(GLuint program);
+void gl_bind_vertex_array(GLuint vao);
+void gl_bind_texture(GLuint unit, GLuint texture);
+void gl_bind_texture_3d(GLuint unit, GLuint texture);
+void gl_bind_uniform_buffer(GLuint buffer);
+void gl_bind_uniform_buffer_base(GLuint index, GLuint buffer);
+void gl_state_frame(void);
+void gl_state_counts(unsigned *issued, unsigned *skipped);
+void gl_state_log(void);
+
+#endif
@@ -0,0 +1,144 @@
+#include "gl.h"
+#include <SDL2/SDL_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum number of differently named sections that can be timed
+#define MAX_SECTIONS 16
+// Query results are read this many frames after they were issued, so that
+// reading them never has to wait for the GPU to catch up.
+#define QUERY_FRAMES 3
+
+// GL_TIME_ELAPSED queries are core in desktop OpenGL 3.3, but only an
+// extension in OpenGL ES. On GL ES the timer does nothing.
+#ifndef GLES
+
+// This struct holds the queries and accumulated results of one section
+typedef struct {
+    const char *name;
+    GLuint queries[QUERY_FRAMES];
+    // Set when the query of a frame has been issued but not read
+    int pending[QUERY_FRAMES];
+    // Sum of measured nanoseconds and number of measurements since last log
+    GLuint64 total_ns;
+    unsigned count;
+} section_t;
+
+typedef struct {
+    section_t sections[MAX_SECTIONS];
+    size_t section_count;
+    // Index to queries[] of the frame which is being recorded
+    size_t frame;
+    // Section which is being timed right now, or NULL
+    section_t *active;
+} gpu_timer_t;
+
+gpu_timer_t *gpu_timer_init(void) {
+    gpu_timer_t *timer = calloc(1, sizeof(gpu_timer_t));
+    return timer;
+}
+
+// Starts timing GPU work issued after this call, under a section name.
+// Sections can't be nested. `name` is not copied, it should be a literal.
+void gpu_timer_begin(gpu_timer_t *timer, const char *name) {
+    if (!timer || timer->active) {
+        return;
+    }
+
+    // Find the section by name, or add a new one
+    section_t *section = NULL;
+    for (size_t i = 0; i < timer->section_count; i++) {
+        if (strcmp(timer->sections[i].name, name) == 0) {
+            section = timer->sections + i;
+            break;
+        }
+    }
+    if (!section) {
+        if (timer->section_count == MAX_SECTIONS) {
+            return;
+        }
+        section = timer->sections + timer->section_count++;
+        section->name = name;
+        glGenQueries(QUERY_FRAMES, section->queries);
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, section->queries[timer->frame]);
+    section->pending[timer->frame] = 1;
+    timer->active = section;
+}
+
+// Stops timing the section started by gpu_timer_begin
+void gpu_timer_end(gpu_timer_t *timer) {
+    if (!timer || !timer->active) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->active = NULL;
+}
+
+// Call once per frame. Collects the results of an old frame's queries.
+void gpu_timer_frame(gpu_timer_t *timer) {
+    if (!timer) {
+        return;
+    }
+
+    timer->frame = (timer->frame + 1) % QUERY_FRAMES;
+
+    // The queries of this frame index were issued QUERY_FRAMES - 1 frames
+    // ago. Skip the ones that still aren't ready, instead of stalling.
+    for (size_t i = 0; i < timer->section_count; i++) {
+        section_t *section = timer->sections + i;
+        GLuint query = section->queries[timer->frame];
+        if (!section->pending[timer->frame]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            section->total_ns += ns;
+            section->count++;
+        }
+        section->pending[timer->frame] = 0;
+    }
+}
+
+// Logs average GPU time of every section since the previous call
+void gpu_timer_log(gpu_timer_t *timer) {
+    if (!timer) {
+        return;
+    }
+
+    for (size_t i = 0; i < timer->section_count; i++) {
+        section_t *section = timer->sections + i;
+        if (section->count) {
+            SDL_Log("GPU %-10s %7.3f ms\n", section->name,
+                    section->total_ns / (section->count * 1e6));
+        }
+        section->total_ns = 0;
+        section->count = 0;
+    }
+}
+
+void gpu_timer_deinit(gpu_timer_t *timer) {
+    if (timer) {
+        for (size_t i = 0; i < timer->section_count; i++) {
+            glDeleteQueries(QUERY_FRAMES, timer->sections[i].queries);
+        }
+        free(timer);
+    }
+}
+
+#else // ifndef GLES
+
+#include "gpu_timer.h"
+
+gpu_timer_t *gpu_timer_init(void) { return NULL; }
+void gpu_timer_begin(gpu_timer_t *timer, const char *name) {}
+void gpu_timer_end(gpu_timer_t *timer) {}
+void gpu_timer_frame(gpu_timer_t *timer) {}
+void gpu_timer_log(gpu_timer_t *timer) {}
+void gpu_timer_deinit(gpu_timer_t *timer) {}
+
+#endif // ifndef GLES
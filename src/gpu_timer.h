@@ -0,0 +1,14 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+// Forward declaration so that implementation remains opaque
+typedef struct gpu_timer_t_ gpu_timer_t;
+
+gpu_timer_t *gpu_timer_init(void);
+void gpu_timer_begin(gpu_timer_t *timer, const char *name);
+void gpu_timer_end(gpu_timer_t *timer);
+void gpu_timer_frame(gpu_timer_t *timer);
+void gpu_timer_log(gpu_timer_t *timer);
+void gpu_timer_deinit(gpu_timer_t *timer);
+
+#endif
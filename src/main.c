@@ -1,15 +1,16 @@
 #include "config.h"
+#include "cpu_renderer.h"
 #include "demo.h"
+#include "exporter.h"
 #include "gl.h"
 #include "music_player.h"
+#include "task.h"
+#include "trace.h"
 #include <SDL2/SDL.h>
+#include <stdio.h>
+#include <string.h>
 #include <sync.h>
 
-// The surrounding () parentheses are actually important!
-// Without them, the expression could be changed by it's surroundings
-// after the macro is "inlined" in the preprocessor.
-#define ROW_RATE ((BEATS_PER_MINUTE / 60.) * ROWS_PER_BEAT)
-
 // The following functions and sync_cb struct are used to glue rocket to
 // our music player.
 #ifdef DEBUG
@@ -36,15 +37,19 @@ static struct sync_cb rocket_callbacks = {
 #endif
 
 // This handles SDL2 events. Returns 1 to "keep running" or 0 to "stop"/exit.
+// demo is NULL when rendering with the CPU renderer.
 static int poll_events(demo_t *demo, struct sync_device *rocket) {
     static SDL_Event e;
+    TRACE_BEGIN("poll_events");
 
     // Get SDL events, such as keyboard presses or quit-signals
     while (SDL_PollEvent(&e)) {
         if (e.type == SDL_QUIT) {
+            TRACE_END();
             return 0;
         } else if (e.type == SDL_KEYDOWN) {
             if (e.key.keysym.sym == SDLK_ESCAPE || e.key.keysym.sym == SDLK_q) {
+                TRACE_END();
                 return 0;
             }
 #ifdef DEBUG
@@ -52,13 +57,20 @@ static int poll_events(demo_t *demo, struct sync_device *rocket) {
                 sync_save_tracks(rocket);
                 SDL_Log("Tracks saved.\n");
             }
-            if (e.key.keysym.sym == SDLK_r) {
+            if (e.key.keysym.sym == SDLK_r && demo) {
                 demo_reload(demo);
                 SDL_Log("Shaders reloaded.\n");
             }
+            if (e.key.keysym.sym == SDLK_c && demo) {
+                demo_toggle_compute(demo);
+            }
 #endif
         } else if (e.type == SDL_WINDOWEVENT) {
-            if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            // Exposing the window also redraws it, because frames get
+            // skipped while paused (see demo_skip_frame)
+            if ((e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED ||
+                 e.window.event == SDL_WINDOWEVENT_EXPOSED) &&
+                demo) {
                 int w, h;
                 SDL_Window *window = SDL_GetWindowFromID(e.window.windowID);
                 SDL_GL_GetDrawableSize(window, &w, &h);
@@ -67,6 +79,7 @@ static int poll_events(demo_t *demo, struct sync_device *rocket) {
         }
     }
 
+    TRACE_END();
     return 1;
 }
 
@@ -87,13 +100,149 @@ static int connect_rocket(struct sync_device *rocket, demo_t *demo) {
 }
 #endif
 
+// Logs how long a phase of startup took since the previous call, and the
+// total time since the first call. The first call (with NULL) only starts
+// the clock.
+static void log_startup(const char *phase) {
+    static uint64_t start, prev;
+    uint64_t now = SDL_GetPerformanceCounter();
+    double ms = SDL_GetPerformanceFrequency() / 1000.;
+    if (phase) {
+        SDL_Log("Startup: %s took %.1f ms, %.1f ms since start\n", phase,
+                (now - prev) / ms, (now - start) / ms);
+    } else {
+        start = now;
+    }
+    prev = now;
+}
+
+// Opens the music file and the audio device on a task thread
+static void *load_music(void *filename) {
+    return music_player_init((const char *)filename);
+}
+
+// Renders the whole demo frame by frame at EXPORT_FPS, as fast as the GPU can,
+// and writes it to export.y4m and export.wav. Returns 1 when successful, 0
+// when unsuccessful.
+static int export_demo(demo_t *demo, struct sync_device *rocket,
+                       SDL_Window *window) {
+    double length = export_wav("data/music.ogg", "export.wav");
+    if (length < 0.) {
+        return 0;
+    }
+
+    exporter_t *exporter = exporter_init("export.y4m", demo, EXPORT_FPS);
+    if (!exporter) {
+        return 0;
+    }
+
+    // Don't wait for vsync, the window only shows the progress
+    SDL_GL_SetSwapInterval(0);
+    // Frames must not depend on how fast things load
+    demo_finish_loading(demo);
+
+    for (uint64_t frame = 0; poll_events(demo, rocket); frame++) {
+        double time = (double)frame / EXPORT_FPS;
+        if (time >= length) {
+            break;
+        }
+        demo_render(demo, rocket, time * ROW_RATE);
+        if (!exporter_capture(exporter, demo)) {
+            exporter_deinit(exporter);
+            return 0;
+        }
+        TRACE_BEGIN("SDL_GL_SwapWindow");
+        SDL_GL_SwapWindow(window);
+        TRACE_END();
+    }
+
+    exporter_deinit(exporter);
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
+    // Run with --cpu to render with cpu_renderer.c instead of OpenGL, for
+    // example on machines without a GPU
+    int use_cpu = 0;
+    // Run with --export to render every frame to export.y4m and the music to
+    // export.wav instead of playing the demo in real time
+    int export = 0;
+    // Run with --poster WIDTHxHEIGHT[@SECONDS] to render one frame in tiles
+    // to poster.ppm, at any resolution
+    int poster_width = 0, poster_height = 0;
+    double poster_time = 0.;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu") == 0) {
+            use_cpu = 1;
+        }
+        if (strcmp(argv[i], "--export") == 0) {
+            export = 1;
+        }
+        if (strcmp(argv[i], "--poster") == 0) {
+            if (i + 1 >= argc ||
+                sscanf(argv[i + 1], "%dx%d@%lf", &poster_width, &poster_height,
+                       &poster_time) < 2 ||
+                poster_width <= 0 || poster_height <= 0) {
+                SDL_Log("Usage: --poster WIDTHxHEIGHT[@SECONDS]\n");
+                return 1;
+            }
+            i++;
+        }
+    }
+    int poster = poster_width > 0;
+
+    // Run with --trace, or set DEMO_TRACE to a filename, to record where CPU
+    // time goes (see trace.c)
+    const char *trace_filename = SDL_getenv("DEMO_TRACE");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            trace_filename = "trace.json";
+        }
+    }
+    trace_init(trace_filename);
+#ifdef SELF_CONTAINED
+    // File writes don't work when stdio is wrapped to embedded data
+    if (export || poster) {
+        SDL_Log("--export and --poster are not available in self-contained "
+                "builds\n");
+        return 1;
+    }
+#endif
+#ifndef SYNC_PLAYER
+    // Debug builds' rocket only gets the tracks from a connected editor, so
+    // without it every track would be 0
+    if (export || poster) {
+        SDL_Log("--export and --poster need a release build (make DEBUG=0), "
+                "which reads the saved tracks\n");
+        return 1;
+    }
+#endif
+    if ((export || poster) && use_cpu) {
+        SDL_Log("--export and --poster only work with OpenGL rendering\n");
+        return 1;
+    }
+
+    log_startup(NULL);
+
     // Initialize SDL
     // This is required to get OpenGL and audio to work
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
         SDL_Log("SDL2 failed to initialize: %s\n", SDL_GetError());
         return 1;
     }
+    log_startup("SDL_Init");
+
+    // Start loading the music and the demo's data on other threads, while
+    // this thread creates the window and the OpenGL context (see task.c).
+    // demo_init makes no OpenGL calls yet.
+    task_t *music_task = task_start("music", load_music, "data/music.ogg");
+    demo_t *demo = NULL;
+    if (!use_cpu) {
+        demo = demo_init(WIDTH * RESOLUTION_SCALE, HEIGHT * RESOLUTION_SCALE);
+        if (!demo) {
+            return 1;
+        }
+    }
 
     // Set OpenGL version (ES 3.1 when GLES configured in make)
 #ifdef GLES
@@ -101,8 +250,9 @@ int main(int argc, char *argv[]) {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
 #else
-    // Set OpenGL version (3.3 core is the default)
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    // Set OpenGL version (4.3 core for compute shaders, falls back to 3.3
+    // core below)
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
                         SDL_GL_CONTEXT_PROFILE_CORE);
@@ -116,47 +266,70 @@ int main(int argc, char *argv[]) {
     // Create a window
     // This is what the demo gets rendered to.
     int w = WIDTH, h = HEIGHT;
-    SDL_Window *window =
-        SDL_CreateWindow("demo", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                         w, h, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+    SDL_Window *window = SDL_CreateWindow(
+        "demo", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, w, h,
+        (use_cpu ? 0 : SDL_WINDOW_OPENGL) | SDL_WINDOW_RESIZABLE);
     if (!window) {
         SDL_Log("SDL2 failed to initialize a window: %s\n", SDL_GetError());
         return 1;
     }
 
-    // Get an OpenGL context
-    // This is needed to connect the OpenGL driver to the window we just created
-    SDL_GLContext gl_context = SDL_GL_CreateContext(window);
-    if (!gl_context) {
-        SDL_Log("SDL2 failed to create an OpenGL context: %s\n",
-                SDL_GetError());
-        return 1;
-    }
+    if (!use_cpu) {
+        // Get an OpenGL context
+        // This is needed to connect the OpenGL driver to the window we just
+        // created
+        SDL_GLContext gl_context = SDL_GL_CreateContext(window);
+#ifndef GLES
+        // Without OpenGL 4.3, the demo runs its bloom and post passes as
+        // fragment shaders instead of compute shaders (see demo.c)
+        if (!gl_context) {
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+            gl_context = SDL_GL_CreateContext(window);
+        }
+#endif
+        if (!gl_context) {
+            SDL_Log("SDL2 failed to create an OpenGL context: %s\n",
+                    SDL_GetError());
+            return 1;
+        }
 
 #ifdef __MINGW64__
-    // On windows, we need to actually load/"wrangle" some OpenGL functions
-    // at runtime. We use glew for that, because it's a hassle without using
-    // a library.
-    glewExperimental = GL_TRUE;
-    GLenum err = glewInit();
-    if (err != GLEW_OK) {
-        SDL_Log("glew initialization failed.\n %s\n", glewGetErrorString(err));
-        return 1;
-    }
+        // On windows, we need to actually load/"wrangle" some OpenGL
+        // functions at runtime. We use glew for that, because it's a hassle
+        // without using a library.
+        glewExperimental = GL_TRUE;
+        GLenum err = glewInit();
+        if (err != GLEW_OK) {
+            SDL_Log("glew initialization failed.\n %s\n",
+                    glewGetErrorString(err));
+            return 1;
+        }
 #endif
+    }
+    log_startup("window and OpenGL context");
 
-    // Initialize music player
-    music_player_t *player = music_player_init("data/music.ogg");
-    if (!player) {
+    // Finish initializing demo rendering, either OpenGL or CPU.
+    // OpenGL objects get created as soon as the data for them has loaded.
+    cpu_renderer_t *cpu_renderer = NULL;
+    if (use_cpu) {
+        cpu_renderer =
+            cpu_renderer_init(WIDTH * RESOLUTION_SCALE / CPU_DIVISOR,
+                              HEIGHT * RESOLUTION_SCALE / CPU_DIVISOR);
+        if (!cpu_renderer) {
+            return 1;
+        }
+    } else if (!demo_init_gl(demo)) {
         return 1;
     }
+    log_startup("demo initialization");
 
-    // Initialize demo rendering
-    demo_t *demo =
-        demo_init(WIDTH * RESOLUTION_SCALE, HEIGHT * RESOLUTION_SCALE);
-    if (!demo) {
+    // Initialize music player
+    music_player_t *player = task_wait(music_task);
+    if (!player) {
         return 1;
     }
+    log_startup("music player");
 
 #ifndef DEBUG
     // Put window in fullscreen when building a non-debug build
@@ -165,8 +338,11 @@ int main(int argc, char *argv[]) {
 #endif
 
     // Resize demo to fit the window we actually got
-    SDL_GL_GetDrawableSize(window, &w, &h);
-    demo_resize(demo, w, h);
+    // (the CPU renderer fits its image to the window surface every frame)
+    if (demo) {
+        SDL_GL_GetDrawableSize(window, &w, &h);
+        demo_resize(demo, w, h);
+    }
 
     // Initialize rocket
     struct sync_device *rocket = sync_create_device("data/sync");
@@ -174,12 +350,30 @@ int main(int argc, char *argv[]) {
         SDL_Log("Rocket initialization failed\n");
         return 1;
     }
+    log_startup("rocket");
+
+    if (export || poster) {
+        // Exporting uses the saved tracks (or the baked ones), which release
+        // builds' rocket player reads
+        int ok = poster ? demo_render_tiled(demo, rocket,
+                                            poster_time * ROW_RATE,
+                                            poster_width, poster_height,
+                                            "poster.ppm")
+                        : export_demo(demo, rocket, window);
+        sync_destroy_device(rocket);
+        demo_deinit(demo);
+        music_player_deinit(player);
+        trace_deinit();
+        SDL_Quit();
+        return ok ? 0 : 1;
+    }
 
 #ifdef DEBUG
     // Connect rocket
     if (!connect_rocket(rocket, demo)) {
         return 0;
     }
+    log_startup("waiting for Rocket editor");
 
     // Set up framerate counting
     uint64_t frames = 0;
@@ -190,6 +384,7 @@ int main(int argc, char *argv[]) {
 
     // Here starts the demo's main loop
     player_pause(player, 0);
+    int first_frame = 1;
     while (poll_events(demo, rocket)) {
         // Get time from music player
         double time = player_get_time(player);
@@ -200,7 +395,10 @@ int main(int argc, char *argv[]) {
         // This can cause a net delay up to n * m milliseconds, where
         // n = 10 (hardcoded loop) and m = 20 (hardcoded SDL_Delay call).
         // Total 200 ms may be blocked to save power when nothing is changing
-        // in the editor.
+        // in the editor. While paused, a frame which would look the same as
+        // the previous one doesn't get rendered at all (see demo_skip_frame).
+        TRACE_BEGIN("sync_update");
+        int skip = 0;
         for (int i = 0; i < 10; i++) {
             if (sync_update(rocket, (int)rocket_row, &rocket_callbacks,
                             (void *)player)) {
@@ -213,11 +411,19 @@ int main(int argc, char *argv[]) {
             // After previous update, if player time has changed (due to seek
             // or unpause), don't continue delaying, go render.
             if (player_is_playing(player) || player_get_time(player) != time) {
+                skip = 0;
+                break;
+            }
+            // Go render if tracks or shaders changed, or if the paused frame
+            // still gets refined
+            skip = demo && demo_skip_frame(demo, rocket, rocket_row);
+            if (!skip) {
                 break;
             }
             // Delay
             SDL_Delay(20);
         }
+        TRACE_END();
 
         // Print FPS reading every so often
         uint64_t ct = SDL_GetTicks64();
@@ -228,10 +434,17 @@ int main(int argc, char *argv[]) {
             SDL_Log("FPS: %.1f, max frametime: %lu ms\n",
                     frames * 1000. / (double)(ct - frame_check_time),
                     max_frame_time);
+            if (demo) {
+                demo_log_timings(demo);
+            }
             frames = 0;
             max_frame_time = 0;
             frame_check_time = ct;
         }
+
+        if (skip) {
+            continue;
+        }
         frames++;
 #else
         // Quit the demo when music ends
@@ -240,11 +453,27 @@ int main(int argc, char *argv[]) {
         }
 #endif
 
-        // Render. This does draw calls.
-        demo_render(demo, rocket, rocket_row);
+        if (cpu_renderer) {
+            // Render on the CPU straight into the window
+            TRACE_BEGIN("cpu_renderer_render");
+            cpu_renderer_render(cpu_renderer, rocket, rocket_row,
+                                SDL_GetWindowSurface(window));
+            SDL_UpdateWindowSurface(window);
+            TRACE_END();
+        } else {
+            // Render. This does draw calls.
+            demo_render(demo, rocket, rocket_row);
 
-        // Swap the render result to window, so that it becomes visible
-        SDL_GL_SwapWindow(window);
+            // Swap the render result to window, so that it becomes visible
+            TRACE_BEGIN("SDL_GL_SwapWindow");
+            SDL_GL_SwapWindow(window);
+            TRACE_END();
+        }
+
+        if (first_frame) {
+            log_startup("first frame");
+            first_frame = 0;
+        }
     }
 
 #ifdef DEBUG
@@ -253,7 +482,9 @@ int main(int argc, char *argv[]) {
 #endif
 
     demo_deinit(demo);
+    cpu_renderer_deinit(cpu_renderer);
     music_player_deinit(player);
+    trace_deinit();
     SDL_Quit();
     return 0;
 }
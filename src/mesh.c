@@ -1,2 +1,830 @@
+// Loads the meshes of a glTF file (.gltf or .glb) to draw them along with the
+// raymarched scene. All meshes get packed into one arena: one buffer of
+// interleaved, quantized vertices and one buffer of indices. Every node which
+// uses a mesh becomes an instance of it, and all instances of a mesh get
+// drawn with one instanced draw call.
+//
+// Before packing, each mesh's triangles get reordered for the GPU's
+// post-transform vertex cache with Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation", then groups of them get sorted so that triangles facing
+// outwards are drawn first, which reduces overdraw, and finally the vertices
+// get reordered to the order in which the triangles use them.
+
 #define CGLTF_IMPLEMENTATION
 #include "cgltf.h"
+#include "filesystem.h"
+#include "gl.h"
+#include "gl_state.h"
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Vertex cache size which the optimisation targets
+#define CACHE_SIZE 32
+// FIFO cache size for reporting the results, smaller than in most GPUs
+#define FIFO_SIZE 16
+// Triangles per group when sorting to reduce overdraw. Smaller groups reduce
+// more overdraw but lose more of the vertex cache optimisation.
+#define CLUSTER_TRIANGLES 64
+#define NO_TRIANGLE SIZE_MAX
+
+// Quantized vertex, 12 bytes instead of 24 as floats. The position is in the
+// mesh's bounding cube (-32767..32767 is -1..1), and the instance's matrix
+// scales it back. The fourth components only pad the vertex to 4 byte
+// alignment.
+typedef struct {
+    int16_t position[4];
+    int8_t normal[4];
+} vertex_t;
+
+// One glTF mesh's indices and instances in the arena
+typedef struct {
+    size_t first_index;
+    size_t index_count;
+    size_t first_instance;
+    size_t instance_count;
+} range_t;
+
+typedef struct {
+    range_t *ranges;
+    size_t range_count;
+    // The arena on the CPU side, freed by mesh_upload. Indices already point
+    // to the mesh's vertices in the whole arena.
+    vertex_t *vertices;
+    size_t vertex_count;
+    uint32_t *indices;
+    size_t index_count;
+    // Column-major 4x4 matrices, from quantized positions to world space
+    float *instances;
+    size_t instance_count;
+    // GL objects: VAO, and the vertex, index and instance buffers
+    GLuint vao;
+    GLuint buffers[3];
+    GLenum index_type;
+} mesh_t;
+
+// One glTF mesh as floats, while it gets optimised
+typedef struct {
+    float *positions;
+    float *normals;
+    size_t vertex_count;
+    uint32_t *indices;
+    size_t index_count;
+} geometry_t;
+
+void mesh_deinit(mesh_t *mesh);
+
+// Reads the triangles of a glTF mesh's primitives into one geometry_t.
+// Primitives which aren't triangles are skipped. Missing normals get computed
+// from the triangles. Returns 1 when successful, 0 when unsuccessful.
+static int read_geometry(const cgltf_mesh *gltf_mesh, geometry_t *geometry) {
+    *geometry = (geometry_t){0};
+    size_t vertex_count = 0, index_count = 0;
+    for (size_t i = 0; i < gltf_mesh->primitives_count; i++) {
+        const cgltf_primitive *primitive = gltf_mesh->primitives + i;
+        for (size_t j = 0; j < primitive->attributes_count; j++) {
+            const cgltf_attribute *attribute = primitive->attributes + j;
+            if (primitive->type == cgltf_primitive_type_triangles &&
+                attribute->type == cgltf_attribute_type_position) {
+                vertex_count += attribute->data->count;
+                index_count += primitive->indices ? primitive->indices->count
+                                                  : attribute->data->count;
+            }
+        }
+    }
+
+    geometry->positions = malloc(sizeof(float) * 3 * vertex_count + 1);
+    geometry->normals = calloc(vertex_count * 3 + 1, sizeof(float));
+    geometry->indices = malloc(sizeof(uint32_t) * index_count + 1);
+    if (!geometry->positions || !geometry->normals || !geometry->indices) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < gltf_mesh->primitives_count; i++) {
+        const cgltf_primitive *primitive = gltf_mesh->primitives + i;
+        const cgltf_accessor *positions = NULL, *normals = NULL;
+        for (size_t j = 0; j < primitive->attributes_count; j++) {
+            const cgltf_attribute *attribute = primitive->attributes + j;
+            if (attribute->type == cgltf_attribute_type_position) {
+                positions = attribute->data;
+            } else if (attribute->type == cgltf_attribute_type_normal) {
+                normals = attribute->data;
+            }
+        }
+        if (primitive->type != cgltf_primitive_type_triangles || !positions) {
+            continue;
+        }
+
+        const size_t base = geometry->vertex_count;
+        float *p = geometry->positions + base * 3;
+        float *n = geometry->normals + base * 3;
+        for (size_t v = 0; v < positions->count; v++) {
+            cgltf_accessor_read_float(positions, v, p + v * 3, 3);
+            if (normals && v < normals->count) {
+                cgltf_accessor_read_float(normals, v, n + v * 3, 3);
+            }
+        }
+        geometry->vertex_count += positions->count;
+
+        const size_t first = geometry->index_count;
+        size_t count = primitive->indices ? primitive->indices->count
+                                          : positions->count;
+        count -= count % 3;
+        const cgltf_accessor *indices = primitive->indices;
+        for (size_t k = 0; k < count; k++) {
+            size_t index = indices ? cgltf_accessor_read_index(indices, k) : k;
+            geometry->indices[first + k] = base + index;
+        }
+        geometry->index_count += count;
+
+        // Smooth normals: every vertex gets the sum of its triangles'
+        // normals, which are weighted by area because they aren't normalized
+        if (!normals) {
+            for (size_t k = first; k < first + count; k += 3) {
+                const uint32_t *t = geometry->indices + k;
+                const float *a = geometry->positions + t[0] * 3;
+                const float *b = geometry->positions + t[1] * 3;
+                const float *c = geometry->positions + t[2] * 3;
+                float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float cross[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                                  e1[2] * e2[0] - e1[0] * e2[2],
+                                  e1[0] * e2[1] - e1[1] * e2[0]};
+                for (int v = 0; v < 3; v++) {
+                    for (int axis = 0; axis < 3; axis++) {
+                        geometry->normals[t[v] * 3 + axis] += cross[axis];
+                    }
+                }
+            }
+        }
+    }
+
+    // Normalize all normals, the file's normals should already be
+    for (size_t v = 0; v < geometry->vertex_count; v++) {
+        float *n = geometry->normals + v * 3;
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int axis = 0; axis < 3; axis++) {
+            n[axis] = len > 0.f ? n[axis] / len : (axis == 1);
+        }
+    }
+
+    return 1;
+}
+
+// Forsyth's score for a vertex: vertices in the cache score higher the more
+// recently they were used, and vertices with few remaining triangles get a
+// boost, so that they get finished off and don't need to be reloaded later.
+// The three most recent vertices score a bit less, because triangles which
+// use them would mostly cover the same area again.
+static float vertex_score(int cache_position, uint32_t remaining) {
+    if (remaining == 0) {
+        return -1.f;
+    }
+    float score = 0.f;
+    if (cache_position >= 3) {
+        float s = 1.f - (cache_position - 3) / (float)(CACHE_SIZE - 3);
+        score = powf(s, 1.5f);
+    } else if (cache_position >= 0) {
+        score = .75f;
+    }
+    return score + 2.f / sqrtf(remaining);
+}
+
+// Reorders triangles so that consecutive triangles share vertices, which then
+// stay in the post-transform vertex cache. Greedily picks the next triangle
+// with the best score among the triangles of the vertices in a simulated LRU
+// cache, so it takes linear time.
+static int optimize_vertex_cache(uint32_t *indices, size_t index_count,
+                                 size_t vertex_count) {
+    const size_t triangle_count = index_count / 3;
+    // Triangles of each vertex: offsets to adjacency, and how many of them
+    // are not yet drawn (which come first in adjacency)
+    uint32_t *offsets = calloc(vertex_count + 1, sizeof(uint32_t));
+    uint32_t *remaining = calloc(vertex_count + 1, sizeof(uint32_t));
+    uint32_t *adjacency = malloc(sizeof(uint32_t) * index_count + 1);
+    int *cache_position = malloc(sizeof(int) * vertex_count + 1);
+    float *score = malloc(sizeof(float) * vertex_count + 1);
+    float *triangle_score = malloc(sizeof(float) * triangle_count + 1);
+    unsigned char *drawn = calloc(triangle_count + 1, 1);
+    uint32_t *out = malloc(sizeof(uint32_t) * index_count + 1);
+    int ok = offsets && remaining && adjacency && cache_position && score &&
+             triangle_score && drawn && out;
+
+    if (ok) {
+        for (size_t i = 0; i < index_count; i++) {
+            remaining[indices[i]]++;
+        }
+        for (size_t v = 0; v < vertex_count; v++) {
+            offsets[v + 1] = offsets[v] + remaining[v];
+            remaining[v] = 0;
+        }
+        for (size_t i = 0; i < index_count; i++) {
+            uint32_t v = indices[i];
+            adjacency[offsets[v] + remaining[v]++] = i / 3;
+        }
+        for (size_t v = 0; v < vertex_count; v++) {
+            cache_position[v] = -1;
+            score[v] = vertex_score(-1, remaining[v]);
+        }
+        for (size_t t = 0; t < triangle_count; t++) {
+            const uint32_t *tri = indices + t * 3;
+            triangle_score[t] = score[tri[0]] + score[tri[1]] + score[tri[2]];
+        }
+    }
+
+    // The cache holds up to CACHE_SIZE vertices, and 3 more while a
+    // triangle's vertices get added to it
+    uint32_t cache[CACHE_SIZE + 3];
+    size_t cache_count = 0;
+    size_t best = 0, next_unused = 0;
+    float best_score = -1.f;
+    for (size_t t = 0; ok && t < triangle_count; t++) {
+        if (triangle_score[t] > best_score) {
+            best_score = triangle_score[t];
+            best = t;
+        }
+    }
+
+    for (size_t n = 0; ok && n < triangle_count; n++) {
+        // When no triangle in the cache is left, continue from any triangle
+        if (best == NO_TRIANGLE) {
+            while (drawn[next_unused]) {
+                next_unused++;
+            }
+            best = next_unused;
+        }
+        const uint32_t *tri = indices + best * 3;
+        memcpy(out + n * 3, tri, sizeof(uint32_t) * 3);
+        drawn[best] = 1;
+
+        // Move the triangle out of its vertices' remaining triangles
+        for (int i = 0; i < 3; i++) {
+            uint32_t *list = adjacency + offsets[tri[i]];
+            uint32_t count = remaining[tri[i]];
+            for (uint32_t j = 0; j < count; j++) {
+                if (list[j] == best) {
+                    list[j] = list[count - 1];
+                    list[count - 1] = best;
+                    remaining[tri[i]]--;
+                    break;
+                }
+            }
+        }
+
+        // The triangle's vertices become the most recent in the cache
+        uint32_t updated[CACHE_SIZE + 3];
+        size_t updated_count = 0;
+        for (int i = 0; i < 3; i++) {
+            updated[updated_count++] = tri[i];
+        }
+        for (size_t i = 0; i < cache_count; i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                updated[updated_count++] = v;
+            }
+        }
+
+        // Rescore the vertices which moved in the cache or fell out of it
+        for (size_t i = 0; i < updated_count; i++) {
+            uint32_t v = updated[i];
+            cache_position[v] = i < CACHE_SIZE ? (int)i : -1;
+            score[v] = vertex_score(cache_position[v], remaining[v]);
+        }
+
+        // Rescore their remaining triangles, and pick the best one next
+        best = NO_TRIANGLE;
+        best_score = -1.f;
+        for (size_t i = 0; i < updated_count; i++) {
+            uint32_t v = updated[i];
+            for (uint32_t j = 0; j < remaining[v]; j++) {
+                uint32_t t = adjacency[offsets[v] + j];
+                const uint32_t *other = indices + t * 3;
+                triangle_score[t] =
+                    score[other[0]] + score[other[1]] + score[other[2]];
+                if (triangle_score[t] > best_score) {
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+
+        cache_count = updated_count < CACHE_SIZE ? updated_count : CACHE_SIZE;
+        memcpy(cache, updated, sizeof(uint32_t) * cache_count);
+    }
+
+    if (ok) {
+        memcpy(indices, out, sizeof(uint32_t) * index_count);
+    }
+    free(offsets);
+    free(remaining);
+    free(adjacency);
+    free(cache_position);
+    free(score);
+    free(triangle_score);
+    free(drawn);
+    free(out);
+    return ok;
+}
+
+typedef struct {
+    float key;
+    size_t cluster;
+} cluster_key_t;
+
+// Sorts by descending key
+static int compare_clusters(const void *a, const void *b) {
+    float ka = ((const cluster_key_t *)a)->key;
+    float kb = ((const cluster_key_t *)b)->key;
+    return (ka < kb) - (ka > kb);
+}
+
+// Reduces overdraw by sorting groups of CLUSTER_TRIANGLES consecutive
+// triangles (which stay in vertex cache order) so that groups on the outside
+// of the mesh, facing away from its center, get drawn first. From most
+// viewpoints they then hide the groups behind them from the depth test.
+static int optimize_overdraw(uint32_t *indices, size_t index_count,
+                             const float *positions) {
+    const size_t triangle_count = index_count / 3;
+    const size_t cluster_count =
+        (triangle_count + CLUSTER_TRIANGLES - 1) / CLUSTER_TRIANGLES;
+    cluster_key_t *keys = malloc(sizeof(cluster_key_t) * cluster_count + 1);
+    // Centroids have the cluster's area as the fourth component
+    float *centroids = calloc(cluster_count * 4 + 1, sizeof(float));
+    float *normals = calloc(cluster_count * 3 + 1, sizeof(float));
+    uint32_t *out = malloc(sizeof(uint32_t) * index_count + 1);
+    if (!keys || !centroids || !normals || !out) {
+        free(keys);
+        free(centroids);
+        free(normals);
+        free(out);
+        return 0;
+    }
+
+    // Area weighted centroids of the clusters and the whole mesh, and the
+    // clusters' area weighted normals
+    float center[3] = {0.f}, total_area = 0.f;
+    for (size_t t = 0; t < triangle_count; t++) {
+        const uint32_t *tri = indices + t * 3;
+        const float *a = positions + tri[0] * 3;
+        const float *b = positions + tri[1] * 3;
+        const float *c = positions + tri[2] * 3;
+        float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        float cross[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                          e1[2] * e2[0] - e1[0] * e2[2],
+                          e1[0] * e2[1] - e1[1] * e2[0]};
+        float area = sqrtf(cross[0] * cross[0] + cross[1] * cross[1] +
+                           cross[2] * cross[2]);
+        float *centroid = centroids + t / CLUSTER_TRIANGLES * 4;
+        float *normal = normals + t / CLUSTER_TRIANGLES * 3;
+        for (int axis = 0; axis < 3; axis++) {
+            float mid = (a[axis] + b[axis] + c[axis]) / 3.f;
+            centroid[axis] += mid * area;
+            center[axis] += mid * area;
+            normal[axis] += cross[axis];
+        }
+        centroid[3] += area;
+        total_area += area;
+    }
+
+    for (size_t i = 0; i < cluster_count; i++) {
+        const float *centroid = centroids + i * 4;
+        const float *normal = normals + i * 3;
+        float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+                          normal[2] * normal[2]);
+        float key = 0.f;
+        for (int axis = 0; axis < 3 && len > 0.f && centroid[3] > 0.f;
+             axis++) {
+            float offset = centroid[axis] / centroid[3] -
+                           center[axis] / total_area;
+            key += offset * normal[axis] / len;
+        }
+        keys[i] = (cluster_key_t){.key = key, .cluster = i};
+    }
+    qsort(keys, cluster_count, sizeof(cluster_key_t), compare_clusters);
+
+    size_t n = 0;
+    for (size_t i = 0; i < cluster_count; i++) {
+        size_t first = keys[i].cluster * CLUSTER_TRIANGLES * 3;
+        size_t last = first + CLUSTER_TRIANGLES * 3;
+        last = last < index_count ? last : index_count;
+        memcpy(out + n, indices + first, sizeof(uint32_t) * (last - first));
+        n += last - first;
+    }
+    memcpy(indices, out, sizeof(uint32_t) * index_count);
+
+    free(keys);
+    free(centroids);
+    free(normals);
+    free(out);
+    return 1;
+}
+
+// Renumbers vertices in the order in which the triangles first use them, so
+// that the vertex fetches mostly go forward in memory. Drops vertices which
+// no triangle uses. Returns 1 when successful, 0 when unsuccessful.
+static int optimize_vertex_fetch(geometry_t *geometry) {
+    uint32_t *remap = malloc(sizeof(uint32_t) * geometry->vertex_count + 1);
+    float *positions = malloc(sizeof(float) * 3 * geometry->vertex_count + 1);
+    float *normals = malloc(sizeof(float) * 3 * geometry->vertex_count + 1);
+    if (!remap || !positions || !normals) {
+        free(remap);
+        free(positions);
+        free(normals);
+        return 0;
+    }
+
+    memset(remap, 0xff, sizeof(uint32_t) * geometry->vertex_count);
+    uint32_t next = 0;
+    for (size_t i = 0; i < geometry->index_count; i++) {
+        uint32_t v = geometry->indices[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = next;
+            memcpy(positions + next * 3, geometry->positions + v * 3,
+                   sizeof(float) * 3);
+            memcpy(normals + next * 3, geometry->normals + v * 3,
+                   sizeof(float) * 3);
+            next++;
+        }
+        geometry->indices[i] = remap[v];
+    }
+
+    free(remap);
+    free(geometry->positions);
+    free(geometry->normals);
+    geometry->positions = positions;
+    geometry->normals = normals;
+    geometry->vertex_count = next;
+    return 1;
+}
+
+// Average cache miss ratio: how many vertices a FIFO vertex cache of
+// FIFO_SIZE vertices needs to transform per triangle. 3 is the worst, and
+// about 0.5 is the best for large regular meshes.
+static double cache_miss_ratio(const uint32_t *indices, size_t index_count,
+                               size_t vertex_count) {
+    // A vertex is in the cache when less than FIFO_SIZE misses have happened
+    // after it was added, timestamps start from 1
+    size_t *added = calloc(vertex_count + 1, sizeof(size_t));
+    if (!added || index_count < 3) {
+        free(added);
+        return 0.;
+    }
+    size_t misses = 0;
+    for (size_t i = 0; i < index_count; i++) {
+        uint32_t v = indices[i];
+        if (!added[v] || misses - added[v] >= FIFO_SIZE) {
+            added[v] = ++misses;
+        }
+    }
+    free(added);
+    return (double)misses / (index_count / 3);
+}
+
+static void geometry_deinit(geometry_t *geometry) {
+    free(geometry->positions);
+    free(geometry->normals);
+    free(geometry->indices);
+}
+
+// Quantizes a geometry to the end of the arena. Positions get scaled to the
+// geometry's bounding cube, and `dequantize` gets the transform back (center
+// xyz, half size). Returns 1 when successful, 0 when unsuccessful.
+static int pack_geometry(mesh_t *mesh, const geometry_t *geometry,
+                         float *dequantize) {
+    vertex_t *vertices =
+        realloc(mesh->vertices, sizeof(vertex_t) * (mesh->vertex_count +
+                                                    geometry->vertex_count));
+    if (!vertices && mesh->vertex_count + geometry->vertex_count) {
+        return 0;
+    }
+    mesh->vertices = vertices;
+    uint32_t *indices =
+        realloc(mesh->indices,
+                sizeof(uint32_t) * (mesh->index_count + geometry->index_count));
+    if (!indices && mesh->index_count + geometry->index_count) {
+        return 0;
+    }
+    mesh->indices = indices;
+
+    // A cube instead of a box keeps the scale uniform, so that normals need
+    // no correction for quantization
+    float min[3] = {INFINITY, INFINITY, INFINITY};
+    float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t v = 0; v < geometry->vertex_count; v++) {
+        for (int axis = 0; axis < 3; axis++) {
+            float p = geometry->positions[v * 3 + axis];
+            min[axis] = p < min[axis] ? p : min[axis];
+            max[axis] = p > max[axis] ? p : max[axis];
+        }
+    }
+    float extent = 0.f;
+    for (int axis = 0; axis < 3; axis++) {
+        dequantize[axis] =
+            geometry->vertex_count ? (min[axis] + max[axis]) * .5f : 0.f;
+        float half = (max[axis] - min[axis]) * .5f;
+        extent = half > extent ? half : extent;
+    }
+    dequantize[3] = extent > 0.f ? extent : 1.f;
+
+    for (size_t v = 0; v < geometry->vertex_count; v++) {
+        vertex_t *dst = mesh->vertices + mesh->vertex_count + v;
+        for (int axis = 0; axis < 3; axis++) {
+            float p = (geometry->positions[v * 3 + axis] - dequantize[axis]) /
+                      dequantize[3];
+            dst->position[axis] = (int16_t)lrintf(p * 32767.f);
+            dst->normal[axis] =
+                (int8_t)lrintf(geometry->normals[v * 3 + axis] * 127.f);
+        }
+        dst->position[3] = 0;
+        dst->normal[3] = 0;
+    }
+    for (size_t i = 0; i < geometry->index_count; i++) {
+        mesh->indices[mesh->index_count + i] =
+            mesh->vertex_count + geometry->indices[i];
+    }
+    mesh->vertex_count += geometry->vertex_count;
+    mesh->index_count += geometry->index_count;
+    return 1;
+}
+
+// Loads all meshes of a glTF file, and optimises them for drawing. This makes
+// no OpenGL calls, so it can run on any thread, see mesh_upload. Returns NULL
+// if the file can't be loaded or has no triangles.
+mesh_t *mesh_load(const char *filename) {
+    // The meshes are optional, so a missing file isn't worth a log line
+    FILE *exists = fopen(filename, "rb");
+    if (!exists) {
+        return NULL;
+    }
+    fclose(exists);
+
+    size_t len = 0;
+    const void *file = map_file(filename, &len);
+    if (!file) {
+        return NULL;
+    }
+
+    // .glb buffers point into the file, so it stays mapped until the end.
+    // .gltf files' other buffers get loaded relative to the file's path.
+    cgltf_options options = {0};
+    cgltf_data *data = NULL;
+    if (cgltf_parse(&options, file, len, &data) != cgltf_result_success ||
+        cgltf_load_buffers(&options, data, filename) != cgltf_result_success ||
+        cgltf_validate(data) != cgltf_result_success) {
+        SDL_Log("Failed to load glTF file %s\n", filename);
+        cgltf_free(data);
+        unmap_file(file);
+        return NULL;
+    }
+
+    mesh_t *mesh = calloc(1, sizeof(mesh_t));
+    if (!mesh) {
+        cgltf_free(data);
+        unmap_file(file);
+        return NULL;
+    }
+    mesh->range_count = data->meshes_count;
+    mesh->ranges = calloc(data->meshes_count + 1, sizeof(range_t));
+    // Dequantization transform of every mesh, see pack_geometry
+    float *dequantize = calloc(data->meshes_count * 4 + 1, sizeof(float));
+    int ok = mesh->ranges && dequantize;
+
+    // Instances are grouped by mesh
+    for (size_t i = 0; ok && i < data->nodes_count; i++) {
+        if (data->nodes[i].mesh) {
+            mesh->ranges[data->nodes[i].mesh - data->meshes].instance_count++;
+            mesh->instance_count++;
+        }
+    }
+    for (size_t i = 1; ok && i < mesh->range_count; i++) {
+        const range_t *prev = mesh->ranges + i - 1;
+        mesh->ranges[i].first_instance =
+            prev->first_instance + prev->instance_count;
+    }
+    mesh->instances = malloc(sizeof(float) * 16 * mesh->instance_count + 1);
+    ok = ok && mesh->instances;
+
+    size_t float_bytes = 0;
+    double miss_ratio[2] = {0., 0.};
+    for (size_t i = 0; ok && i < data->meshes_count; i++) {
+        geometry_t geometry;
+        ok = read_geometry(data->meshes + i, &geometry);
+        if (ok && geometry.index_count) {
+            // Weighted by triangles for the average over all meshes
+            miss_ratio[0] += cache_miss_ratio(geometry.indices,
+                                              geometry.index_count,
+                                              geometry.vertex_count) *
+                             geometry.index_count;
+            ok = optimize_vertex_cache(geometry.indices, geometry.index_count,
+                                       geometry.vertex_count) &&
+                 optimize_overdraw(geometry.indices, geometry.index_count,
+                                   geometry.positions) &&
+                 optimize_vertex_fetch(&geometry);
+            miss_ratio[1] += cache_miss_ratio(geometry.indices,
+                                              geometry.index_count,
+                                              geometry.vertex_count) *
+                             geometry.index_count;
+        }
+        // Floats for the position and normal, and 32-bit indices
+        float_bytes += geometry.vertex_count * sizeof(float) * 6 +
+                       geometry.index_count * sizeof(uint32_t);
+        mesh->ranges[i].first_index = mesh->index_count;
+        mesh->ranges[i].index_count = geometry.index_count;
+        ok = ok && pack_geometry(mesh, &geometry, dequantize + i * 4);
+        geometry_deinit(&geometry);
+    }
+
+    // Every node's world matrix, multiplied by its mesh's dequantization
+    // transform (translation and uniform scale), which is simple because
+    // the matrices are column-major
+    size_t *written = calloc(mesh->range_count + 1, sizeof(size_t));
+    ok = ok && written;
+    for (size_t i = 0; ok && i < data->nodes_count; i++) {
+        const cgltf_node *node = data->nodes + i;
+        if (!node->mesh) {
+            continue;
+        }
+        size_t index = node->mesh - data->meshes;
+        const range_t *range = mesh->ranges + index;
+        const float *dq = dequantize + index * 4;
+        float *m = mesh->instances + (range->first_instance + written[index]) *
+                                         16;
+        written[index]++;
+        cgltf_node_transform_world(node, m);
+        for (int row = 0; row < 4; row++) {
+            m[12 + row] +=
+                m[row] * dq[0] + m[4 + row] * dq[1] + m[8 + row] * dq[2];
+        }
+        for (int j = 0; j < 12; j++) {
+            m[j] *= dq[3];
+        }
+    }
+    free(written);
+    free(dequantize);
+    cgltf_free(data);
+    unmap_file(file);
+
+    if (!ok || mesh->index_count == 0) {
+        if (ok) {
+            SDL_Log("No triangles in %s\n", filename);
+        }
+        mesh_deinit(mesh);
+        return NULL;
+    }
+
+    const size_t triangles = mesh->index_count / 3;
+    const size_t index_bytes =
+        mesh->index_count * (mesh->vertex_count > 65536 ? 4 : 2);
+    SDL_Log("%s: %zu meshes, %zu instances, %zu vertices, %zu triangles\n",
+            filename, mesh->range_count, mesh->instance_count,
+            mesh->vertex_count, triangles);
+    SDL_Log("Mesh memory %.1f KiB (%.1f KiB as floats), cache misses per "
+            "triangle %.2f -> %.2f\n",
+            (mesh->vertex_count * sizeof(vertex_t) + index_bytes) / 1024.,
+            float_bytes / 1024., miss_ratio[0] / mesh->index_count,
+            miss_ratio[1] / mesh->index_count);
+    return mesh;
+}
+
+// Returns every instance's triangles in world space, 9 floats (three
+// vertices) each, and sets *count to the number of triangles. Only works
+// before mesh_upload, which frees the arena. Returns NULL if it fails. The
+// caller should free the array.
+float *mesh_triangles(const mesh_t *mesh, size_t *count) {
+    *count = 0;
+    if (!mesh->vertices) {
+        return NULL;
+    }
+    for (size_t i = 0; i < mesh->range_count; i++) {
+        *count += mesh->ranges[i].index_count / 3 *
+                  mesh->ranges[i].instance_count;
+    }
+    float *triangles = malloc(sizeof(float) * 9 * *count + 1);
+    if (!triangles) {
+        return NULL;
+    }
+
+    float *dst = triangles;
+    for (size_t i = 0; i < mesh->range_count; i++) {
+        const range_t *range = mesh->ranges + i;
+        for (size_t j = 0; j < range->instance_count; j++) {
+            const float *m = mesh->instances + (range->first_instance + j) * 16;
+            for (size_t k = 0; k < range->index_count; k++) {
+                const vertex_t *v =
+                    mesh->vertices + mesh->indices[range->first_index + k];
+                float p[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    p[axis] = v->position[axis] / 32767.f;
+                }
+                for (int row = 0; row < 3; row++) {
+                    *dst++ = m[row] * p[0] + m[4 + row] * p[1] +
+                             m[8 + row] * p[2] + m[12 + row];
+                }
+            }
+        }
+    }
+    return triangles;
+}
+
+// Creates the mesh's buffers, and frees its CPU side arena. Needs the OpenGL
+// context. Returns 1 when successful, 0 when unsuccessful.
+int mesh_upload(mesh_t *mesh) {
+    // 16-bit indices are enough for most scenes, and take half the memory
+    // and bandwidth
+    mesh->index_type = GL_UNSIGNED_INT;
+    size_t index_size = sizeof(uint32_t);
+    if (mesh->vertex_count <= 65536) {
+        uint16_t *indices = (uint16_t *)mesh->indices;
+        for (size_t i = 0; i < mesh->index_count; i++) {
+            indices[i] = mesh->indices[i];
+        }
+        mesh->index_type = GL_UNSIGNED_SHORT;
+        index_size = sizeof(uint16_t);
+    }
+
+    glGenVertexArrays(1, &mesh->vao);
+    gl_bind_vertex_array(mesh->vao);
+    glGenBuffers(3, mesh->buffers);
+
+    // Positions and normals get converted back to -1..1 floats when read
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * mesh->vertex_count,
+                 mesh->vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(vertex_t),
+                          (void *)offsetof(vertex_t, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_BYTE, GL_TRUE, sizeof(vertex_t),
+                          (void *)offsetof(vertex_t, normal));
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_size * mesh->index_count,
+                 mesh->indices, GL_STATIC_DRAW);
+
+    // The instance matrix takes four attribute locations, one per column.
+    // mesh_draw points them to each mesh's instances.
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[2]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 16 * mesh->instance_count,
+                 mesh->instances, GL_STATIC_DRAW);
+    for (GLuint i = 0; i < 4; i++) {
+        glEnableVertexAttribArray(2 + i);
+        glVertexAttribDivisor(2 + i, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->instances);
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+    mesh->instances = NULL;
+    return 1;
+}
+
+// Draws every mesh's instances, one draw call per mesh. The caller binds the
+// program and framebuffer. Base vertex and base instance need newer OpenGL
+// than GL ES 3.1 has, so indices point to the whole arena and the instance
+// attributes get moved to each mesh's instances instead.
+void mesh_draw(const mesh_t *mesh) {
+    const size_t index_size = mesh->index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+    gl_bind_vertex_array(mesh->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[2]);
+    for (size_t i = 0; i < mesh->range_count; i++) {
+        const range_t *range = mesh->ranges + i;
+        if (!range->instance_count || !range->index_count) {
+            continue;
+        }
+        for (GLuint column = 0; column < 4; column++) {
+            size_t offset = (range->first_instance * 16 + column * 4) *
+                            sizeof(float);
+            glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE,
+                                  sizeof(float) * 16, (void *)offset);
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, range->index_count,
+                                mesh->index_type,
+                                (void *)(range->first_index * index_size),
+                                range->instance_count);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void mesh_deinit(mesh_t *mesh) {
+    if (mesh) {
+        if (mesh->vao) {
+            glDeleteVertexArrays(1, &mesh->vao);
+            glDeleteBuffers(3, mesh->buffers);
+            // New objects may get the deleted ones' names
+            gl_state_invalidate();
+        }
+        free(mesh->ranges);
+        free(mesh->vertices);
+        free(mesh->indices);
+        free(mesh->instances);
+        free(mesh);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stddef.h>
+
+// Forward declaration so that implementation remains opaque
+typedef struct mesh_t_ mesh_t;
+
+mesh_t *mesh_load(const char *filename);
+float *mesh_triangles(const mesh_t *mesh, size_t *count);
+int mesh_upload(mesh_t *mesh);
+void mesh_draw(const mesh_t *mesh);
+void mesh_deinit(mesh_t *mesh);
+
+#endif
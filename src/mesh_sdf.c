@@ -0,0 +1,480 @@
+// Bakes triangle meshes into signed distance fields, which the raymarcher
+// samples from a 3D texture with sdTexture (shaders/sdf.glsl). This way
+// meshes get shadows, reflections and blending with opUnion like any other
+// SDF, at the cost of one texture fetch per march step.
+//
+// Every voxel gets the distance to the closest triangle, found through a
+// bounding volume hierarchy (BVH). The sign comes from ray parity: a point
+// is inside when a ray from it crosses the surface an odd number of times.
+// One ray per row of voxels gives the signs of the whole row, so rows along
+// X and Y vote, and a ray along Z breaks ties, which tolerates small holes in
+// the mesh. Slices of the volume get baked in parallel on the thread pool.
+//
+// Baking takes a while for large meshes, so the result is cached in a file
+// along with a hash of the triangles and the resolution, and gets baked
+// again only when either changes. Self-contained builds embed the cache
+// file, so releases don't bake at all.
+
+#include "filesystem.h"
+#include "thread_pool.h"
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Most triangles in a BVH leaf, and the most levels in the BVH. Deeper
+// nodes become leaves regardless of their triangle count.
+#define LEAF_SIZE 4
+#define MAX_DEPTH 48
+// Empty voxels around the mesh, so that the surface doesn't touch the
+// texture's border
+#define PADDING 2
+// Most surface crossings counted along one ray
+#define MAX_HITS 256
+#define CACHE_MAGIC "SDF1"
+
+typedef struct {
+    float min[3], max[3];
+    // Leaves have the first triangle and count. Inner nodes have count 0
+    // and the first of their two consecutive children.
+    uint32_t first, count;
+} node_t;
+
+// Data shared with every bake_slice call
+typedef struct {
+    // 9 floats (three vertices) per triangle, in the BVH's leaf order
+    float *triangles;
+    node_t *nodes;
+    size_t node_count;
+    int size;
+    // Center and half size of the baked cube
+    float bounds[4];
+    float *out;
+} bake_t;
+
+typedef struct {
+    char magic[4];
+    int32_t size;
+    uint64_t hash;
+    float bounds[4];
+} cache_header_t;
+
+static float dot3(const float *a, const float *b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void sub3(float *dst, const float *a, const float *b) {
+    for (int i = 0; i < 3; i++) {
+        dst[i] = a[i] - b[i];
+    }
+}
+
+static float distance_sq(const float *a, const float *b) {
+    float d[3];
+    sub3(d, a, b);
+    return dot3(d, d);
+}
+
+// Squared distance from p to the closest point of a triangle, from Christer
+// Ericson's Real-Time Collision Detection: finds the Voronoi region of the
+// triangle's vertices, edges or face which contains p
+static float triangle_distance_sq(const float *p, const float *tri) {
+    const float *a = tri, *b = tri + 3, *c = tri + 6;
+    float ab[3], ac[3], ap[3], bp[3], cp[3], q[3];
+    sub3(ab, b, a);
+    sub3(ac, c, a);
+    sub3(ap, p, a);
+    float d1 = dot3(ab, ap), d2 = dot3(ac, ap);
+    if (d1 <= 0.f && d2 <= 0.f) {
+        return distance_sq(p, a);
+    }
+    sub3(bp, p, b);
+    float d3 = dot3(ab, bp), d4 = dot3(ac, bp);
+    if (d3 >= 0.f && d4 <= d3) {
+        return distance_sq(p, b);
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+        float v = d1 / (d1 - d3);
+        for (int i = 0; i < 3; i++) {
+            q[i] = a[i] + ab[i] * v;
+        }
+        return distance_sq(p, q);
+    }
+    sub3(cp, p, c);
+    float d5 = dot3(ab, cp), d6 = dot3(ac, cp);
+    if (d6 >= 0.f && d5 <= d6) {
+        return distance_sq(p, c);
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+        float w = d2 / (d2 - d6);
+        for (int i = 0; i < 3; i++) {
+            q[i] = a[i] + ac[i] * w;
+        }
+        return distance_sq(p, q);
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f) {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        for (int i = 0; i < 3; i++) {
+            q[i] = b[i] + (c[i] - b[i]) * w;
+        }
+        return distance_sq(p, q);
+    }
+    float denom = 1.f / (va + vb + vc);
+    float v = vb * denom, w = vc * denom;
+    for (int i = 0; i < 3; i++) {
+        q[i] = a[i] + ab[i] * v + ac[i] * w;
+    }
+    return distance_sq(p, q);
+}
+
+// Squared distance from p to a node's box, 0 inside it
+static float box_distance_sq(const node_t *node, const float *p) {
+    float d = 0.f;
+    for (int i = 0; i < 3; i++) {
+        float e = fmaxf(fmaxf(node->min[i] - p[i], p[i] - node->max[i]), 0.f);
+        d += e * e;
+    }
+    return d;
+}
+
+// Builds the BVH node `index` over triangles order[first..first+count) by
+// splitting them at the middle of their centroids' longest axis
+static void build_node(bake_t *bake, uint32_t *order, const float *triangles,
+                       size_t index, uint32_t first, uint32_t count,
+                       int depth) {
+    node_t *node = bake->nodes + index;
+    float cmin[3] = {INFINITY, INFINITY, INFINITY};
+    float cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < 3; i++) {
+        node->min[i] = INFINITY;
+        node->max[i] = -INFINITY;
+    }
+    for (uint32_t i = first; i < first + count; i++) {
+        const float *tri = triangles + order[i] * 9;
+        for (int axis = 0; axis < 3; axis++) {
+            float c = (tri[axis] + tri[3 + axis] + tri[6 + axis]) / 3.f;
+            cmin[axis] = fminf(cmin[axis], c);
+            cmax[axis] = fmaxf(cmax[axis], c);
+            for (int v = 0; v < 3; v++) {
+                node->min[axis] = fminf(node->min[axis], tri[v * 3 + axis]);
+                node->max[axis] = fmaxf(node->max[axis], tri[v * 3 + axis]);
+            }
+        }
+    }
+
+    if (count <= LEAF_SIZE || depth >= MAX_DEPTH) {
+        node->first = first;
+        node->count = count;
+        return;
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (cmax[i] - cmin[i] > cmax[axis] - cmin[axis]) {
+            axis = i;
+        }
+    }
+    const float middle = (cmin[axis] + cmax[axis]) * .5f;
+    uint32_t left = first;
+    for (uint32_t i = first; i < first + count; i++) {
+        const float *tri = triangles + order[i] * 9;
+        if ((tri[axis] + tri[3 + axis] + tri[6 + axis]) / 3.f < middle) {
+            uint32_t t = order[i];
+            order[i] = order[left];
+            order[left++] = t;
+        }
+    }
+    // All centroids on one side (they are all the same), split by count
+    uint32_t left_count = left - first;
+    if (left_count == 0 || left_count == count) {
+        left_count = count / 2;
+    }
+
+    size_t children = bake->node_count;
+    bake->node_count += 2;
+    node->first = children;
+    node->count = 0;
+    build_node(bake, order, triangles, children, first, left_count,
+               depth + 1);
+    build_node(bake, order, triangles, children + 1, first + left_count,
+               count - left_count, depth + 1);
+}
+
+// Builds the BVH, and copies the triangles to bake->triangles in the order
+// of its leaves. Returns 1 when successful, 0 when unsuccessful.
+static int build_bvh(bake_t *bake, const float *triangles, size_t count) {
+    uint32_t *order = malloc(sizeof(uint32_t) * count + 1);
+    // A binary tree with at most one leaf per triangle
+    bake->nodes = malloc(sizeof(node_t) * (count * 2 + 1));
+    bake->triangles = malloc(sizeof(float) * 9 * count + 1);
+    if (!order || !bake->nodes || !bake->triangles) {
+        free(order);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    bake->node_count = 1;
+    build_node(bake, order, triangles, 0, 0, count, 0);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(bake->triangles + i * 9, triangles + order[i] * 9,
+               sizeof(float) * 9);
+    }
+    free(order);
+    return 1;
+}
+
+// Distance from p to the closest triangle. Visits the closer child first, so
+// that the other one can often be skipped.
+static float closest_distance(const bake_t *bake, const float *p) {
+    uint32_t stack[MAX_DEPTH + 2];
+    int top = 0;
+    float best = INFINITY;
+    stack[top++] = 0;
+    while (top > 0) {
+        const node_t *node = bake->nodes + stack[--top];
+        if (box_distance_sq(node, p) >= best) {
+            continue;
+        }
+        if (node->count) {
+            for (uint32_t i = node->first; i < node->first + node->count;
+                 i++) {
+                best = fminf(best,
+                             triangle_distance_sq(p, bake->triangles + i * 9));
+            }
+            continue;
+        }
+        uint32_t near = node->first, far = node->first + 1;
+        if (box_distance_sq(bake->nodes + far, p) <
+            box_distance_sq(bake->nodes + near, p)) {
+            near = far;
+            far = node->first;
+        }
+        stack[top++] = far;
+        stack[top++] = near;
+    }
+    return sqrtf(best);
+}
+
+// Finds where a ray from o along +axis crosses the triangles. Writes the
+// crossings' coordinates on the axis to hits, and returns their count.
+static int cast_ray(const bake_t *bake, const float *o, int axis,
+                    float *hits) {
+    const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    uint32_t stack[MAX_DEPTH + 2];
+    int top = 0, count = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const node_t *node = bake->nodes + stack[--top];
+        if (o[u] < node->min[u] || o[u] > node->max[u] || o[v] < node->min[v] ||
+            o[v] > node->max[v] || o[axis] > node->max[axis]) {
+            continue;
+        }
+        if (!node->count) {
+            stack[top++] = node->first;
+            stack[top++] = node->first + 1;
+            continue;
+        }
+        for (uint32_t i = node->first; i < node->first + node->count; i++) {
+            // The ray is a point in the triangle's projection to the other
+            // two axes. Edge functions give the barycentric coordinates.
+            const float *t = bake->triangles + i * 9;
+            double e[3];
+            for (int j = 0; j < 3; j++) {
+                const float *a = t + ((j + 1) % 3) * 3;
+                const float *b = t + ((j + 2) % 3) * 3;
+                e[j] = ((double)b[u] - a[u]) * ((double)o[v] - a[v]) -
+                       ((double)b[v] - a[v]) * ((double)o[u] - a[u]);
+            }
+            if (!((e[0] > 0. && e[1] > 0. && e[2] > 0.) ||
+                  (e[0] < 0. && e[1] < 0. && e[2] < 0.))) {
+                continue;
+            }
+            double sum = e[0] + e[1] + e[2];
+            float x = (e[0] * t[axis] + e[1] * t[3 + axis] +
+                       e[2] * t[6 + axis]) /
+                      sum;
+            if (x >= o[axis] && count < MAX_HITS) {
+                hits[count++] = x;
+            }
+        }
+    }
+    return count;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Center of voxel i on an axis of the baked cube
+static float voxel_center(const bake_t *bake, int axis, int i) {
+    return bake->bounds[axis] +
+           ((2.f * i + 1.f) / bake->size - 1.f) * bake->bounds[3];
+}
+
+// Finds which voxels of a row along `axis` are inside the mesh, from one ray
+// through the whole row. `start` is the row's first voxel center, and
+// inside[i] gets 1 for voxel i when it's inside.
+static void row_signs(const bake_t *bake, const float *start, int axis,
+                      unsigned char *inside) {
+    float hits[MAX_HITS];
+    float o[3] = {start[0], start[1], start[2]};
+    o[axis] = bake->bounds[axis] - bake->bounds[3];
+    int count = cast_ray(bake, o, axis, hits);
+    qsort(hits, count, sizeof(float), compare_floats);
+    int crossed = 0;
+    for (int i = 0; i < bake->size; i++) {
+        float x = voxel_center(bake, axis, i);
+        while (crossed < count && hits[crossed] < x) {
+            crossed++;
+        }
+        inside[i] = crossed & 1;
+    }
+}
+
+// Bakes the distances of one slice of voxels with the same Z
+static void bake_slice(void *userdata, size_t z) {
+    const bake_t *bake = (const bake_t *)userdata;
+    const int size = bake->size;
+    float *dst = bake->out + z * size * size;
+    // Signs from the rows along X (indexed by y, x) and Y (indexed by x, y)
+    unsigned char *inside_x = malloc((size_t)size * size * 2);
+    if (!inside_x) {
+        return;
+    }
+    unsigned char *inside_y = inside_x + size * size;
+
+    const float pz = voxel_center(bake, 2, z);
+    for (int i = 0; i < size; i++) {
+        float row_x[3] = {0.f, voxel_center(bake, 1, i), pz};
+        row_signs(bake, row_x, 0, inside_x + i * size);
+        float row_y[3] = {voxel_center(bake, 0, i), 0.f, pz};
+        row_signs(bake, row_y, 1, inside_y + i * size);
+    }
+
+    float hits[MAX_HITS];
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            float p[3] = {voxel_center(bake, 0, x), voxel_center(bake, 1, y),
+                          pz};
+            int inside = inside_x[y * size + x];
+            if (inside != inside_y[x * size + y]) {
+                inside = cast_ray(bake, p, 2, hits) & 1;
+            }
+            float d = closest_distance(bake, p);
+            dst[y * size + x] = inside ? -d : d;
+        }
+    }
+    free(inside_x);
+}
+
+// FNV-1a hash, continuing from `hash`
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Reads the SDF from the cache file if it was baked with the same hash.
+// Returns the SDF, or NULL if it needs baking.
+static float *load_cache(const char *filename, uint64_t hash, int size,
+                         float *bounds) {
+    size_t len = 0;
+    const unsigned char *data = map_file(filename, &len);
+    if (!data) {
+        return NULL;
+    }
+    const size_t bytes = sizeof(float) * size * size * size;
+    cache_header_t header;
+    float *sdf = NULL;
+    if (len == sizeof(header) + bytes) {
+        memcpy(&header, data, sizeof(header));
+        if (!memcmp(header.magic, CACHE_MAGIC, 4) && header.hash == hash &&
+            header.size == size && (sdf = malloc(bytes))) {
+            memcpy(sdf, data + sizeof(header), bytes);
+            memcpy(bounds, header.bounds, sizeof(header.bounds));
+        }
+    }
+    unmap_file(data);
+    return sdf;
+}
+
+#ifndef SELF_CONTAINED
+static void save_cache(const char *filename, uint64_t hash, int size,
+                       const float *bounds, const float *sdf) {
+    cache_header_t header = {.size = size, .hash = hash};
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    memcpy(header.bounds, bounds, sizeof(header.bounds));
+    const size_t count = (size_t)size * size * size;
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        SDL_Log("Failed to open %s for writing\n", filename);
+        return;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(sdf, sizeof(float), count, file) == count;
+    if (fclose(file) != 0 || !ok) {
+        SDL_Log("Failed to write %s\n", filename);
+    }
+}
+#endif
+
+// Bakes `count` triangles (9 floats each) into a signed distance field of
+// size * size * size voxels, negative inside the mesh. The field covers a
+// cube around the triangles, and its center and half size get written to
+// bounds[0..3]. Voxels are baked in parallel on `pool`. When the cache file
+// has a field baked from the same triangles at the same size, it's used
+// instead. Returns the field, or NULL if it fails. The caller should free
+// the array.
+float *mesh_sdf_bake(thread_pool_t *pool, const float *triangles,
+                     size_t count, int size, float *bounds,
+                     const char *cache) {
+    uint64_t hash = 0xcbf29ce484222325;
+    hash = hash_bytes(hash, triangles, sizeof(float) * 9 * count);
+    hash = hash_bytes(hash, &size, sizeof(size));
+    float *sdf = load_cache(cache, hash, size, bounds);
+    if (sdf) {
+        SDL_Log("Loaded mesh SDF from %s\n", cache);
+        return sdf;
+    }
+
+    bake_t bake = {.size = size};
+    if (count == 0 || size <= PADDING * 2 ||
+        !build_bvh(&bake, triangles, count) ||
+        !(bake.out = malloc(sizeof(float) * size * size * size))) {
+        free(bake.nodes);
+        free(bake.triangles);
+        return NULL;
+    }
+
+    // The root's box holds all triangles. The cube gets padded so that
+    // PADDING voxels on every side are outside of it.
+    float half = 0.f;
+    for (int i = 0; i < 3; i++) {
+        bake.bounds[i] = (bake.nodes[0].min[i] + bake.nodes[0].max[i]) * .5f;
+        half = fmaxf(half, (bake.nodes[0].max[i] - bake.nodes[0].min[i]) * .5f);
+    }
+    half = half > 0.f ? half : 1.f;
+    bake.bounds[3] = half * size / (size - PADDING * 2);
+
+    uint64_t start = SDL_GetTicks64();
+    thread_pool_for(pool, size, bake_slice, &bake);
+    SDL_Log("Baked %d^3 mesh SDF from %zu triangles in %.1f s\n", size,
+            count, (SDL_GetTicks64() - start) / 1000.);
+
+    memcpy(bounds, bake.bounds, sizeof(bake.bounds));
+#ifndef SELF_CONTAINED
+    save_cache(cache, hash, size, bounds, bake.out);
+#endif
+    free(bake.nodes);
+    free(bake.triangles);
+    return bake.out;
+}
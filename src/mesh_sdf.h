@@ -0,0 +1,11 @@
+#ifndef MESH_SDF_H
+#define MESH_SDF_H
+
+#include "thread_pool.h"
+#include <stddef.h>
+
+float *mesh_sdf_bake(thread_pool_t *pool, const float *triangles,
+                     size_t count, int size, float *bounds,
+                     const char *cache);
+
+#endif
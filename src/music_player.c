@@ -14,6 +14,8 @@ typedef struct {
 
 // This struct is for music player's main thread data
 typedef struct {
+    // The whole .ogg file, which the decoder reads from (see open_vorbis)
+    const void *data;
     // SDL's audio device and specification we use
     SDL_AudioDeviceID audio_device;
     SDL_AudioSpec spec;
@@ -24,6 +26,8 @@ typedef struct {
     playback_t playback;
 } music_player_t;
 
+void music_player_deinit(music_player_t *player);
+
 // This function gets repeatedly called from SDL when the audio device is
 // set to be playing. Decodes audio samples to SDL's buffer (*stream).
 static void callback(void *userdata, Uint8 *stream, int len) {
@@ -38,11 +42,21 @@ static void callback(void *userdata, Uint8 *stream, int len) {
     }
 }
 
-// This function opens stb vorbis by filename
-static stb_vorbis *open_vorbis(const char *filename) {
+// This function opens stb vorbis from a file's contents in memory, which
+// map_file gives without a copy in SELF_CONTAINED builds. Decoding and
+// especially seeking from memory skip the byte-at-a-time stdio calls which
+// stb_vorbis makes when it reads a file. *data must stay valid until the
+// decoder is closed, release it with unmap_file.
+static stb_vorbis *open_vorbis(const char *filename, const void **data) {
     int error = VORBIS__no_error;
 
-    stb_vorbis *vorbis = stb_vorbis_open_filename(filename, &error, NULL);
+    size_t len = 0;
+    *data = map_file(filename, &len);
+    if (!*data) {
+        return NULL;
+    }
+    stb_vorbis *vorbis = stb_vorbis_open_memory(
+        (const unsigned char *)*data, (int)len, &error, NULL);
 
     if (error != VORBIS__no_error) {
         vorbis = NULL;
@@ -60,8 +74,9 @@ music_player_t *music_player_init(const char *filename) {
         return NULL;
     }
 
-    stb_vorbis *vorbis = open_vorbis(filename);
+    stb_vorbis *vorbis = open_vorbis(filename, &player->data);
     if (!vorbis) {
+        music_player_deinit(player);
         return NULL;
     }
 
@@ -82,6 +97,7 @@ music_player_t *music_player_init(const char *filename) {
         SDL_OpenAudioDevice(NULL, 0, &desired, &player->spec, 0);
     if (!player->audio_device) {
         SDL_Log("Failed to open audio device:\n%s\n", SDL_GetError());
+        music_player_deinit(player);
         return NULL;
     }
 
@@ -131,6 +147,7 @@ void music_player_deinit(music_player_t *player) {
         if (player->playback.vorbis) {
             stb_vorbis_close(player->playback.vorbis);
         }
+        unmap_file(player->data);
         free(player);
     }
 }
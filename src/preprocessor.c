@@ -1,6 +1,7 @@
 #include "config.h"
 #include "filesystem.h"
 #include "shader.h"
+#include "trace.h"
 #include <SDL2/SDL_log.h>
 #include <assert.h>
 #include <math.h>
@@ -151,16 +152,20 @@ static char *process_includes(char *src, size_t len, const char *path) {
 // Parameters:
 //    `src`:       The source code buffer
 //    `len`:       Length of the source code buffer in bytes
+//    `version`:   The #version directive line, like GLSL_VERSION
 //    `path`:      Directory prefix to search for files to include
 //    `defines`:   An array of shader_define_t:s (see shader.h)
 //    `count_def`: The count of items in `defines`
 // Returns a new null-terminated string which the caller should free.
-const char *preprocess_glsl(const char *src, size_t src_len, const char *path,
+const char *preprocess_glsl(const char *src, size_t src_len,
+                            const char *version, const char *path,
                             const shader_define_t *defines, size_t count_def) {
+    TRACE_BEGIN("preprocess_glsl");
+
     // Create output buffer with #version -directive initial line
-    size_t len = strlen(GLSL_VERSION) + 1;
+    size_t len = strlen(version) + 1;
     char *s = malloc(len);
-    memcpy(s, GLSL_VERSION, len);
+    memcpy(s, version, len);
 
     // Iterate defines and inject #define directives right after an injected
     // #version -directive.
@@ -183,5 +188,7 @@ const char *preprocess_glsl(const char *src, size_t src_len, const char *path,
     strcat(s, "#line 1\n");
     strncat(s, src, src_len);
 
-    return process_includes(s, len, path);
+    char *processed = process_includes(s, len, path);
+    TRACE_END();
+    return processed;
 }
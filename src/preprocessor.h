@@ -7,7 +7,8 @@
 
 #include "shader.h"
 
-const char *preprocess_glsl(const char *src, size_t src_len, const char *path,
+const char *preprocess_glsl(const char *src, size_t src_len,
+                            const char *version, const char *path,
                             const shader_define_t *defines, size_t count_def);
 
 #endif
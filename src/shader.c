@@ -2,7 +2,9 @@
 #include "config.h"
 #include "filesystem.h"
 #include "gl.h"
+#include "gl_state.h"
 #include "preprocessor.h"
+#include "trace.h"
 #include "uniforms.h"
 #include <SDL2/SDL_log.h>
 #include <assert.h>
@@ -18,11 +20,19 @@ static GLenum type_from_str(const char *shader_type) {
         return GL_VERTEX_SHADER;
     } else if (strcmp("frag", shader_type) == 0) {
         return GL_FRAGMENT_SHADER;
+    } else if (strcmp("comp", shader_type) == 0) {
+        return GL_COMPUTE_SHADER;
     }
     SDL_Log("Unrecognized shader type: %s\n", shader_type);
     return GL_INVALID_ENUM;
 }
 
+// Compute shaders need a newer GLSL version than the other shader types
+static const char *version_from_str(const char *shader_type) {
+    return strcmp("comp", shader_type) == 0 ? GLSL_COMPUTE_VERSION
+                                            : GLSL_VERSION;
+}
+
 // This function preprocesses and compiles a shader.
 // Inputs:
 //    `src`:         The base shader source code (excluding #version directive)
@@ -35,23 +45,47 @@ static GLenum type_from_str(const char *shader_type) {
 GLuint compile_shader(const char *src, size_t src_len, const char *shader_type,
                       const shader_define_t *defines, size_t count_def) {
 
-    // Create empty shader object
-    GLuint shader = glCreateShader(type_from_str(shader_type));
-
     // Preprocess include-directives and inject define-directives
     const char *processed_src =
-        preprocess_glsl(src, src_len, "shaders", defines, count_def);
+        preprocess_glsl(src, src_len, version_from_str(shader_type),
+                        "shaders", defines, count_def);
 
-    // Load the sources "into" OpenGL driver
-    glShaderSource(shader, 1, &processed_src, NULL);
+    GLuint shader = compile_preprocessed_shader(processed_src, shader_type);
 
     // Free the processed source code
     free((void *)processed_src);
 
-    // Compile
-    glCompileShader(shader);
+    return shader;
+}
 
-    // Check and report errors
+// GL_KHR_parallel_shader_compile lets drivers compile and link on their own
+// threads, and tells when they are done without waiting for them
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Returns 1 if the driver has GL_KHR_parallel_shader_compile (or the same
+// extension as ARB)
+static int parallel_compile(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        supported = 0;
+        for (GLint i = 0; i < count; i++) {
+            const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if (name && (!strcmp(name, "GL_KHR_parallel_shader_compile") ||
+                         !strcmp(name, "GL_ARB_parallel_shader_compile"))) {
+                supported = 1;
+            }
+        }
+    }
+    return supported;
+}
+
+// Checks and reports a shader's compilation errors.
+// Returns 1 if it compiled, 0 otherwise.
+static int check_shader(GLuint shader) {
     GLint status;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
     if (status == GL_FALSE) {
@@ -61,35 +95,90 @@ GLuint compile_shader(const char *src, size_t src_len, const char *shader_type,
         glGetShaderInfoLog(shader, log_len, NULL, log);
         SDL_Log("Shader compilation failed:\n%s\n", log);
         free(log);
-        glDeleteShader(shader);
         return 0;
     }
+    return 1;
+}
+
+// This function starts compiling a shader which has already been
+// preprocessed (see preprocess_shader_file), but doesn't wait for the
+// result. Errors get reported when a program linked from it is finished
+// (see finish_program).
+GLuint submit_shader(const char *processed_src, const char *shader_type) {
+    // Create empty shader object
+    GLuint shader = glCreateShader(type_from_str(shader_type));
+
+    // Load the sources "into" OpenGL driver
+    glShaderSource(shader, 1, &processed_src, NULL);
+
+    // Compile
+    glCompileShader(shader);
 
     return shader;
 }
 
-// This function is similar to the one above, but it loads a file by filename
-// first, before running compile_shader.
-GLuint compile_shader_file(const char *filename, const shader_define_t *defines,
-                           size_t n_defs) {
-    char *shader_src = NULL;
-    size_t shader_src_len = read_file(filename, &shader_src);
-    if (shader_src_len == 0) {
-        return 0;
+// This function compiles a shader which has already been preprocessed (see
+// preprocess_shader_file). Returns 0 if compilation failed.
+GLuint compile_preprocessed_shader(const char *processed_src,
+                                   const char *shader_type) {
+    TRACE_BEGIN("compile_shader");
+    GLuint shader = submit_shader(processed_src, shader_type);
+
+    // Check and report errors
+    if (!check_shader(shader)) {
+        glDeleteShader(shader);
+        shader = 0;
     }
 
-    // Find file extension
+    TRACE_END();
+    return shader;
+}
+
+// Returns the shader type of a file, which is its file extension
+const char *shader_file_type(const char *filename) {
     const char *shader_type = filename, *ret;
     do {
         if ((ret = strchr(shader_type, '.'))) {
             shader_type = ret + 1;
         }
     } while (ret);
+    return shader_type;
+}
+
+// This function loads a file by filename and runs the preprocessor on it.
+// It makes no OpenGL calls, so it can run on any thread while OpenGL is
+// busy with something else. Returns the processed source which the caller
+// should free, or NULL if the file can't be read.
+char *preprocess_shader_file(const char *filename,
+                             const shader_define_t *defines, size_t n_defs) {
+    char *shader_src = NULL;
+    size_t shader_src_len = read_file(filename, &shader_src);
+    if (shader_src_len == 0) {
+        return NULL;
+    }
 
-    GLuint shader = compile_shader(shader_src, shader_src_len, shader_type,
-                                   defines, n_defs);
+    char *processed_src = (char *)preprocess_glsl(
+        shader_src, shader_src_len,
+        version_from_str(shader_file_type(filename)), "shaders", defines,
+        n_defs);
 
     free(shader_src);
+    return processed_src;
+}
+
+// This function is similar to compile_shader, but it loads a file by
+// filename first.
+GLuint compile_shader_file(const char *filename, const shader_define_t *defines,
+                           size_t n_defs) {
+    char *processed_src = preprocess_shader_file(filename, defines, n_defs);
+    if (!processed_src) {
+        return 0;
+    }
+
+    GLuint shader =
+        compile_preprocessed_shader(processed_src, shader_file_type(filename));
+
+    free(processed_src);
 
     if (shader == 0) {
         SDL_Log("File: %s\n", filename);
@@ -98,27 +187,48 @@ GLuint compile_shader_file(const char *filename, const shader_define_t *defines,
     return shader;
 }
 
-// This function "combines" shaders to a usable shader program.
-// In all cases, the function returns a `program_t`. Check its `handle`-field
-// for value 0. If `handle` is 0, compilation failed.
-program_t link_program(GLuint *shaders, size_t count) {
-    program_t ret = (program_t){0};
-    ret.handle = glCreateProgram();
-
+// This function starts linking shaders to a program, but doesn't wait for
+// the result. The shaders may still be compiling (see submit_shader).
+// Finish the program with finish_program.
+GLuint submit_program(const GLuint *shaders, size_t count) {
+    GLuint handle = glCreateProgram();
     for (size_t i = 0; i < count; i++) {
-        if (!shaders[i]) {
-            glDeleteProgram(ret.handle);
-            return (program_t){0};
-        }
-        glAttachShader(ret.handle, shaders[i]);
+        glAttachShader(handle, shaders[i]);
+    }
+    glLinkProgram(handle);
+    return handle;
+}
+
+// Returns 1 if finish_program can be called without waiting for the driver
+// to compile and link. Without GL_KHR_parallel_shader_compile, there is no
+// way to know, and this always returns 1.
+int program_ready(GLuint handle) {
+    if (!parallel_compile()) {
+        return 1;
     }
+    GLint done = GL_FALSE;
+    glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
 
-    glLinkProgram(ret.handle);
+// This function waits for a program from submit_program to link, and
+// reports errors in it and its shaders. In all cases, the function returns a
+// `program_t`. Check its `handle`-field for value 0. If `handle` is 0,
+// compilation or linking failed.
+program_t finish_program(GLuint handle) {
+    program_t ret = (program_t){.handle = handle};
 
+    TRACE_BEGIN("finish_program");
     // Check and report errors
     GLint status;
     glGetProgramiv(ret.handle, GL_LINK_STATUS, &status);
     if (status == GL_FALSE) {
+        GLuint shaders[2];
+        GLsizei count = 0;
+        glGetAttachedShaders(ret.handle, 2, &count, shaders);
+        for (GLsizei i = 0; i < count; i++) {
+            check_shader(shaders[i]);
+        }
         GLint log_len;
         glGetProgramiv(ret.handle, GL_INFO_LOG_LENGTH, &log_len);
         GLchar *log = malloc(sizeof(GLchar) * log_len);
@@ -126,6 +236,7 @@ program_t link_program(GLuint *shaders, size_t count) {
         SDL_Log("Program linking failed.\n%s\n", log);
         free(log);
         glDeleteProgram(ret.handle);
+        TRACE_END();
         return (program_t){0};
     }
 
@@ -133,16 +244,34 @@ program_t link_program(GLuint *shaders, size_t count) {
     ret.uniforms = get_uniforms(ret.handle, &ret.uniform_count);
     ret.blocks = get_uniform_blocks(ret.handle, &ret.block_count);
 
-    // Generate one buffer per uniform block
+    // Generate one buffer per uniform block. Block i always uses binding
+    // point i, which only needs to be set once here.
     ret.block_buffers = calloc(ret.block_count, sizeof(GLuint));
     glGenBuffers(ret.block_count, ret.block_buffers);
     for (size_t i = 0; i < ret.block_count; i++) {
-        glBindBuffer(GL_UNIFORM_BUFFER, ret.block_buffers[i]);
+        glUniformBlockBinding(ret.handle, i, i);
+        gl_bind_uniform_buffer(ret.block_buffers[i]);
         glBufferData(GL_UNIFORM_BUFFER, ret.blocks[i].size, NULL,
                      GL_STATIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
+    TRACE_END();
+    return ret;
+}
+
+// This function "combines" shaders to a usable shader program.
+// In all cases, the function returns a `program_t`. Check its `handle`-field
+// for value 0. If `handle` is 0, compilation failed.
+program_t link_program(GLuint *shaders, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!shaders[i]) {
+            return (program_t){0};
+        }
+    }
+
+    TRACE_BEGIN("link_program");
+    program_t ret = finish_program(submit_program(shaders, count));
+    TRACE_END();
     return ret;
 }
 
@@ -151,6 +280,8 @@ void shader_deinit(GLuint shader) { glDeleteShader(shader); }
 void program_deinit(program_t *program) {
     glDeleteBuffers(program->block_count, program->block_buffers);
     glDeleteProgram(program->handle);
+    // New objects may get the deleted ones' names
+    gl_state_invalidate();
     free(program->uniforms);
     free(program->blocks);
     free(program->block_buffers);
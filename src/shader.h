@@ -29,8 +29,17 @@ typedef struct {
 GLuint compile_shader(const char *shader_src, size_t shader_src_len,
                       const char *shader_type, const shader_define_t *defines,
                       size_t n_defs);
+GLuint submit_shader(const char *processed_src, const char *shader_type);
+GLuint compile_preprocessed_shader(const char *processed_src,
+                                   const char *shader_type);
+const char *shader_file_type(const char *filename);
+char *preprocess_shader_file(const char *filename,
+                             const shader_define_t *defines, size_t n_defs);
 GLuint compile_shader_file(const char *filename, const shader_define_t *defines,
                            size_t n_defs);
+GLuint submit_program(const GLuint *shaders, size_t count);
+int program_ready(GLuint handle);
+program_t finish_program(GLuint handle);
 program_t link_program(GLuint *shaders, size_t count);
 void shader_deinit(GLuint shader);
 void program_deinit(program_t *program);
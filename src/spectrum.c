@@ -0,0 +1,247 @@
+// Bakes the music's spectrogram at startup, so that shaders can react to the
+// music without any audio analysis per frame, and so that the result doesn't
+// depend on where playback was seeked to. The whole file gets decoded to
+// mono, and every column (one time step) is a Hann windowed FFT of the
+// samples around it, reduced to logarithmically spaced frequency bands.
+// Columns are independent of each other, so they run on the thread pool.
+
+#include "filesystem.h"
+#include "thread_pool.h"
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Only declarations, music_player.c includes the implementation
+#define STB_VORBIS_HEADER_ONLY
+#include "stb_vorbis.c"
+
+// FFT length in samples, about 46 ms at 44.1 kHz
+#define FFT_SIZE 2048
+// Frequency range covered by the bands, in Hz
+#define LOW_FREQUENCY 40.
+#define HIGH_FREQUENCY 16000.
+// Loudness range in decibels which maps to 0..1, anything quieter is 0
+#define DB_RANGE 60.
+#define PI 3.14159265358979
+
+// Tables and output shared with every analyse_column call
+typedef struct {
+    const float *samples;
+    size_t sample_count;
+    double hop;
+    int bins;
+    unsigned char *out;
+    float window[FFT_SIZE];
+    // cos and -sin of 2 PI i / FFT_SIZE
+    float cos_table[FFT_SIZE / 2];
+    float sin_table[FFT_SIZE / 2];
+    // Range of FFT bins (first, last) of every band
+    int *band_bins;
+} bake_t;
+
+// In-place iterative radix-2 FFT of n complex values (n = FFT_SIZE / 2).
+// Twiddles come from the FFT_SIZE tables, every other entry.
+static void fft(const bake_t *bake, float *re, float *im, int n) {
+    // Bit reversal permutation
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    // Butterflies. The inner loop has no dependencies between iterations,
+    // so the compiler can vectorize it for long stages.
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len >> 1;
+        int stride = FFT_SIZE / len;
+        for (int i = 0; i < n; i += len) {
+            float *ar = re + i, *ai = im + i;
+            float *br = ar + half, *bi = ai + half;
+            for (int k = 0; k < half; k++) {
+                float wr = bake->cos_table[k * stride];
+                float wi = bake->sin_table[k * stride];
+                float tr = br[k] * wr - bi[k] * wi;
+                float ti = br[k] * wi + bi[k] * wr;
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+static void analyse_column(void *userdata, size_t column) {
+    const bake_t *bake = (const bake_t *)userdata;
+    const int m = FFT_SIZE / 2;
+    float re[FFT_SIZE / 2], im[FFT_SIZE / 2];
+    float magnitude[FFT_SIZE / 2 + 1];
+
+    // A real FFT of FFT_SIZE samples is a complex FFT of half the size, with
+    // even samples as real parts and odd samples as imaginary parts. The
+    // window is centered at the column's time, samples outside the music
+    // are silence.
+    long start = (long)(column * bake->hop) - FFT_SIZE / 2;
+    for (int i = 0; i < m; i++) {
+        long s = start + i * 2;
+        float even = s >= 0 && (size_t)s < bake->sample_count
+                         ? bake->samples[s]
+                         : 0.f;
+        float odd = s + 1 >= 0 && (size_t)(s + 1) < bake->sample_count
+                        ? bake->samples[s + 1]
+                        : 0.f;
+        re[i] = even * bake->window[i * 2];
+        im[i] = odd * bake->window[i * 2 + 1];
+    }
+    fft(bake, re, im, m);
+
+    // Separate the even and odd samples' spectra and combine them into the
+    // real signal's spectrum. Scaled so that a full scale sine is 1.
+    for (int k = 0; k <= m; k++) {
+        int a = k % m, b = (m - k) % m;
+        float er = (re[a] + re[b]) * .5f, ei = (im[a] - im[b]) * .5f;
+        float odr = (im[a] + im[b]) * .5f, odi = (re[b] - re[a]) * .5f;
+        float wr = k < m ? bake->cos_table[k] : -1.f;
+        float wi = k < m ? bake->sin_table[k] : 0.f;
+        float xr = er + odr * wr - odi * wi;
+        float xi = ei + odr * wi + odi * wr;
+        magnitude[k] = sqrtf(xr * xr + xi * xi) * (4.f / FFT_SIZE);
+    }
+
+    // Each band gets its loudest bin, in decibels mapped to 0..255
+    unsigned char *dst = bake->out + column * bake->bins;
+    for (int i = 0; i < bake->bins; i++) {
+        float peak = 0.f;
+        for (int k = bake->band_bins[i * 2]; k <= bake->band_bins[i * 2 + 1];
+             k++) {
+            peak = magnitude[k] > peak ? magnitude[k] : peak;
+        }
+        double level = (20. * log10(peak + 1e-9) + DB_RANGE) / DB_RANGE;
+        level = level < 0. ? 0. : level > 1. ? 1. : level;
+        dst[i] = (unsigned char)(level * 255. + .5);
+    }
+}
+
+// Decodes a whole .ogg file to mono. Returns the samples, or NULL if it
+// fails. The caller should free the array.
+static float *decode_mono(const char *filename, size_t *count, int *rate) {
+    int error = 0;
+    size_t len = 0;
+    const unsigned char *data = map_file(filename, &len);
+    if (!data) {
+        return NULL;
+    }
+    stb_vorbis *vorbis = stb_vorbis_open_memory(data, (int)len, &error, NULL);
+    if (!vorbis) {
+        SDL_Log("Failed to parse vorbis file %s\n", filename);
+        unmap_file(data);
+        return NULL;
+    }
+    stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+    size_t length = stb_vorbis_stream_length_in_samples(vorbis);
+    float *samples = malloc(sizeof(float) * (length + 1));
+    if (!samples) {
+        stb_vorbis_close(vorbis);
+        unmap_file(data);
+        return NULL;
+    }
+
+    float buffer[4096 * 2];
+    const int channels = info.channels < 2 ? info.channels : 2;
+    size_t n = 0;
+    while (n < length) {
+        int frames = stb_vorbis_get_samples_float_interleaved(
+            vorbis, channels, buffer, sizeof(buffer) / sizeof(float));
+        if (frames == 0) {
+            break;
+        }
+        for (int i = 0; i < frames && n < length; i++, n++) {
+            samples[n] = channels == 2
+                             ? (buffer[i * 2] + buffer[i * 2 + 1]) * .5f
+                             : buffer[i];
+        }
+    }
+
+    *count = n;
+    *rate = info.sample_rate;
+    stb_vorbis_close(vorbis);
+    unmap_file(data);
+    return samples;
+}
+
+// Computes the spectrogram of an .ogg file: `rate` columns per second, with
+// `bins` bytes each, from LOW_FREQUENCY to HIGH_FREQUENCY on a logarithmic
+// scale. Columns are baked in parallel on `pool`. Returns the spectrogram
+// and sets *columns, or returns NULL if it fails. The caller should free the
+// array.
+unsigned char *spectrum_bake(thread_pool_t *pool, const char *filename,
+                             int bins, int rate, int *columns) {
+    bake_t *bake = calloc(1, sizeof(bake_t));
+    if (!bake) {
+        return NULL;
+    }
+
+    int sample_rate = 0;
+    float *samples = decode_mono(filename, &bake->sample_count, &sample_rate);
+    if (!samples) {
+        free(bake);
+        return NULL;
+    }
+    bake->samples = samples;
+    bake->hop = (double)sample_rate / rate;
+    bake->bins = bins;
+    *columns = (int)ceil(bake->sample_count / bake->hop);
+
+    unsigned char *out = malloc((size_t)*columns * bins);
+    bake->out = out;
+    bake->band_bins = malloc(sizeof(int) * bins * 2);
+    if (!out || !bake->band_bins) {
+        free(out);
+        free(samples);
+        free(bake->band_bins);
+        free(bake);
+        return NULL;
+    }
+
+    for (int i = 0; i < FFT_SIZE; i++) {
+        bake->window[i] = .5f - .5f * (float)cos(2. * PI * i / FFT_SIZE);
+    }
+    for (int i = 0; i < FFT_SIZE / 2; i++) {
+        bake->cos_table[i] = (float)cos(2. * PI * i / FFT_SIZE);
+        bake->sin_table[i] = (float)-sin(2. * PI * i / FFT_SIZE);
+    }
+
+    // Bands which are narrower than one FFT bin use the nearest bin
+    const double nyquist = sample_rate * .5;
+    const double high = HIGH_FREQUENCY < nyquist ? HIGH_FREQUENCY : nyquist;
+    const double bin_width = (double)sample_rate / FFT_SIZE;
+    for (int i = 0; i < bins; i++) {
+        double lo = LOW_FREQUENCY * pow(high / LOW_FREQUENCY, (double)i / bins);
+        double hi =
+            LOW_FREQUENCY * pow(high / LOW_FREQUENCY, (i + 1.) / bins);
+        int first = (int)ceil(lo / bin_width);
+        int last = (int)floor(hi / bin_width);
+        if (last < first) {
+            first = last = (int)((lo + hi) * .5 / bin_width + .5);
+        }
+        bake->band_bins[i * 2] = first;
+        bake->band_bins[i * 2 + 1] = last < FFT_SIZE / 2 ? last : FFT_SIZE / 2;
+    }
+
+    thread_pool_for(pool, *columns, analyse_column, bake);
+
+    free(samples);
+    free(bake->band_bins);
+    free(bake);
+    return out;
+}
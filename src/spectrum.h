@@ -0,0 +1,9 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "thread_pool.h"
+
+unsigned char *spectrum_bake(thread_pool_t *pool, const char *filename,
+                             int bins, int rate, int *columns);
+
+#endif
@@ -0,0 +1,230 @@
+// Baked rocket tracks for release builds. scripts/bake_sync.py packs all
+// tracks into one file (see the script for the layout), which gets used
+// straight from memory without parsing. Instead of looking tracks up by name
+// every time a value is needed, sync_tracks_evaluate computes every track's
+// value for a row at once.
+//
+// Values match sync_get_val in the rocket library.
+
+#include "filesystem.h"
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VERSION 1
+
+// Interpolation types, same as in rocket
+enum { KEY_STEP, KEY_LINEAR, KEY_SMOOTH, KEY_RAMP };
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t track_count;
+    uint32_t key_count;
+    uint32_t rows_offset;
+    uint32_t values_offset;
+    uint32_t types_offset;
+    uint32_t names_offset;
+} header_t;
+
+typedef struct {
+    uint32_t first_key;
+    uint32_t key_count;
+    uint32_t name_offset;
+} track_t;
+
+typedef struct {
+    const void *data;
+    size_t track_count;
+    const track_t *table;
+    // Keys of all tracks, every track's keys are a contiguous range
+    const int32_t *rows;
+    const float *values;
+    const uint8_t *types;
+    const char *names;
+    size_t names_size;
+    // Key index of every track's previous evaluation. Rows usually only move
+    // a little between frames, so searching from here is quick.
+    uint32_t *cursors;
+} sync_tracks_t;
+
+void sync_tracks_deinit(sync_tracks_t *tracks);
+
+// Checks that the data in the file is consistent, so that evaluation doesn't
+// need to do any checks
+static int validate(const sync_tracks_t *tracks, const header_t *header,
+                    size_t len) {
+    size_t keys = header->key_count;
+    size_t table_end = sizeof(header_t) + tracks->track_count * sizeof(track_t);
+    if (table_end > len || header->rows_offset + keys * 4 > len ||
+        header->values_offset + keys * 4 > len ||
+        header->types_offset + keys > len || header->names_offset > len ||
+        header->rows_offset % 4 || header->values_offset % 4) {
+        return 0;
+    }
+    if (tracks->names_size == 0 ||
+        tracks->names[tracks->names_size - 1] != '\0') {
+        return 0;
+    }
+    for (size_t i = 0; i < tracks->track_count; i++) {
+        const track_t *t = tracks->table + i;
+        if (t->first_key + (size_t)t->key_count > keys ||
+            t->name_offset >= tracks->names_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Loads a file made by scripts/bake_sync.py. Returns NULL if the file doesn't
+// exist or isn't valid.
+sync_tracks_t *sync_tracks_load(const char *filename) {
+    size_t len = 0;
+    const unsigned char *data = map_file(filename, &len);
+    if (!data) {
+        return NULL;
+    }
+
+    const header_t *header = (const header_t *)data;
+    if (len < sizeof(header_t) || (uintptr_t)data % 4 != 0 ||
+        memcmp(header->magic, "TRKS", 4) != 0 || header->version != VERSION) {
+        SDL_Log("%s is not a baked sync track file\n", filename);
+        unmap_file(data);
+        return NULL;
+    }
+
+    sync_tracks_t *tracks = calloc(1, sizeof(sync_tracks_t));
+    if (!tracks) {
+        unmap_file(data);
+        return NULL;
+    }
+    tracks->data = data;
+    tracks->track_count = header->track_count;
+    tracks->table = (const track_t *)(data + sizeof(header_t));
+    tracks->rows = (const int32_t *)(data + header->rows_offset);
+    tracks->values = (const float *)(data + header->values_offset);
+    tracks->types = data + header->types_offset;
+    tracks->names = (const char *)(data + header->names_offset);
+    tracks->names_size = len - header->names_offset;
+
+    if (!validate(tracks, header, len)) {
+        SDL_Log("%s is corrupted\n", filename);
+        sync_tracks_deinit(tracks);
+        return NULL;
+    }
+
+    tracks->cursors = calloc(tracks->track_count + 1, sizeof(uint32_t));
+    if (!tracks->cursors) {
+        sync_tracks_deinit(tracks);
+        return NULL;
+    }
+
+    return tracks;
+}
+
+size_t sync_tracks_count(const sync_tracks_t *tracks) {
+    return tracks ? tracks->track_count : 0;
+}
+
+// Returns the index of a track by name, or -1 if there is no such track.
+// The index stays the same for as long as the tracks are loaded.
+int sync_tracks_find(const sync_tracks_t *tracks, const char *name) {
+    if (!tracks) {
+        return -1;
+    }
+
+    // Tracks are sorted by name
+    size_t lo = 0, hi = tracks->track_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strcmp(name, tracks->names + tracks->table[mid].name_offset);
+        if (cmp == 0) {
+            return (int)mid;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+// Finds the last key at or before irow, starting the search from key k
+static uint32_t find_key(const int32_t *rows, uint32_t count, uint32_t k,
+                         int irow) {
+    if (rows[k] > irow) {
+        // Went backwards (seek), search from the beginning
+        uint32_t lo = 0, hi = k;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (rows[mid] <= irow) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        return lo;
+    }
+    while (k + 1 < count && rows[k + 1] <= irow) {
+        k++;
+    }
+    return k;
+}
+
+// Computes the value of every track at `row`, values[i] gets the value of
+// track i. `values` must have room for sync_tracks_count values.
+void sync_tracks_evaluate(sync_tracks_t *tracks, double row, float *values) {
+    if (!tracks) {
+        return;
+    }
+
+    int irow = (int)floor(row);
+    for (size_t i = 0; i < tracks->track_count; i++) {
+        const track_t *t = tracks->table + i;
+        const int32_t *rows = tracks->rows + t->first_key;
+        const float *v = tracks->values + t->first_key;
+
+        // No keys at all is a constant 0
+        if (t->key_count == 0) {
+            values[i] = 0.f;
+            continue;
+        }
+
+        uint32_t k = find_key(rows, t->key_count, tracks->cursors[i], irow);
+        tracks->cursors[i] = k;
+
+        // Before the first key or after the last key, the value is constant
+        if (rows[k] > irow) {
+            values[i] = v[0];
+            continue;
+        }
+        if (k + 1 >= t->key_count) {
+            values[i] = v[k];
+            continue;
+        }
+
+        double x = (row - rows[k]) / (rows[k + 1] - rows[k]);
+        switch (tracks->types[t->first_key + k]) {
+        case KEY_STEP:
+            x = 0.;
+            break;
+        case KEY_SMOOTH:
+            x = x * x * (3. - 2. * x);
+            break;
+        case KEY_RAMP:
+            x = x * x;
+            break;
+        }
+        values[i] = v[k] + (v[k + 1] - v[k]) * x;
+    }
+}
+
+void sync_tracks_deinit(sync_tracks_t *tracks) {
+    if (tracks) {
+        unmap_file(tracks->data);
+        free(tracks->cursors);
+        free(tracks);
+    }
+}
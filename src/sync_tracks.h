@@ -0,0 +1,15 @@
+#ifndef SYNC_TRACKS_H
+#define SYNC_TRACKS_H
+
+#include <stddef.h>
+
+// Forward declaration so that implementation remains opaque
+typedef struct sync_tracks_t_ sync_tracks_t;
+
+sync_tracks_t *sync_tracks_load(const char *filename);
+size_t sync_tracks_count(const sync_tracks_t *tracks);
+int sync_tracks_find(const sync_tracks_t *tracks, const char *name);
+void sync_tracks_evaluate(sync_tracks_t *tracks, double row, float *values);
+void sync_tracks_deinit(sync_tracks_t *tracks);
+
+#endif
@@ -0,0 +1,89 @@
+// Background tasks for startup. Every task runs on its own SDL thread, so
+// that loading files, parsing the music and baking textures happen while the
+// main thread creates the window and the OpenGL context. The main thread
+// picks up the results with task_wait when it needs them.
+//
+// task_wait logs how long each task took and how long the main thread had to
+// wait for it. A task which got waited for is on the critical path of
+// startup, making it faster would make the first frame appear sooner.
+
+#include "trace.h"
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+
+// A task function returns its result, which task_wait passes on
+typedef void *(*task_fn_t)(void *userdata);
+
+typedef struct {
+    const char *name;
+    task_fn_t fn;
+    void *userdata;
+    void *result;
+    SDL_Thread *thread;
+    // Set by the task's thread when it has finished
+    SDL_atomic_t done;
+    // Performance counter values at the start and end of the task
+    uint64_t start, end;
+} task_t;
+
+static double to_ms(uint64_t counter_diff) {
+    return counter_diff * 1000. / SDL_GetPerformanceFrequency();
+}
+
+static int run(void *data) {
+    task_t *task = (task_t *)data;
+    TRACE_BEGIN(task->name);
+    task->result = task->fn(task->userdata);
+    TRACE_END();
+    task->end = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&task->done, 1);
+    return 0;
+}
+
+// Starts running fn(userdata) on a new thread. `name` is used in logs and
+// must stay valid until task_wait. If a thread can't be created, the task
+// runs right away on the calling thread instead.
+task_t *task_start(const char *name, task_fn_t fn, void *userdata) {
+    task_t *task = calloc(1, sizeof(task_t));
+    if (!task) {
+        return NULL;
+    }
+    task->name = name;
+    task->fn = fn;
+    task->userdata = userdata;
+    task->start = SDL_GetPerformanceCounter();
+
+    task->thread = SDL_CreateThread(run, name, task);
+    if (!task->thread) {
+        SDL_Log("Failed to create a thread for %s: %s\n", name,
+                SDL_GetError());
+        run(task);
+    }
+
+    return task;
+}
+
+// Returns 1 if the task has finished, so that task_wait won't block
+int task_done(task_t *task) { return !task || SDL_AtomicGet(&task->done); }
+
+// Waits until the task has finished and returns its result. Frees the task.
+void *task_wait(task_t *task) {
+    if (!task) {
+        return NULL;
+    }
+
+    uint64_t wait_start = SDL_GetPerformanceCounter();
+    if (task->thread) {
+        SDL_WaitThread(task->thread, NULL);
+    }
+    uint64_t wait_end = SDL_GetPerformanceCounter();
+
+    // The wait didn't take any time if the task was already finished
+    double waited = task->end > wait_start ? to_ms(wait_end - wait_start) : 0.;
+    SDL_Log("Task %s took %.1f ms, waited %.1f ms for it\n", task->name,
+            to_ms(task->end - task->start), waited);
+
+    void *result = task->result;
+    free(task);
+    return result;
+}
@@ -0,0 +1,14 @@
+#ifndef TASK_H
+#define TASK_H
+
+// Forward declaration so that implementation remains opaque
+typedef struct task_t_ task_t;
+
+// A task function returns its result, which task_wait passes on
+typedef void *(*task_fn_t)(void *userdata);
+
+task_t *task_start(const char *name, task_fn_t fn, void *userdata);
+int task_done(task_t *task);
+void *task_wait(task_t *task);
+
+#endif
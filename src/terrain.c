@@ -0,0 +1,62 @@
+#include "thread_pool.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Same as in shaders/shader.frag
+#define OCTAVES 4
+#define PI 3.14159265f
+
+// These are C versions of the shader functions motion and fbm in
+// shaders/shader.frag. Keep them in sync, or the baked terrain won't match
+// the shader's ANALYTIC_TERRAIN version.
+static float motion(float x, float y, float phase) {
+    x += sinf(y + phase + 0.41f) * 2.f;
+    return sinf(x + phase);
+}
+
+static float fbm(float x, float y) {
+    // Initial values
+    float value = 0.f;
+    float amplitude = .5f;
+
+    // Loop of octaves
+    for (int i = 0; i < OCTAVES; i++) {
+        value += powf(1.f - fabsf(motion(x, y, amplitude * 3.14f) * amplitude),
+                      2.5f);
+        x *= 2.f;
+        y *= 2.f;
+        amplitude *= .5f;
+    }
+    return value;
+}
+
+// Output buffer and its dimensions, shared with every bake_row call
+typedef struct {
+    float *heights;
+    int size;
+} bake_t;
+
+static void bake_row(void *userdata, size_t row) {
+    bake_t *bake = (bake_t *)userdata;
+    float *dst = bake->heights + row * bake->size;
+    float y = (row + .5f) / bake->size * 2.f * PI;
+    for (int i = 0; i < bake->size; i++) {
+        dst[i] = fbm((i + .5f) / bake->size * 2.f * PI, y);
+    }
+}
+
+// Evaluates the mountains' fbm into a size * size float array.
+// fbm repeats every 2 PI along both axes, so the array holds exactly one
+// period (texel centers at 0..2 PI) and can be sampled with GL_REPEAT.
+// Rows are baked in parallel on `pool`. The caller should free the array.
+float *terrain_bake(thread_pool_t *pool, int size) {
+    bake_t bake = {.heights = malloc(sizeof(float) * size * size),
+                   .size = size};
+    if (!bake.heights) {
+        return NULL;
+    }
+
+    thread_pool_for(pool, size, bake_row, &bake);
+
+    return bake.heights;
+}
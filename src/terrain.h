@@ -0,0 +1,8 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "thread_pool.h"
+
+float *terrain_bake(thread_pool_t *pool, int size);
+
+#endif
@@ -0,0 +1,693 @@
+// Streams image textures to the GPU without stalling frames. Every file gets
+// read and decoded on a task thread: PNG and JPEG files with stb_image, and
+// KTX2 files with block compressed levels only get checked and their levels
+// located, because they get uploaded as they are.
+//
+// The decoded levels then get uploaded a slice of rows at a time, at most
+// TEXTURE_UPLOAD_BYTES per frame, through a ring of TEXTURE_PBOS pixel buffer
+// objects. The copy from a PBO to the texture happens on the GPU's timeline,
+// and a fence tells when the PBO can be written again, so a frame skips the
+// upload instead of waiting for the GPU. A texture becomes visible once all
+// its levels are there. Until then it samples as black.
+//
+// All textures together stay within a memory budget. A decoded image which
+// doesn't fit gets halved until it does, and a KTX2 file's largest levels get
+// skipped.
+//
+// Rows are kept top first like in the files, so v = 0 is the image's top.
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+// Files get read with map_file, which also works in SELF_CONTAINED builds
+#define STBI_NO_STDIO
+#include "stb_image.h"
+#include "config.h"
+#include "filesystem.h"
+#include "gl.h"
+#include "gl_state.h"
+#include "task.h"
+#include "trace.h"
+#include <SDL2/SDL.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// KTX2 files can have at most this many levels (a 32768 pixel texture)
+#define MAX_LEVELS 16
+// A slot which isn't uploading
+#define NO_UPLOAD SIZE_MAX
+
+// Compressed formats which GL ES 3 always has, and which desktop GL has with
+// EXT_texture_compression_s3tc and ARB_texture_compression_bptc
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_SRGB8_ETC2 0x9275
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+// KTX2 files name their format with a VkFormat value. Each build accepts the
+// formats which its GPUs decode in hardware: ETC2 on GL ES and BCn on desktop
+// GL. Blocks are 4x4 pixels.
+typedef struct {
+    uint32_t vk_format;
+    GLenum format;
+    int block_bytes;
+} ktx2_format_t;
+
+static const ktx2_format_t ktx2_formats[] = {
+#ifdef GLES
+    {147, GL_COMPRESSED_RGB8_ETC2, 8},
+    {148, GL_COMPRESSED_SRGB8_ETC2, 8},
+    {151, GL_COMPRESSED_RGBA8_ETC2_EAC, 16},
+    {152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 16},
+#else
+    {131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8},
+    {133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8},
+    {134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8},
+    {137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16},
+    {138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16},
+    {145, GL_COMPRESSED_RGBA_BPTC_UNORM, 16},
+    {146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16},
+#endif
+};
+
+// The start of a KTX2 file, see the KTX 2.0 specification. Little endian,
+// like every platform this runs on.
+typedef struct {
+    unsigned char identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+} ktx2_header_t;
+
+// Follows the header once for every level, the largest level first
+typedef struct {
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+} ktx2_level_t;
+
+static const unsigned char ktx2_identifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+// A decoded image, ready to be uploaded
+typedef struct {
+    // Internal format, and bytes per 4x4 block for compressed formats. 0
+    // means RGBA8 pixels.
+    GLenum format;
+    int block_bytes;
+    int width, height;
+    int levels;
+    // Decoded images get their mip levels generated after uploading
+    int generate_mips;
+    const unsigned char *level_data[MAX_LEVELS];
+    // Decoded pixels, or the mapped KTX2 file which the levels point to
+    unsigned char *pixels;
+    const void *file;
+    // Bytes reserved from the memory budget
+    int reserved;
+} image_t;
+
+// One texture, from its file to the GPU
+typedef struct {
+    struct textures_t_ *textures;
+    const char *filename;
+    // Decodes the file, NULL when done
+    task_t *task;
+    // The decoded image, while it's being uploaded
+    image_t *image;
+    GLuint texture;
+    int ready;
+} slot_t;
+
+typedef struct textures_t_ {
+    slot_t *slots;
+    size_t count;
+    // Memory budget and the bytes which decoded images have reserved from
+    // it, from any thread
+    int budget;
+    SDL_atomic_t used;
+    // The slot being uploaded, and the next level and row (in blocks for
+    // compressed formats) to upload
+    size_t uploading;
+    int level;
+    int row;
+    // Ring of PBOs for uploads, and fences which tell when the GPU has
+    // copied from them. Created by the first textures_update.
+    GLuint pbos[TEXTURE_PBOS];
+    GLsync fences[TEXTURE_PBOS];
+    size_t pbo;
+} textures_t;
+
+static int level_width(const image_t *image, int level) {
+    return image->width >> level > 0 ? image->width >> level : 1;
+}
+
+static int level_height(const image_t *image, int level) {
+    return image->height >> level > 0 ? image->height >> level : 1;
+}
+
+// Rows of a level, in blocks for compressed formats
+static int level_rows(const image_t *image, int level) {
+    int height = level_height(image, level);
+    return image->block_bytes ? (height + 3) / 4 : height;
+}
+
+// Bytes in one row of a level, in blocks for compressed formats
+static size_t row_bytes(const image_t *image, int level) {
+    size_t width = level_width(image, level);
+    return image->block_bytes ? (width + 3) / 4 * image->block_bytes
+                              : width * 4;
+}
+
+static size_t level_bytes(const image_t *image, int level) {
+    return row_bytes(image, level) * level_rows(image, level);
+}
+
+// GPU memory of the image, including the mip levels which get generated
+static size_t image_bytes(const image_t *image) {
+    size_t bytes = 0;
+    for (int i = 0; i < image->levels; i++) {
+        bytes += level_bytes(image, i);
+    }
+    if (image->generate_mips) {
+        for (int i = 1; level_width(image, i - 1) > 1 ||
+                        level_height(image, i - 1) > 1;
+             i++) {
+            bytes += level_bytes(image, i);
+        }
+    }
+    return bytes;
+}
+
+static void free_image(image_t *image) {
+    if (image) {
+        stbi_image_free(image->pixels);
+        unmap_file(image->file);
+        free(image);
+    }
+}
+
+// Locates the levels of a KTX2 file, which stays mapped for uploading them.
+// Returns 1 if the file's format can be used, 0 otherwise.
+static int read_ktx2(image_t *image, const unsigned char *file, size_t len) {
+    ktx2_header_t header;
+    if (len < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, file, sizeof(header));
+
+    const ktx2_format_t *format = NULL;
+    for (size_t i = 0; i < sizeof(ktx2_formats) / sizeof(*ktx2_formats); i++) {
+        if (ktx2_formats[i].vk_format == header.vk_format) {
+            format = ktx2_formats + i;
+        }
+    }
+    if (!format) {
+        SDL_Log("KTX2 format %u isn't supported in this build\n",
+                (unsigned)header.vk_format);
+        return 0;
+    }
+    // Only plain 2D textures, without supercompression (Basis, zstd)
+    if (header.pixel_width == 0 || header.pixel_height == 0 ||
+        header.pixel_depth > 0 || header.layer_count > 1 ||
+        header.face_count != 1 || header.supercompression_scheme != 0) {
+        SDL_Log("KTX2 file isn't a plain 2D texture\n");
+        return 0;
+    }
+
+    image->format = format->format;
+    image->block_bytes = format->block_bytes;
+    image->width = header.pixel_width;
+    image->height = header.pixel_height;
+    // Level count 0 asks for mip levels to be generated, which compressed
+    // formats can't have
+    image->levels = header.level_count ? header.level_count : 1;
+    if (image->levels > MAX_LEVELS ||
+        sizeof(header) + image->levels * sizeof(ktx2_level_t) > len) {
+        return 0;
+    }
+    for (int i = 0; i < image->levels; i++) {
+        ktx2_level_t level;
+        memcpy(&level, file + sizeof(header) + i * sizeof(level),
+               sizeof(level));
+        if (level.byte_length != level_bytes(image, i) ||
+            level.byte_offset > len || level.byte_length > len ||
+            level.byte_offset + level.byte_length > len) {
+            SDL_Log("KTX2 level %d is truncated\n", i);
+            return 0;
+        }
+        image->level_data[i] = file + level.byte_offset;
+    }
+    image->file = file;
+    return 1;
+}
+
+// Decodes a PNG or JPEG file to RGBA8 pixels. Returns 1 if successful, 0
+// otherwise.
+static int decode_image(image_t *image, const unsigned char *file,
+                        size_t len) {
+    int width, height, channels;
+    image->pixels =
+        stbi_load_from_memory(file, len, &width, &height, &channels, 4);
+    if (!image->pixels) {
+        SDL_Log("stb_image: %s\n", stbi_failure_reason());
+        return 0;
+    }
+    image->format = GL_RGBA8;
+    image->width = width;
+    image->height = height;
+    image->levels = 1;
+    image->generate_mips = 1;
+    image->level_data[0] = image->pixels;
+    return 1;
+}
+
+// Halves a decoded image's size with a box filter. Returns 1 if successful,
+// 0 if the image is already 1x1 or out of memory.
+static int halve(image_t *image) {
+    const int w = image->width, h = image->height;
+    if (w == 1 && h == 1) {
+        return 0;
+    }
+    const int hw = w > 1 ? w / 2 : 1, hh = h > 1 ? h / 2 : 1;
+    // Freed with stbi_image_free like the decoded pixels
+    unsigned char *half = STBI_MALLOC((size_t)hw * hh * 4);
+    if (!half) {
+        return 0;
+    }
+    for (int y = 0; y < hh; y++) {
+        for (int x = 0; x < hw; x++) {
+            int x1 = x * 2 + 1 < w ? x * 2 + 1 : x * 2;
+            int y1 = y * 2 + 1 < h ? y * 2 + 1 : y * 2;
+            const unsigned char *p = image->pixels;
+            for (int c = 0; c < 4; c++) {
+                half[((size_t)y * hw + x) * 4 + c] =
+                    (p[((size_t)y * 2 * w + x * 2) * 4 + c] +
+                     p[((size_t)y * 2 * w + x1) * 4 + c] +
+                     p[((size_t)y1 * w + x * 2) * 4 + c] +
+                     p[((size_t)y1 * w + x1) * 4 + c] + 2) /
+                    4;
+            }
+        }
+    }
+    stbi_image_free(image->pixels);
+    image->pixels = half;
+    image->level_data[0] = half;
+    image->width = hw;
+    image->height = hh;
+    return 1;
+}
+
+// Reserves `bytes` from the memory budget. Returns 1 if they fit, 0
+// otherwise.
+static int reserve(textures_t *textures, size_t bytes) {
+    for (;;) {
+        int used = SDL_AtomicGet(&textures->used);
+        if (bytes > (size_t)(textures->budget - used)) {
+            return 0;
+        }
+        if (SDL_AtomicCAS(&textures->used, used, used + (int)bytes)) {
+            return 1;
+        }
+    }
+}
+
+// Reserves the image's memory from the budget, making the image smaller
+// until it fits. Returns 1 if successful, 0 if even the smallest doesn't fit.
+static int fit_budget(textures_t *textures, image_t *image) {
+    for (;;) {
+        size_t bytes = image_bytes(image);
+        if (reserve(textures, bytes)) {
+            image->reserved = bytes;
+            return 1;
+        }
+        if (!image->block_bytes) {
+            if (!halve(image)) {
+                return 0;
+            }
+        } else if (image->levels > 1) {
+            // Skip the largest level
+            memmove(image->level_data, image->level_data + 1,
+                    (image->levels - 1) * sizeof(*image->level_data));
+            image->levels--;
+            image->width = level_width(image, 1);
+            image->height = level_height(image, 1);
+        } else {
+            return 0;
+        }
+    }
+}
+
+// Reads and decodes a slot's file on a task thread
+static void *decode(void *userdata) {
+    slot_t *slot = (slot_t *)userdata;
+    size_t len = 0;
+    const unsigned char *file = map_file(slot->filename, &len);
+    if (!file) {
+        return NULL;
+    }
+
+    image_t *image = calloc(1, sizeof(image_t));
+    int ok = 0;
+    if (image) {
+        if (len >= sizeof(ktx2_identifier) &&
+            memcmp(file, ktx2_identifier, sizeof(ktx2_identifier)) == 0) {
+            ok = read_ktx2(image, file, len);
+        } else {
+            ok = decode_image(image, file, len);
+        }
+    }
+    // Only KTX2 files stay mapped, decoded images don't need them
+    if (!image || !image->file) {
+        unmap_file(file);
+    }
+
+    int width = ok ? image->width : 0, height = ok ? image->height : 0;
+    if (ok && !fit_budget(slot->textures, image)) {
+        SDL_Log("Texture %s doesn't fit in TEXTURE_BUDGET\n", slot->filename);
+        ok = 0;
+    }
+    if (!ok) {
+        SDL_Log("Failed to load texture %s\n", slot->filename);
+        free_image(image);
+        return NULL;
+    }
+    if (image->width != width) {
+        SDL_Log("Texture %s reduced from %dx%d to %dx%d for TEXTURE_BUDGET\n",
+                slot->filename, width, height, image->width, image->height);
+    }
+    return image;
+}
+
+// Starts reading and decoding `count` image files on other threads. Makes no
+// OpenGL calls, textures_update uploads the results. `budget` is the
+// textures' memory limit in bytes.
+textures_t *textures_init(const char *const *filenames, size_t count,
+                          size_t budget) {
+    textures_t *textures = calloc(1, sizeof(textures_t));
+    if (!textures) {
+        return NULL;
+    }
+    textures->slots = calloc(count ? count : 1, sizeof(slot_t));
+    if (!textures->slots) {
+        free(textures);
+        return NULL;
+    }
+    textures->count = count;
+    textures->budget = budget < INT32_MAX ? budget : INT32_MAX;
+    textures->uploading = NO_UPLOAD;
+
+    for (size_t i = 0; i < count; i++) {
+        slot_t *slot = textures->slots + i;
+        slot->textures = textures;
+        slot->filename = filenames[i];
+        slot->task = task_start(filenames[i], decode, slot);
+    }
+    return textures;
+}
+
+// Returns 1 if the GPU can sample a compressed format
+static int format_supported(GLenum format) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+    GLint *formats = calloc(count ? count : 1, sizeof(GLint));
+    int supported = 0;
+    if (formats) {
+        glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats);
+        for (GLint i = 0; i < count; i++) {
+            supported |= (GLenum)formats[i] == format;
+        }
+    }
+    free(formats);
+    return supported;
+}
+
+// Creates a slot's texture with storage for all of its image's levels.
+// Returns 1 if successful, 0 otherwise.
+static int begin_upload(slot_t *slot) {
+    const image_t *image = slot->image;
+    if (image->block_bytes && !format_supported(image->format)) {
+        SDL_Log("Texture %s: the GPU doesn't support format 0x%x\n",
+                slot->filename, image->format);
+        return 0;
+    }
+
+    glGenTextures(1, &slot->texture);
+    gl_bind_texture(0, slot->texture);
+    for (int i = 0; i < image->levels; i++) {
+        if (image->block_bytes) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, image->format,
+                                   level_width(image, i),
+                                   level_height(image, i), 0,
+                                   level_bytes(image, i), NULL);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, image->format,
+                         level_width(image, i), level_height(image, i), 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+    // Generated mip levels come from glGenerateMipmap at the end
+    if (!image->generate_mips) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                        image->levels - 1);
+    }
+    int mipmapped = image->levels > 1 || image->generate_mips;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    return 1;
+}
+
+// Drops a slot's image, and its texture unless it's ready. The budget
+// reservation stays with a ready texture.
+static void end_upload(textures_t *textures, slot_t *slot) {
+    if (!slot->ready) {
+        glDeleteTextures(1, &slot->texture);
+        slot->texture = 0;
+        // New textures may get the deleted one's name
+        gl_state_invalidate();
+        SDL_AtomicAdd(&textures->used, -slot->image->reserved);
+    }
+    free_image(slot->image);
+    slot->image = NULL;
+    textures->uploading = NO_UPLOAD;
+}
+
+// Picks the next slot to upload, the first one whose file is decoded. With
+// `wait`, waits for the first remaining one if none is. Returns 1 if a slot
+// is uploading, 0 otherwise.
+static int next_upload(textures_t *textures, int wait) {
+    while (textures->uploading == NO_UPLOAD) {
+        size_t next = textures->count;
+        for (size_t i = 0; i < textures->count && next == textures->count;
+             i++) {
+            slot_t *slot = textures->slots + i;
+            if (slot->task && (wait || task_done(slot->task))) {
+                next = i;
+            }
+        }
+        if (next == textures->count) {
+            return 0;
+        }
+
+        slot_t *slot = textures->slots + next;
+        slot->image = task_wait(slot->task);
+        slot->task = NULL;
+        if (slot->image) {
+            textures->uploading = next;
+            textures->level = 0;
+            textures->row = 0;
+            if (!begin_upload(slot)) {
+                end_upload(textures, slot);
+            }
+        }
+    }
+    return 1;
+}
+
+// Copies the next rows of the uploading slot's current level to a PBO, and
+// from there to the texture. Without `wait`, uploads at most `max_bytes`,
+// and nothing if the next PBO is still in use. Returns the number of bytes
+// uploaded.
+static size_t upload_slice(textures_t *textures, size_t max_bytes, int wait) {
+    slot_t *slot = textures->slots + textures->uploading;
+    const image_t *image = slot->image;
+    const int level = textures->level;
+
+    // The GPU has usually finished with the PBO frames ago
+    GLsync *fence = textures->fences + textures->pbo;
+    if (*fence) {
+        GLenum status = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                         wait ? 1000000000 : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return 0;
+        }
+        glDeleteSync(*fence);
+        *fence = 0;
+    }
+
+    // Whole rows, the PBO holds TEXTURE_UPLOAD_BYTES
+    const size_t stride = row_bytes(image, level);
+    int rows = level_rows(image, level) - textures->row;
+    size_t max_rows = (wait ? TEXTURE_UPLOAD_BYTES : max_bytes) / stride;
+    if ((size_t)rows > max_rows) {
+        rows = max_rows;
+    }
+    if (rows == 0) {
+        return 0;
+    }
+    const size_t bytes = rows * stride;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, textures->pbos[textures->pbo]);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                 GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+        memcpy(dst, image->level_data[level] + textures->row * stride, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // With a PBO bound, the data pointer is an offset into it
+        gl_bind_texture(0, slot->texture);
+        const int width = level_width(image, level);
+        if (image->block_bytes) {
+            // The last row of blocks may be cut by the level's edge
+            const int y = textures->row * 4;
+            const int height = level_height(image, level);
+            glCompressedTexSubImage2D(
+                GL_TEXTURE_2D, level, 0, y, width,
+                y + rows * 4 < height ? rows * 4 : height - y, image->format,
+                bytes, NULL);
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, textures->row, width,
+                            rows, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        *fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        textures->pbo = (textures->pbo + 1) % TEXTURE_PBOS;
+    }
+    // Other uploads (e.g. glTexImage2D with NULL) must not read from the PBO
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!dst) {
+        SDL_Log("Failed to map a texture upload buffer\n");
+        return 0;
+    }
+
+    textures->row += rows;
+    if (textures->row == level_rows(image, level)) {
+        textures->level++;
+        textures->row = 0;
+    }
+    return bytes;
+}
+
+// Uploads decoded textures to the GPU, at most TEXTURE_UPLOAD_BYTES per call
+// so that frames stay short. Gets called once per frame. With `wait`, uploads
+// everything, waiting for decoding to finish. Returns 1 if a texture became
+// ready (then textures_get returns it), 0 otherwise.
+int textures_update(textures_t *textures, int wait) {
+    if (!textures) {
+        return 0;
+    }
+
+    TRACE_BEGIN("textures_update");
+    if (!textures->pbos[0]) {
+        glGenBuffers(TEXTURE_PBOS, textures->pbos);
+        for (size_t i = 0; i < TEXTURE_PBOS; i++) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, textures->pbos[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_BYTES, NULL,
+                         GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    int ready = 0;
+    size_t uploaded = 0;
+    while (next_upload(textures, wait)) {
+        size_t bytes =
+            upload_slice(textures, TEXTURE_UPLOAD_BYTES - uploaded, wait);
+        if (bytes == 0) {
+            break;
+        }
+        uploaded += bytes;
+
+        slot_t *slot = textures->slots + textures->uploading;
+        if (textures->level == slot->image->levels) {
+            if (slot->image->generate_mips) {
+                gl_bind_texture(0, slot->texture);
+                glGenerateMipmap(GL_TEXTURE_2D);
+            }
+            slot->ready = 1;
+            ready = 1;
+            SDL_Log("Texture %s uploaded, textures use %.1f of %.1f MiB\n",
+                    slot->filename,
+                    SDL_AtomicGet(&textures->used) / (1024. * 1024.),
+                    textures->budget / (1024. * 1024.));
+            end_upload(textures, slot);
+        }
+    }
+    TRACE_END();
+    return ready;
+}
+
+// Returns a texture, or 0 while it isn't ready (or failed to load), which
+// samples as black
+GLuint textures_get(const textures_t *textures, size_t index) {
+    if (!textures || index >= textures->count ||
+        !textures->slots[index].ready) {
+        return 0;
+    }
+    return textures->slots[index].texture;
+}
+
+void textures_deinit(textures_t *textures) {
+    if (textures) {
+        for (size_t i = 0; i < textures->count; i++) {
+            slot_t *slot = textures->slots + i;
+            free_image(task_wait(slot->task));
+            free_image(slot->image);
+            if (slot->texture) {
+                glDeleteTextures(1, &slot->texture);
+            }
+        }
+        if (textures->pbos[0]) {
+            for (size_t i = 0; i < TEXTURE_PBOS; i++) {
+                if (textures->fences[i]) {
+                    glDeleteSync(textures->fences[i]);
+                }
+            }
+            glDeleteBuffers(TEXTURE_PBOS, textures->pbos);
+        }
+        free(textures->slots);
+        free(textures);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef TEXTURES_H
+#define TEXTURES_H
+
+#include "gl.h"
+#include <stddef.h>
+
+// Forward declaration so that implementation remains opaque
+typedef struct textures_t_ textures_t;
+
+textures_t *textures_init(const char *const *filenames, size_t count,
+                          size_t budget);
+int textures_update(textures_t *textures, int wait);
+GLuint textures_get(const textures_t *textures, size_t index);
+void textures_deinit(textures_t *textures);
+
+#endif
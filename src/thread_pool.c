@@ -0,0 +1,202 @@
+#include <SDL2/SDL.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Upper limit for worker threads, no matter how many cores there are
+#define MAX_THREADS 64
+
+// A job function gets called once for every index in 0..count-1
+typedef void (*job_fn_t)(void *userdata, size_t index);
+
+// Every thread working on a job starts with its own contiguous range of
+// indices, so that neighbouring indices (such as image tiles) tend to run on
+// the same core. A thread which runs out of its own range steals indices from
+// the other ranges. The padding keeps every range on its own cache line, so
+// that threads claiming from their own ranges don't slow each other down.
+typedef struct {
+    SDL_atomic_t next;
+    size_t end;
+    char padding[64 - sizeof(SDL_atomic_t) - sizeof(size_t)];
+} range_t;
+
+// This struct holds the worker threads and the job they are working on.
+// Only one job runs at a time, and the thread which started the job works
+// on it too.
+typedef struct {
+    SDL_Thread *threads[MAX_THREADS];
+    int thread_count;
+    // Guards everything below except the ranges' `next` cursors
+    SDL_mutex *mutex;
+    // Signaled when a new job starts or when the pool shuts down
+    SDL_cond *work_cond;
+    // Signaled when the last busy worker leaves a job
+    SDL_cond *idle_cond;
+    // The current job
+    job_fn_t fn;
+    void *userdata;
+    // Index ranges of the current job, the calling thread's range is last
+    range_t ranges[MAX_THREADS + 1];
+    // Incremented for every new job, so that workers notice new jobs
+    unsigned generation;
+    // Number of workers which are claiming and running indices
+    int busy;
+    int quit;
+} thread_pool_t;
+
+// Claims and runs indices of a job until all indices have been claimed.
+// Starts from range `own` and then steals from the others.
+static void run_job(job_fn_t fn, void *userdata, range_t *ranges,
+                    int range_count, int own) {
+    for (int r = 0; r < range_count; r++) {
+        range_t *range = ranges + (own + r) % range_count;
+        for (;;) {
+            size_t i = (size_t)SDL_AtomicAdd(&range->next, 1);
+            if (i >= range->end) {
+                break;
+            }
+            fn(userdata, i);
+        }
+    }
+}
+
+typedef struct {
+    thread_pool_t *pool;
+    int index;
+} worker_arg_t;
+
+static int worker(void *data) {
+    worker_arg_t *arg = (worker_arg_t *)data;
+    thread_pool_t *pool = arg->pool;
+    int index = arg->index;
+    free(arg);
+    unsigned generation = 0;
+
+    SDL_LockMutex(pool->mutex);
+    for (;;) {
+        while (!pool->quit && pool->generation == generation) {
+            SDL_CondWait(pool->work_cond, pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        // Copy the job while holding the lock, and mark this worker busy so
+        // that the next job can't start before this worker is done
+        generation = pool->generation;
+        job_fn_t fn = pool->fn;
+        void *userdata = pool->userdata;
+        pool->busy++;
+        SDL_UnlockMutex(pool->mutex);
+
+        run_job(fn, userdata, pool->ranges, pool->thread_count + 1, index);
+
+        SDL_LockMutex(pool->mutex);
+        if (--pool->busy == 0) {
+            SDL_CondSignal(pool->idle_cond);
+        }
+    }
+    SDL_UnlockMutex(pool->mutex);
+
+    return 0;
+}
+
+// Starts a thread pool with `threads` worker threads. If `threads` is 0 or
+// less, starts one less than there are CPU cores, because the thread calling
+// thread_pool_for works too.
+thread_pool_t *thread_pool_init(int threads) {
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount() - 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+
+    pool->mutex = SDL_CreateMutex();
+    pool->work_cond = SDL_CreateCond();
+    pool->idle_cond = SDL_CreateCond();
+
+    // Workers are counted before they start, because they use the count to
+    // find every range of a job
+    for (int i = 0; i < threads; i++) {
+        worker_arg_t *arg = malloc(sizeof(worker_arg_t));
+        if (!arg) {
+            break;
+        }
+        arg->pool = pool;
+        arg->index = i;
+        pool->thread_count++;
+        pool->threads[i] = SDL_CreateThread(worker, "worker", arg);
+        if (!pool->threads[i]) {
+            SDL_Log("Failed to create a worker thread: %s\n", SDL_GetError());
+            pool->thread_count--;
+            free(arg);
+            break;
+        }
+    }
+
+    return pool;
+}
+
+// Calls fn(userdata, i) for every i in 0..count-1 on all threads of the pool
+// and the calling thread. Returns when all calls have returned.
+// Calls happen in no particular order. Without a pool (NULL), this just
+// calls fn in order on the calling thread.
+void thread_pool_for(thread_pool_t *pool, size_t count, job_fn_t fn,
+                     void *userdata) {
+    if (!pool) {
+        for (size_t i = 0; i < count; i++) {
+            fn(userdata, i);
+        }
+        return;
+    }
+
+    SDL_LockMutex(pool->mutex);
+    // Wait for workers which are still leaving the previous job
+    while (pool->busy > 0) {
+        SDL_CondWait(pool->idle_cond, pool->mutex);
+    }
+    pool->fn = fn;
+    pool->userdata = userdata;
+    // Split the indices evenly between the workers and the calling thread
+    int range_count = pool->thread_count + 1;
+    for (int i = 0; i < range_count; i++) {
+        SDL_AtomicSet(&pool->ranges[i].next, (int)(count * i / range_count));
+        pool->ranges[i].end = count * (i + 1) / range_count;
+    }
+    pool->generation++;
+    SDL_CondBroadcast(pool->work_cond);
+    SDL_UnlockMutex(pool->mutex);
+
+    run_job(fn, userdata, pool->ranges, range_count, range_count - 1);
+
+    // Every index has been claimed now, but workers may still be running
+    // their last ones
+    SDL_LockMutex(pool->mutex);
+    while (pool->busy > 0) {
+        SDL_CondWait(pool->idle_cond, pool->mutex);
+    }
+    SDL_UnlockMutex(pool->mutex);
+}
+
+void thread_pool_deinit(thread_pool_t *pool) {
+    if (pool) {
+        SDL_LockMutex(pool->mutex);
+        pool->quit = 1;
+        SDL_CondBroadcast(pool->work_cond);
+        SDL_UnlockMutex(pool->mutex);
+
+        for (int i = 0; i < pool->thread_count; i++) {
+            SDL_WaitThread(pool->threads[i], NULL);
+        }
+
+        SDL_DestroyCond(pool->idle_cond);
+        SDL_DestroyCond(pool->work_cond);
+        SDL_DestroyMutex(pool->mutex);
+        free(pool);
+    }
+}
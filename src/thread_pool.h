@@ -0,0 +1,17 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// Forward declaration so that implementation remains opaque
+typedef struct thread_pool_t_ thread_pool_t;
+
+// A job function gets called once for every index in 0..count-1
+typedef void (*job_fn_t)(void *userdata, size_t index);
+
+thread_pool_t *thread_pool_init(int threads);
+void thread_pool_for(thread_pool_t *pool, size_t count, job_fn_t fn,
+                     void *userdata);
+void thread_pool_deinit(thread_pool_t *pool);
+
+#endif
@@ -0,0 +1,191 @@
+// CPU time tracing of scopes marked with TRACE_BEGIN and TRACE_END (trace.h).
+// The result is a Chrome trace_event JSON file, which can be opened in
+// https://ui.perfetto.dev or chrome://tracing.
+//
+// Every thread records its events to its own buffer, found through thread
+// local storage, so recording needs no locks. Buffers grow one block at a
+// time and are only written to the file in trace_deinit.
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Number of events per buffer block
+#define BLOCK_EVENTS 4096
+// Maximum number of threads which can record events
+#define MAX_THREADS 128
+// Maximum nesting of scopes on one thread
+#define MAX_DEPTH 32
+
+// A finished scope, a "complete event" in trace_event terms
+typedef struct {
+    const char *name;
+    uint64_t start, end;
+} event_t;
+
+typedef struct block_t_ {
+    event_t events[BLOCK_EVENTS];
+    size_t count;
+    struct block_t_ *next;
+} block_t;
+
+typedef struct {
+    SDL_threadID thread_id;
+    block_t *first, *last;
+    // Scopes which have begun but not ended yet
+    event_t stack[MAX_DEPTH];
+    int depth;
+} buffer_t;
+
+int trace_enabled = 0;
+
+static const char *trace_filename;
+static uint64_t trace_start;
+static SDL_TLSID tls;
+// Buffers of all threads, registered by claiming a slot with an atomic add
+static buffer_t *buffers[MAX_THREADS];
+static SDL_atomic_t buffer_count;
+
+// Returns the calling thread's buffer, creating it on the thread's first
+// event. Returns NULL if the thread can't record.
+static buffer_t *get_buffer(void) {
+    buffer_t *buffer = SDL_TLSGet(tls);
+    if (buffer) {
+        return buffer;
+    }
+
+    int slot = SDL_AtomicAdd(&buffer_count, 1);
+    if (slot >= MAX_THREADS) {
+        return NULL;
+    }
+    buffer = calloc(1, sizeof(buffer_t));
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->thread_id = SDL_ThreadID();
+    buffers[slot] = buffer;
+    SDL_TLSSet(tls, buffer, NULL);
+    return buffer;
+}
+
+// Turns tracing on, to be written to `filename` in trace_deinit. Does nothing
+// if filename is NULL. Call this before any other threads start.
+void trace_init(const char *filename) {
+    if (!filename) {
+        return;
+    }
+#ifdef SELF_CONTAINED
+    // fopen is wrapped to read embedded data in self-contained builds
+    SDL_Log("Tracing is not available in self-contained builds\n");
+    return;
+#endif
+    tls = SDL_TLSCreate();
+    if (!tls) {
+        SDL_Log("Failed to create TLS for tracing: %s\n", SDL_GetError());
+        return;
+    }
+    trace_filename = filename;
+    trace_start = SDL_GetPerformanceCounter();
+    trace_enabled = 1;
+    SDL_Log("Tracing to %s\n", filename);
+}
+
+void trace_begin(const char *name) {
+    buffer_t *buffer = get_buffer();
+    if (!buffer) {
+        return;
+    }
+    // Scopes deeper than MAX_DEPTH are counted but not recorded
+    if (buffer->depth < MAX_DEPTH) {
+        buffer->stack[buffer->depth].name = name;
+        buffer->stack[buffer->depth].start = SDL_GetPerformanceCounter();
+    }
+    buffer->depth++;
+}
+
+void trace_end(void) {
+    uint64_t end = SDL_GetPerformanceCounter();
+    buffer_t *buffer = get_buffer();
+    if (!buffer || buffer->depth == 0) {
+        return;
+    }
+    buffer->depth--;
+    if (buffer->depth >= MAX_DEPTH) {
+        return;
+    }
+
+    // Start a new block when the last one is full
+    block_t *block = buffer->last;
+    if (!block || block->count == BLOCK_EVENTS) {
+        block = malloc(sizeof(block_t));
+        if (!block) {
+            return;
+        }
+        block->count = 0;
+        block->next = NULL;
+        if (buffer->last) {
+            buffer->last->next = block;
+        } else {
+            buffer->first = block;
+        }
+        buffer->last = block;
+    }
+
+    event_t *event = block->events + block->count++;
+    *event = buffer->stack[buffer->depth];
+    event->end = end;
+}
+
+// Writes all recorded events to the file and frees the buffers. Other
+// threads must not record events anymore.
+void trace_deinit(void) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_enabled = 0;
+
+    FILE *file = fopen(trace_filename, "w");
+    if (!file) {
+        SDL_Log("Failed to open %s for writing\n", trace_filename);
+    }
+
+    // Timestamps are microseconds since trace_init
+    double us = SDL_GetPerformanceFrequency() / 1000000.;
+    size_t total = 0;
+    const char *separator = "";
+    if (file) {
+        fputs("{\"traceEvents\":[\n", file);
+    }
+    int count = SDL_AtomicGet(&buffer_count);
+    for (int i = 0; i < count && i < MAX_THREADS; i++) {
+        buffer_t *buffer = buffers[i];
+        if (!buffer) {
+            continue;
+        }
+        for (block_t *block = buffer->first, *next; block; block = next) {
+            for (size_t j = 0; file && j < block->count; j++) {
+                const event_t *e = block->events + j;
+                fprintf(file,
+                        "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                        "\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                        separator, e->name, (unsigned long)buffer->thread_id,
+                        (e->start - trace_start) / us,
+                        (e->end - e->start) / us);
+                separator = ",\n";
+            }
+            total += block->count;
+            next = block->next;
+            free(block);
+        }
+        free(buffer);
+        buffers[i] = NULL;
+    }
+
+    if (file) {
+        fputs("\n]}\n", file);
+        fclose(file);
+        SDL_Log("Wrote %lu trace events to %s\n", (unsigned long)total,
+                trace_filename);
+    }
+}
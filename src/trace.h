@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Nonzero when trace_init has turned tracing on. The macros check this
+// before calling anything, so that instrumentation costs only a branch when
+// tracing is off.
+extern int trace_enabled;
+
+void trace_init(const char *filename);
+void trace_begin(const char *name);
+void trace_end(void);
+void trace_deinit(void);
+
+// Marks the start and the end of a scope. `name` must be a string which
+// stays valid until trace_deinit, usually a literal.
+#define TRACE_BEGIN(name)                                                      \
+    do {                                                                       \
+        if (trace_enabled) {                                                   \
+            trace_begin(name);                                                 \
+        }                                                                      \
+    } while (0)
+#define TRACE_END()                                                            \
+    do {                                                                       \
+        if (trace_enabled) {                                                   \
+            trace_end();                                                       \
+        }                                                                      \
+    } while (0)
+
+#endif
@@ -12,6 +12,10 @@ typedef struct {
     GLint offset;
     GLsizei name_len;
     GLchar name[UFM_NAME_MAX];
+    // Baked sync track index + 1 of every component, 0 when not looked up
+    // yet and -1 when there's no track. Only used in release builds, see
+    // sync_tracks.c and demo.c.
+    int track_index[4];
 } uniform_t;
 
 typedef struct {